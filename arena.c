@@ -0,0 +1,89 @@
+// arena.c - Allocates the structures that live as long as a program does (source lines, labels, conditions) in big blocks, freed all at once
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+#define ARENA_ALIGN 16
+
+static size_t align_up(size_t size) {
+	return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+/*
+  Returns size bytes of memory from the arena, aligned for any type, or NULL if there is not
+  enough memory. The memory isn't cleared
+*/
+void *arena_alloc(Arena *arena, size_t size) {
+	ArenaBlock *block = arena->blocks;
+	size_t header = align_up(sizeof(ArenaBlock)), block_size;
+
+	size = align_up(size ? size : 1);
+
+	if (block == NULL || block->used + size > block->size) {
+		block_size = (size > ARENA_BLOCK_SIZE - header) ? size : ARENA_BLOCK_SIZE - header;
+		block = malloc(header + block_size);
+
+		if (block == NULL)
+			return NULL;
+
+		block->used = 0;
+		block->size = block_size;
+
+		// a block for one big allocation goes behind the current one, which still has room
+		if (size > ARENA_BLOCK_SIZE - header && arena->blocks != NULL) {
+			block->next = arena->blocks->next;
+			arena->blocks->next = block;
+		} else {
+			block->next = arena->blocks;
+			arena->blocks = block;
+		}
+	}
+
+	block->used += size;
+	return (char*)block + header + block->used - size;
+}
+
+// Returns a copy of str in the arena, or NULL if there is not enough memory
+char *arena_strdup(Arena *arena, char *str) {
+	size_t len = strlen(str) + 1;
+	char *copy = arena_alloc(arena, len);
+
+	if (copy != NULL)
+		memcpy(copy, str, len);
+
+	return copy;
+}
+
+// Moves everything allocated in from into arena, leaving from empty
+void arena_merge(Arena *arena, Arena *from) {
+	ArenaBlock *last = from->blocks;
+
+	if (last == NULL)
+		return;
+
+	while (last->next != NULL)
+		last = last->next;
+
+	// from's blocks go behind arena's current block, which may still have room
+	if (arena->blocks == NULL) {
+		arena->blocks = from->blocks;
+	} else {
+		last->next = arena->blocks->next;
+		arena->blocks->next = from->blocks;
+	}
+
+	from->blocks = NULL;
+}
+
+// Frees everything allocated in the arena, leaving it empty
+void arena_free(Arena *arena) {
+	ArenaBlock *block = arena->blocks, *next;
+
+	while (block != NULL) {
+		next = block->next;
+		free(block);
+		block = next;
+	}
+
+	arena->blocks = NULL;
+}
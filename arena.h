@@ -0,0 +1,28 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+#include "common.h"
+
+#define ARENA_BLOCK_SIZE (64 * 1024) // bigger allocations get a block of their own
+
+/*
+  A block of memory that allocations are carved out of one after another, followed by its
+  data. Blocks are never freed on their own, only all together by arena_free
+*/
+typedef struct _ArenaBlock {
+	struct _ArenaBlock *next; // the block allocated before this one
+	size_t used, size;
+} ArenaBlock;
+
+// An arena with no blocks (all zeros) is empty and ready to use
+typedef struct _Arena {
+	ArenaBlock *blocks; // newest first
+} Arena;
+
+void *arena_alloc(Arena *arena, size_t size);
+char *arena_strdup(Arena *arena, char *str);
+void arena_merge(Arena *arena, Arena *from);
+void arena_free(Arena *arena);
+
+#endif
@@ -6,21 +6,153 @@
 #include <stdarg.h>
 #include <math.h>
 #include <ctype.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "simulator.h"
 #include "common.h"
 #include "assembler.h"
-#include "debugger.h"
 #include "parser.h"
+#include "memory.h"
+#include "object.h"
+#include "cache.h"
+#include "parallel.h"
 
-// Writes a byte to memory
-void write_uint8(uint8 val) {
-	memory[mem_len++] = val;
+/*
+  Called before len bytes are written at mem_len. Below asm_end (a .pos has moved back)
+  they may land on the placeholder of a fixup, whose bytes then keep what is written now,
+  as they would have if the label had been known when that fixup was made
+*/
+static void rewrite_fixups(Y86Machine *m, int len) {
+	uint64 addr;
+	int i, j;
+
+	if (m->mem_len >= m->asm_end) {
+		m->asm_end = m->mem_len + len;
+		return;
+	}
+
+	for (i = 0; i < m->num_fixups; i++)
+		for (j = 0, addr = m->fixups[i].addr; j < 4; j++, addr++)
+			if (addr >= m->mem_len && addr < m->mem_len + len)
+				m->fixups[i].rewritten |= 1 << j;
+
+	if (m->mem_len + len > m->asm_end)
+		m->asm_end = m->mem_len + len;
+}
+
+// Writes a byte to memory (parse_line has made sure the instruction fits)
+void write_uint8(Y86Machine *m, uint8 val) {
+	rewrite_fixups(m, 1);
+
+	if (!mem_write8(m, m->mem_len, val))
+		sim_error(m, "Not enough memory for the page at 0x%x", (uint32)m->mem_len & ~PAGE_MASK);
+
+	m->mem_len++;
 }
 
 // Writes a 4 byte integer to memory
-void write_uint32(uint32 val) {
-	*((uint32*)&memory[mem_len]) = val;
-	mem_len += 4;
+void write_uint32(Y86Machine *m, uint32 val) {
+	rewrite_fixups(m, 4);
+
+	if (!mem_write32(m, m->mem_len, val))
+		sim_error(m, "Not enough memory for the page at 0x%x", (uint32)m->mem_len & ~PAGE_MASK);
+
+	m->mem_len += 4;
+}
+
+// Checks if str could be the name of a label (letters, digits and underscores)
+static int is_label_name(char *str) {
+	for (; *str != '\0'; str++)
+		if (!is_alphanumeric(*str) && *str != '_')
+			return 0;
+	
+	return 1;
+}
+
+/*
+  Records that the 4 bytes just written (before the current address) are the address of
+  the label name, which hasn't been defined yet. A weak fixup is only patched if the label
+  turns up, otherwise what was written stays. Returns 1 on success, 0 if there is not enough memory
+*/
+int add_fixup(Y86Machine *m, char *name, int weak) {
+	Fixup *fixups = realloc(m->fixups, (m->num_fixups + 1) * sizeof(Fixup));
+	
+	if (fixups == NULL)
+		return 0;
+	
+	m->fixups = fixups;
+	fixups[m->num_fixups].addr = m->mem_len - 4;
+	fixups[m->num_fixups].name = strdup(name);
+	fixups[m->num_fixups].line = NULL;
+	fixups[m->num_fixups].weak = weak;
+	fixups[m->num_fixups].rewritten = 0;
+	
+	if (fixups[m->num_fixups].name == NULL)
+		return 0;
+	
+	m->num_fixups++;
+	return 1;
+}
+
+// Writes the address of a label, or a placeholder and a fixup if the label comes later in the source
+static int write_label_addr(Y86Machine *m, char *name) {
+	Label *label = find_label(m, name);
+	
+	if (label == NULL) {
+		DBG_PRINT("Label %s isn't defined yet, adding a fixup at %lx\n", name, (long)m->mem_len);
+		
+		write_uint32(m, 0);
+		return add_fixup(m, name, 0);
+	}
+	
+	write_uint32(m, label->addr);
+	return 1;
+}
+
+/*
+  Patches every fixup with the address of its label, now that all of the labels are known,
+  but for any bytes a later line wrote over (see rewrite_fixups)
+  Returns 1 on success, 0 if a label is never defined (after reporting the line using it)
+*/
+int resolve_fixups(Y86Machine *m) {
+	Label *label;
+	int i, j;
+	
+	for (i = 0; i < m->num_fixups; i++) {
+		label = find_label(m, m->fixups[i].name);
+		
+		if (label != NULL && !m->fixups[i].rewritten) {
+			mem_write32(m, m->fixups[i].addr, label->addr);
+		} else if (label != NULL) {
+			for (j = 0; j < 4; j++)
+				if (!(m->fixups[i].rewritten & (1 << j)))
+					mem_write8(m, m->fixups[i].addr + j, label->addr >> (j * 8));
+		} else if (!m->fixups[i].weak) {
+			DBG_PRINT("Invalid label name %s\n", m->fixups[i].name);
+			sim_error(m, "parser: Error processing %s", m->fixups[i].line);
+			return 0;
+		}
+	}
+	
+	return 1;
+}
+
+// Frees the fixups left over from assembling
+void free_fixups(Y86Machine *m) {
+	int i;
+	
+	for (i = 0; i < m->num_fixups; i++) {
+		free(m->fixups[i].name);
+		free(m->fixups[i].line);
+	}
+	
+	free(m->fixups);
+	m->fixups = NULL;
+	m->num_fixups = 0;
+	m->asm_end = 0;
 }
 
 /*
@@ -31,16 +163,13 @@ void write_uint32(uint32 val) {
    
   Supports rmmovl, mrmovl
 */
-int reg_mem_codegen(char *cmd, char **args) {
+int reg_mem_codegen(Y86Machine *m, Mnemonic *mn, char **args) {
 	char *reg = args[0]; // source for rmmovl (dest for mrmovl) e.g. %ecx -- TODO: add check to verify valid register (use reg_num)
 	char *mem_addr = args[1]; // dest for rmmovl (source for mrmovl), e.g. 16(%ebx) or MyLabel
   
-	if (strcmp(cmd, "rmmovl") == 0) {
-		write_uint8(0x40);
-		reg = args[0];
-		mem_addr = args[1];
-	} else {
-		write_uint8(0x50);
+	write_uint8(m, mn->opcode);
+	
+	if (mn->opcode == 0x50) {
 		reg = args[1];
 		mem_addr = args[0];
 	}
@@ -65,29 +194,19 @@ int reg_mem_codegen(char *cmd, char **args) {
 		
 		DBG_PRINT("Supplied as reg: offset=%d, mem_addr_reg=%s, reg=%s\n", offset, mem_addr_reg, reg);
 		
-		write_uint8((reg_name_to_num(reg + 1) << 4) |
+		write_uint8(m, (reg_name_to_num(reg + 1) << 4) |
 					reg_name_to_num(mem_addr_reg));
-		write_uint32(offset);
+		write_uint32(m, offset);
 	} else {
 		// mem_addr is supplied as a label
-		char *label_name;
-    
-		if (strcmp(cmd, "rmmovl") == 0)
-			label_name = args[1];
-		else
-			label_name = args[0];
+		char *label_name = mem_addr;
 		
 		DBG_PRINT("Supplied as label - %s\n", label_name);
 		
-		Label *label = find_label(label_name);
+		write_uint8(m, (reg_name_to_num(reg + 1) << 4) | 8);
 		
-		if (label == NULL) {
-			DBG_PRINT("Invalid label\n");
+		if (!write_label_addr(m, label_name))
 			return 0;
-		}
-
-		write_uint8((reg_name_to_num(reg + 1) << 4) | 8);
-		write_uint32(label->addr);
 	}
 	
 	return 1;
@@ -99,21 +218,9 @@ int reg_mem_codegen(char *cmd, char **args) {
     
   Supports rdint, rdch, wrint, wrch, pushl, popl
 */
-int reg_num_codegen(char *cmd, char **args) {
-	if (strcmp(cmd, "rdint") == 0)
-		write_uint8(0xf2);
-	else if (strcmp(cmd, "rdch") == 0)
-		write_uint8(0xf0);
-	else if (strcmp(cmd, "wrint") == 0)
-		write_uint8(0xf3);
-	else if (strcmp(cmd, "wrch") == 0)
-		write_uint8(0xf1);
-	else if (strcmp(cmd, "pushl") == 0)
-		write_uint8(0xa0);
-	else if (strcmp(cmd, "popl") == 0)
-		write_uint8(0xb0);
-	
-	write_uint8((reg_name_to_num(args[0] + 1) << 4) | 8);
+int reg_num_codegen(Y86Machine *m, Mnemonic *mn, char **args) {
+	write_uint8(m, mn->opcode);
+	write_uint8(m, (reg_name_to_num(args[0] + 1) << 4) | 8);
 	return 1;
 }
 
@@ -123,25 +230,9 @@ int reg_num_codegen(char *cmd, char **args) {
     
   Supports addl, subl, rrmovl, xorl, andl
 */
-int reg_nums_mask_codegen(char *cmd, char **args) {
-	if (strcmp(cmd, "addl") == 0)
-		write_uint8(0x60);
-	else if (strcmp(cmd, "subl") == 0)
-		write_uint8(0x61);
-	else if (strcmp(cmd, "rrmovl") == 0)
-		write_uint8(0x20);
-	else if (strcmp(cmd, "xorl") == 0)
-		write_uint8(0x63);
-	else if (strcmp(cmd, "andl") == 0)
-		write_uint8(0x62);
-	else if (strcmp(cmd, "multl") == 0)
-		write_uint8(0x64);
-	else if (strcmp(cmd, "divl") == 0)
-		write_uint8(0x65);
-	else if (strcmp(cmd, "modl") == 0)
-		write_uint8(0x66);
-	
-	write_uint8((reg_name_to_num(args[0] + 1) << 4) | reg_name_to_num(args[1] + 1));
+int reg_nums_mask_codegen(Y86Machine *m, Mnemonic *mn, char **args) {
+	write_uint8(m, mn->opcode);
+	write_uint8(m, (reg_name_to_num(args[0] + 1) << 4) | reg_name_to_num(args[1] + 1));
 	return 1;
 }
 
@@ -149,14 +240,8 @@ int reg_nums_mask_codegen(char *cmd, char **args) {
   Codegen function for instructions that have no operands
   Supports halt, ret
 */
-int no_operands_codegen(char *cmd, char **args) {
-	if (strcmp(cmd, "halt") == 0)
-		write_uint8(0x10);   
-	else if (strcmp(cmd, "ret") == 0)
-		write_uint8(0x90);
-	else if (strcmp(cmd, "nop") == 0)
-		write_uint8(0x0);
-  
+int no_operands_codegen(Y86Machine *m, Mnemonic *mn, char **args) {
+	write_uint8(m, mn->opcode);
 	return 1;
 }
 
@@ -166,177 +251,279 @@ int no_operands_codegen(char *cmd, char **args) {
     
   Supports je, jle, jmp, jg, jl, jne, jge, call
 */
-int label_addr_codegen(char *cmd, char **args) {
-	if (strcmp(cmd, "je") == 0)
-		write_uint8(0x73);
-	else if (strcmp(cmd, "jle") == 0)
-		write_uint8(0x71);
-	else if (strcmp(cmd, "jmp") == 0)
-		write_uint8(0x70);
-	else if (strcmp(cmd, "jg") == 0)
-		write_uint8(0x76);
-	else if (strcmp(cmd, "jl") == 0)
-		write_uint8(0x72);
-	else if (strcmp(cmd, "jne") == 0)
-		write_uint8(0x74);
-	else if (strcmp(cmd, "jge") == 0)
-		write_uint8(0x75);
-	else if (strcmp(cmd, "call") == 0)
-		write_uint8(0x80);
-  
-    Label *label = find_label(args[0]);
-	
-	if (label == NULL) {
-		DBG_PRINT("Invalid label name %s (len = %d)\n", args[0], (int)strlen(args[0]));
-		return 0;
-	}
-	
-	DBG_PRINT("Label addr: %d, mem_len = %d\n", label->addr, mem_len);
-	write_uint32(label->addr);
-	return 1;
+int label_addr_codegen(Y86Machine *m, Mnemonic *mn, char **args) {
+	write_uint8(m, mn->opcode);
+	return write_label_addr(m, args[0]);
 }
 
 // Codegen function for irmovl
-int irmovl_codegen(char *cmd, char **args) {
-	write_uint8(0x30);
-	write_uint8(reg_name_to_num(args[1]+1) | 0x80); // | 0x80 for yis/yas compatibility (signifies no register)
+int irmovl_codegen(Y86Machine *m, Mnemonic *mn, char **args) {
+	write_uint8(m, mn->opcode);
+	write_uint8(m, reg_name_to_num(args[1]+1) | 0x80); // | 0x80 for yis/yas compatibility (signifies no register)
 	
-	Label *label = find_label(args[0]);
+	Label *label = find_label(m, args[0]);
+	char *data = args[0];
 	
 	if (label != NULL) {
-		write_uint32(label->addr);
-	} else {
-		char *data = args[0];
-		if (*data == '$')
-			data++;
-		
-		if (!valid_stol_str(data)) {
-			DBG_PRINT("Invalid argument to irmovl %s\n", data);
-			return 0;
-		}
-		
-		write_uint32(stol(data));
+		write_uint32(m, label->addr);
+		return 1;
 	}
 	
-	return 1;
+	if (*data == '$')
+		data++;
+	
+	// not a number, so it has to be a label that comes later
+	if (!valid_stol_str(data))
+		return write_label_addr(m, args[0]);
+	
+	write_uint32(m, stol(data));
+	
+	// a later label with this name would win over the number, as it does for an earlier one
+	return data != args[0] || !is_label_name(data) || add_fixup(m, data, 1);
 }
 
 // Codegen for .long
-int long_codegen(char *cmd, char **args) {
-	write_uint32(stol(args[0]));
+int long_codegen(Y86Machine *m, Mnemonic *mn, char **args) {
+	write_uint32(m, stol(args[0]));
 	return 1;
 }
 
 // Codegen for .pos (doesn't actually write any code to memory)
-int pos_codegen(char *cmd, char **args) {
-	int new_pos = stol(args[0]);
+int pos_codegen(Y86Machine *m, Mnemonic *mn, char **args) {
+	long new_pos = stol(args[0]);
     
-	DBG_PRINT("new_pos = %d (str: %s)\n", new_pos, args[0]);
+	DBG_PRINT("new_pos = %ld (str: %s)\n", new_pos, args[0]);
 	
-	if (new_pos > sizeof(memory))
+	if (new_pos < 0 || new_pos > m->mem_size)
 		return 0;
 	
-	mem_len = new_pos;
+	m->mem_len = new_pos;
 	return 1;
 }
 
 // Codegen for .align (doesn't actually write any code to memory)
-int align_codegen(char *cmd, char **args) {
-	int align_by = stol(args[0]);
-	int new_pos = round_up_to_nearest(mem_len, align_by);
+int align_codegen(Y86Machine *m, Mnemonic *mn, char **args) {
+	long align_by = stol(args[0]);
+	long new_pos = round_up_to_nearest(m->mem_len, align_by);
 	
-	if (new_pos > sizeof(memory))
+	if (new_pos > m->mem_size)
 		return 0;
 	
-	mem_len = new_pos;
+	m->mem_len = new_pos;
 	return 1;
 }
 
 /*
-  Returns the size of an instruction, in bytes
-  addr parameter is needed for .pos/.align directives (since their "size" depends on their addr)
+  Every instruction and directive the assembler knows. The parser, get_instr_size and
+  the debugger all look mnemonics up here (see find_mnemonic), through a hash table
 */
-int get_instr_size(char *instr_name, uint16 addr) {
+static Mnemonic mnemonics[] = {
+	/* name, op code, size of instruction, number of operands, codegen function */
+	{"irmovl", 0x30, 6, 2, irmovl_codegen},
+	{"rmmovl", 0x40, 6, 2, reg_mem_codegen},
+	{"mrmovl", 0x50, 6, 2, reg_mem_codegen},
+	{"rrmovl", 0x20, 2, 2, reg_nums_mask_codegen},
+	{"rdint", 0xf2, 2, 1, reg_num_codegen},
+	{"rdch", 0xf0, 2, 1, reg_num_codegen},
+	{"wrint", 0xf3, 2, 1, reg_num_codegen},
+	{"wrch", 0xf1, 2, 1, reg_num_codegen},
+	{"nop", 0x00, 1, 0, no_operands_codegen},
+	{"halt", 0x10, 1, 0, no_operands_codegen},
+	{"jmp", 0x70, 5, 1, label_addr_codegen},
+	{"addl", 0x60, 2, 2, reg_nums_mask_codegen},
+	{"subl", 0x61, 2, 2, reg_nums_mask_codegen},
+	{"xorl", 0x63, 2, 2, reg_nums_mask_codegen},
+	{"andl", 0x62, 2, 2, reg_nums_mask_codegen},
+	{"multl", 0x64, 2, 2, reg_nums_mask_codegen},
+	{"divl", 0x65, 2, 2, reg_nums_mask_codegen},
+	{"modl", 0x66, 2, 2, reg_nums_mask_codegen},
+	{"je", 0x73, 5, 1, label_addr_codegen},
+	{"jle", 0x71, 5, 1, label_addr_codegen},
+	{"jg", 0x76, 5, 1, label_addr_codegen},
+	{"jl", 0x72, 5, 1, label_addr_codegen},
+	{"jne", 0x74, 5, 1, label_addr_codegen},
+	{"jge", 0x75, 5, 1, label_addr_codegen},
+	{"pushl", 0xa0, 2, 1, reg_num_codegen},
+	{"popl", 0xb0, 2, 1, reg_num_codegen},
+	{"call", 0x80, 5, 1, label_addr_codegen},
+	{"ret", 0x90, 1, 0, no_operands_codegen},
+	{".long", 0x00, 4, 1, long_codegen},
+	{".pos", 0x00, 0, 1, pos_codegen},
+	{".align", 0x00, 0, 1, align_codegen}
+};
+
+#define NUM_MNEMONICS (int)(sizeof(mnemonics) / sizeof(Mnemonic))
+
+static Mnemonic *mnemonic_table[MNEMONIC_SLOTS]; // open addressing, built once by build_mnemonic_table
+static pthread_once_t mnemonic_table_once = PTHREAD_ONCE_INIT;
+
+// Hashes the first len characters of name (32 bit FNV-1a)
+static uint32 hash_mnemonic(char *name, int len) {
+	uint32 hash = 2166136261u;
 	int i;
 	
-	if (*instr_name == '.') {    
-		if (strncmp(instr_name, ".pos", 4) == 0)
-			return stol(&instr_name[5]) - addr;
-		
-		else if (strncmp(instr_name, ".align", 6) == 0) {
-			int align_by = stol(&instr_name[7]);
-			int new_pos = round_up_to_nearest(addr, align_by);
-			return new_pos - addr;
-		}
-		
-		else if (strncmp(instr_name, ".long", 5) == 0)
-			return 4;
-        
-		else {
-			return 0;
-		}
-	} else {
-		char *space = strchr(instr_name, ' ');
-		int size = 0;
+	for (i = 0; i < len; i++)
+		hash = (hash ^ (uint8)name[i]) * 16777619u;
+	
+	return hash;
+}
+
+static void build_mnemonic_table(void) {
+	int i;
+	uint32 slot;
+	
+	for (i = 0; i < NUM_MNEMONICS; i++) {
+		mnemonics[i].len = strlen(mnemonics[i].name);
+		slot = hash_mnemonic(mnemonics[i].name, mnemonics[i].len) & (MNEMONIC_SLOTS - 1);
 		
-		if (space != NULL)
-			*space = '\0'; // separate instruction name from parameters
-  
-		for (i = 0; i < num_instrs; i++) {
-			if (strcmp(instrs[i].name, instr_name) == 0) {
-				size = instrs[i].size;
-				break;
-			}
-		}
+		while (mnemonic_table[slot] != NULL)
+			slot = (slot + 1) & (MNEMONIC_SLOTS - 1);
 		
-		if (space != NULL)
-			*space = ' ';
+		mnemonic_table[slot] = &mnemonics[i];
+	}
+}
+
+// Returns the instruction or directive that is the first len characters of name, or NULL if there isn't one
+Mnemonic *find_mnemonic(char *name, int len) {
+	Mnemonic *mn;
+	uint32 slot;
+	
+	pthread_once(&mnemonic_table_once, build_mnemonic_table);
+	slot = hash_mnemonic(name, len) & (MNEMONIC_SLOTS - 1);
+	
+	while ((mn = mnemonic_table[slot]) != NULL) {
+		if (mn->len == len && memcmp(mn->name, name, len) == 0)
+			return mn;
 		
-		return size;
+		slot = (slot + 1) & (MNEMONIC_SLOTS - 1);
 	}
+	
+	return NULL;
 }
 
-// Builds the program memory
-int gen_bytecode(char *filename) {
-	FILE *str_in;
-	char line_in[4096];
-	int i;
+// Returns the length of the mnemonic at the start of line, i.e. everything up to the first space
+int mnemonic_len(char *line) {
+	int len = 0;
 	
-	mem_len = 0;
-	memset(memory, 0, sizeof(memory));
+	while (line[len] != '\0' && !is_whitespace(line[len]))
+		len++;
 	
-	str_in = fopen(filename, "r");
-	if (str_in == NULL) {
+	return len;
+}
+
+/*
+  Returns the size of the instruction on a line in the format format_y86_line gives, in bytes
+  addr parameter is needed for .pos/.align directives (since their "size" depends on their addr)
+*/
+long get_instr_size(char *line, uint32 addr) {
+	int len = mnemonic_len(line);
+	Mnemonic *mn = find_mnemonic(line, len);
+	
+	if (mn == NULL)
+		return 0;
+	
+	if (mn->codegen == pos_codegen)
+		return stol(&line[len + 1]) - addr;
+	
+	if (mn->codegen == align_codegen)
+		return round_up_to_nearest(addr, stol(&line[len + 1])) - addr;
+	
+	return mn->size;
+}
+
+/*
+  Builds the program memory. The source file is mapped into memory and each line is
+  formatted straight out of the mapping, so nothing is copied or allocated per line but the
+  source line that is kept. A program that was assembled before is loaded from the cache
+  (see cache.c) instead, and a program that wasn't is added to it
+*/
+int gen_bytecode(Y86Machine *m, char *filename) {
+	struct stat st;
+	char *file = NULL, *p, *eol, line[MAX_LINE_LEN], cache_file[4096];
+	int fd, i, use_cache, ret = SUCC;
+	
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
 		DBG_PRINT("Error opening %s for reading\n", filename);
 		return INVALID_FILE;
 	}
 	
-	parse_labels(str_in);
-	rewind(str_in);
+	if (fstat(fd, &st) != 0 ||
+		(st.st_size > 0 && (file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)) {
+		close(fd);
+		return INVALID_FILE;
+	}
 	
-	while (read_y86_line(str_in, line_in, sizeof(line_in))) {
-		if (!parse_line(line_in)) {
-			DBG_PRINT("Error parsing %s\n", line_in);
-			return PARSE_ERROR;
+	close(fd);
+	use_cache = cache_path(m, file, st.st_size, cache_file, sizeof(cache_file));
+	
+	if (use_cache && load_obj_file(m, cache_file, 0) == SUCC) {
+		DBG_PRINT("Loaded %s from %s\n", filename, cache_file);
+		
+		if (file != NULL)
+			munmap(file, st.st_size);
+		
+		return SUCC;
+	}
+	
+	m->mem_len = 0;
+	mem_clear(m);
+	
+	// forget the labels and source lines of any program assembled before
+	free_program(m);
+	
+	// a big source is assembled on several threads, unless it has something only the serial pass below handles
+	if (file != NULL && gen_bytecode_parallel(m, file, st.st_size))
+		p = NULL;
+	else
+		p = file;
+	
+	// one pass through the source, uses of labels defined further on are patched at the end
+	for (; p != NULL && p < file + st.st_size; p = eol + 1) {
+		eol = memchr(p, '\n', file + st.st_size - p);
+		
+		if (eol == NULL)
+			eol = file + st.st_size;
+		
+		// a line that isn't understood ends the program
+		if (!format_y86_line(p, eol - p, line, sizeof(line)))
+			break;
+		
+		if (!parse_line(m, line)) {
+			DBG_PRINT("Error parsing %s\n", line);
+			ret = PARSE_ERROR;
+			break;
 		}
 		
 		DBG_PRINT("\n\n\n");
 	}
 	
-	fclose(str_in);
+	if (file != NULL)
+		munmap(file, st.st_size);
+	
+	if (ret == SUCC && !resolve_fixups(m))
+		ret = PARSE_ERROR;
+	
+	free_fixups(m);
+	
+	if (ret != SUCC)
+		return ret;
 	
 	DBG_PRINT("LABELS =>\n");
-	for (i = 0; i < num_labels; i++)
-		DBG_PRINT("%s %d\n", labels[i]->name, labels[i]->addr);
+	for (i = 0; i < m->num_labels; i++)
+		DBG_PRINT("%s %d\n", m->labels[i]->name, m->labels[i]->addr);
+	
+	if (use_cache)
+		cache_store(m, cache_file);
 	
 	return SUCC;
 }
 
 // Generates a yis compatible yo file
-int gen_yo_file(char *filename) {
-	int i;
+int gen_yo_file(Y86Machine *m, char *filename) {
+	long i;
 	FILE *out = fopen(filename, "w+");
-	SourceLine *cur_line = source_lines;
+	SourceLine *cur_line = m->source_lines;
 	
 	if (out == NULL)
 		return 0;
@@ -347,8 +534,8 @@ int gen_yo_file(char *filename) {
 		if (!is_label_line(cur_line->line) && strncmp(cur_line->line, ".pos", 4) && strncmp(cur_line->line, ".align", 6)) {
 			int instr_size = get_instr_size(cur_line->line, cur_line->addr);
       
-			for (i = cur_line->addr; i < cur_line->addr + instr_size; i++)
-				fprintf(out, "%02x", memory[i]);
+			for (i = cur_line->addr; i < (long)cur_line->addr + instr_size; i++)
+				fprintf(out, "%02x", mem_read8(m, i));
 			for (i = 0; i < 13 - 2*instr_size; i++)
 				fprintf(out, " ");
 			fprintf(out, "| ");
@@ -2,17 +2,37 @@
 #define ASSEMBLER_H
 #include "common.h"
 
-int reg_mem_codegen(char *cmd, char **args);
-int reg_num_codegen(char *cmd, char **args);
-int reg_nums_mask_codegen(char *cmd, char **args);
-int no_operands_codegen(char *cmd, char **args);
-int label_addr_codegen(char *cmd, char **args);
-int irmovl_codegen(char *cmd, char **args);
-int long_codegen(char *cmd, char **args);
-int pos_codegen(char *cmd, char **args);
-int align_codegen(char *cmd, char **args);
-int gen_bytecode(char *filename);
-int gen_yo_file(char *filename);
-int get_instr_size(char *instr_name, uint16 addr);
+#define MNEMONIC_SLOTS 64 // size of the mnemonic hash table, a power of 2 at least twice the number of mnemonics
+
+/*
+  An instruction or directive the assembler knows, with everything the parser needs to
+  assemble it: the codegen function decides how the operands are laid out
+*/
+typedef struct _Mnemonic {
+	char *name;
+	uint8 opcode; // first byte of the instruction, unused for directives
+	int size; // in bytes, 0 for .pos and .align whose size depends on their address
+	int num_args;
+	int (*codegen)(Y86Machine *, struct _Mnemonic *, char **); // returns 1 on success, 0 on error
+	int len; // strlen(name), set when the hash table is built
+} Mnemonic;
+
+int reg_mem_codegen(Y86Machine *m, Mnemonic *mn, char **args);
+int reg_num_codegen(Y86Machine *m, Mnemonic *mn, char **args);
+int reg_nums_mask_codegen(Y86Machine *m, Mnemonic *mn, char **args);
+int no_operands_codegen(Y86Machine *m, Mnemonic *mn, char **args);
+int label_addr_codegen(Y86Machine *m, Mnemonic *mn, char **args);
+int irmovl_codegen(Y86Machine *m, Mnemonic *mn, char **args);
+int long_codegen(Y86Machine *m, Mnemonic *mn, char **args);
+int pos_codegen(Y86Machine *m, Mnemonic *mn, char **args);
+int align_codegen(Y86Machine *m, Mnemonic *mn, char **args);
+Mnemonic *find_mnemonic(char *name, int len);
+int mnemonic_len(char *line);
+int add_fixup(Y86Machine *m, char *name, int weak);
+int resolve_fixups(Y86Machine *m);
+void free_fixups(Y86Machine *m);
+int gen_bytecode(Y86Machine *m, char *filename);
+int gen_yo_file(Y86Machine *m, char *filename);
+long get_instr_size(char *line, uint32 addr);
 
 #endif
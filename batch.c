@@ -0,0 +1,90 @@
+// batch.c - I/O hooks for running a machine without the console (see y86sim --batch)
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "batch.h"
+
+void batch_init_output(BatchOutput *out, int fd) {
+	out->fd = fd;
+	out->len = 0;
+	out->failed = 0;
+}
+
+/*
+  Writes everything in the buffer to the output's fd
+  Returns 1 on success, 0 if the write failed
+*/
+int batch_flush(BatchOutput *out) {
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < out->len && !out->failed) {
+		n = write(out->fd, out->buf + done, out->len - done);
+
+		if (n < 0 && errno != EINTR)
+			out->failed = 1;
+		else if (n > 0)
+			done += n;
+	}
+
+	out->len = 0;
+	return !out->failed;
+}
+
+static void batch_append(BatchOutput *out, const char *str, size_t len) {
+	if (out->len + len > BATCH_OUT_SIZE)
+		batch_flush(out);
+
+	memcpy(out->buf + out->len, str, len);
+	out->len += len;
+}
+
+// anything already written is flushed first, so a prompt is visible before the program waits for input
+static void batch_read_int(void *ctx, uint32_t *reg) {
+	int val;
+
+	batch_flush(ctx);
+
+	if (scanf("%d", &val) == 1)
+		*reg = val;
+}
+
+// only the low byte of the register is replaced, like the console's rdch
+static void batch_read_char(void *ctx, uint32_t *reg) {
+	int c;
+
+	batch_flush(ctx);
+	c = getchar();
+
+	if (c != EOF)
+		*reg = (*reg & ~0xFF) | (uint8_t)c;
+}
+
+static void batch_write_int(void *ctx, uint32_t val) {
+	char str[16];
+
+	batch_append(ctx, str, snprintf(str, sizeof(str), "%d", (int)val));
+}
+
+static void batch_write_char(void *ctx, uint32_t val) {
+	BatchOutput *out = ctx;
+
+	if (out->len == BATCH_OUT_SIZE)
+		batch_flush(out);
+
+	out->buf[out->len++] = (char)val;
+}
+
+// errors go straight to stderr, after any output that came before them
+static void batch_error(void *ctx, const char *msg) {
+	batch_flush(ctx);
+	fprintf(stderr, "%s\n", msg);
+}
+
+// Makes the machine read from stdin, write its output to out and print errors on stderr
+void batch_set_io(Y86Machine *m, BatchOutput *out) {
+	Y86IO io = {batch_read_int, batch_read_char, batch_write_int, batch_write_char, batch_error, out};
+
+	y86_set_io(m, &io);
+}
@@ -0,0 +1,21 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include "y86sim.h"
+
+#define BATCH_OUT_SIZE 65536 // bytes of program output collected before each write(2)
+
+// Output written by wrint/wrch in batch mode, flushed to fd when the buffer fills up
+typedef struct _BatchOutput {
+	int fd;
+	size_t len;
+	int failed; // a write to fd failed, further output is dropped
+	char buf[BATCH_OUT_SIZE];
+} BatchOutput;
+
+void batch_init_output(BatchOutput *out, int fd);
+int batch_flush(BatchOutput *out);
+void batch_set_io(Y86Machine *m, BatchOutput *out);
+
+#endif
@@ -0,0 +1,787 @@
+// batchrun.c - y86sim-batch, runs many y86 programs in parallel and reports how each one did
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "y86sim.h"
+
+#define SLICE_INSTRS 1000000 // instructions run between checks of the job's time limit
+#define MAX_OUTPUT (16*1024*1024) // output beyond this is dropped and the job fails
+#define MAX_LANES 1024 // most jobs run as one group with --lockstep
+
+// RESULTS OF A JOB //
+#define JOB_PASS 0 // halted, and the output matched (or there was nothing to compare it to)
+#define JOB_FAIL 1 // halted, but the output didn't match
+#define JOB_ERROR 2 // couldn't be loaded, hit an invalid instruction or memory access
+#define JOB_INSTR_LIMIT 3 // executed --max-instrs instructions without halting
+#define JOB_TIMEOUT 4 // ran for longer than --timeout seconds
+
+static char *job_results[] = {"pass", "fail", "error", "instr_limit", "timeout"};
+
+typedef struct _Job {
+	char *program;
+	char *input; // file given to rdint/rdch, NULL for no input
+	char *expected; // file the output is compared with, NULL to only check that it halts
+
+	int result; // JOB_* constant
+	int status; // STAT_* code y86_run returned, 0 if the program was never run
+	uint64_t instrs;
+	double seconds;
+	char *message; // first error reported by the machine, or NULL
+} Job;
+
+// The buffers a job's I/O hooks read from and write to
+typedef struct _JobIO {
+	char *in;
+	size_t in_len, in_pos;
+	char *out;
+	size_t out_len, out_cap;
+	int out_overflow;
+	char **message;
+} JobIO;
+
+static Job *jobs = NULL;
+static int num_jobs = 0, jobs_cap = 0;
+/*
+  The workers take units of work from units[] in order. A unit is one job, or with
+  --lockstep up to MAX_LANES jobs running the same program, which are run together as the
+  lanes of a Y86Lanes. The unit's jobs are job_order[first] to job_order[first+count-1]
+*/
+typedef struct _Unit {
+	int first, count;
+} Unit;
+
+static int *job_order = NULL;
+static Unit *units = NULL;
+static int num_units = 0;
+static int next_unit = 0;
+static pthread_mutex_t next_unit_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int engine = ENGINE_BLOCK;
+static uint64_t max_instrs = 0;
+static uint64_t mem_size = 4096;
+static double timeout = 10;
+static int lockstep = 0;
+
+static void print_usage(char *prog_name) {
+	printf("Usage: %s [options] <directory|manifest|y86 source file>...\n", prog_name);
+	printf("Runs every program given and writes a report of the results\n\n");
+	printf("A directory is searched for *.ys files. foo.ys reads its input from foo.in and its\n");
+	printf("output is compared with foo.out, if those files exist. Each line of a manifest is\n");
+	printf("<program> [input file|-] [expected output file|-], relative to the manifest's directory\n\n");
+	printf("Options:\n");
+	printf("  -j <n>                                  Number of programs run at once (default the number of cores)\n");
+	printf("  --engine <block|callback|threaded|jit>  Selects the execution core (default block)\n");
+	printf("  --max-instrs <n>                        Stops each program after n instructions (default no limit)\n");
+	printf("  --timeout <seconds>                     Stops each program after this long (default 10, 0 for no limit)\n");
+	printf("  --mem-size <bytes>                      Size of each program's address space, a multiple of 4096 up to 4 GiB (default 4096)\n");
+	printf("  --lockstep                              Runs jobs with the same program together as the lanes of one Y86Lanes\n");
+	printf("                                          (only with the default --mem-size)\n");
+	printf("  --format <json|csv>                     Report format (default json)\n");
+	printf("  -o <file>                               Writes the report to file instead of stdout\n");
+}
+
+static char *copy_str(const char *str) {
+	char *copy = malloc(strlen(str)+1);
+
+	strcpy(copy, str);
+	return copy;
+}
+
+// Returns dir/name, or a copy of name if it's an absolute path or dir is NULL
+static char *join_path(const char *dir, const char *name) {
+	char *path;
+
+	if (dir == NULL || name[0] == '/')
+		return copy_str(name);
+
+	path = malloc(strlen(dir) + strlen(name) + 2);
+	sprintf(path, "%s/%s", dir, name);
+	return path;
+}
+
+// Returns path with its extension replaced by ext if that file exists, NULL otherwise
+static char *sibling_file(const char *path, const char *ext) {
+	const char *dot = strrchr(path, '.');
+	size_t base_len = dot != NULL ? (size_t)(dot - path) : strlen(path);
+	char *sibling = malloc(base_len + strlen(ext) + 1);
+
+	memcpy(sibling, path, base_len);
+	strcpy(sibling + base_len, ext);
+
+	if (access(sibling, R_OK) != 0) {
+		free(sibling);
+		return NULL;
+	}
+
+	return sibling;
+}
+
+static void add_job(char *program, char *input, char *expected) {
+	Job *job;
+
+	if (num_jobs == jobs_cap) {
+		jobs_cap = jobs_cap == 0 ? 64 : jobs_cap*2;
+		jobs = realloc(jobs, jobs_cap * sizeof(Job));
+	}
+
+	job = &jobs[num_jobs++];
+	memset(job, 0, sizeof(Job));
+	job->program = program;
+	job->input = input;
+	job->expected = expected;
+}
+
+static int is_source_file(const char *name) {
+	size_t len = strlen(name);
+
+	return len > 3 && strcmp(name + len - 3, ".ys") == 0;
+}
+
+static int source_filter(const struct dirent *ent) {
+	return is_source_file(ent->d_name);
+}
+
+// Adds a job for every .ys file in the directory, in alphabetical order
+static int add_dir_jobs(char *dir) {
+	struct dirent **ents;
+	int i, n;
+
+	if ((n = scandir(dir, &ents, source_filter, alphasort)) < 0)
+		return 0;
+
+	for (i = 0; i < n; i++) {
+		char *program = join_path(dir, ents[i]->d_name);
+
+		add_job(program, sibling_file(program, ".in"), sibling_file(program, ".out"));
+		free(ents[i]);
+	}
+
+	free(ents);
+	return 1;
+}
+
+// Adds a job for every line of the manifest, blank lines and lines starting with # are skipped
+static int add_manifest_jobs(char *manifest) {
+	FILE *f = fopen(manifest, "r");
+	char line[4096], *dir, *slash, *save_ptr;
+	char *fields[3];
+	int i;
+
+	if (f == NULL)
+		return 0;
+
+	dir = copy_str(manifest);
+	slash = strrchr(dir, '/');
+
+	if (slash != NULL)
+		*slash = '\0';
+	else {
+		free(dir);
+		dir = NULL;
+	}
+
+	while (fgets(line, sizeof(line), f) != NULL) {
+		fields[0] = strtok_r(line, " \t\r\n", &save_ptr);
+
+		if (fields[0] == NULL || fields[0][0] == '#')
+			continue;
+
+		for (i = 1; i < 3; i++)
+			fields[i] = strtok_r(NULL, " \t\r\n", &save_ptr);
+
+		for (i = 0; i < 3; i++)
+			fields[i] = fields[i] != NULL && strcmp(fields[i], "-") != 0 ? join_path(dir, fields[i]) : NULL;
+
+		add_job(fields[0], fields[1], fields[2]);
+	}
+
+	free(dir);
+	fclose(f);
+	return 1;
+}
+
+/*
+  Reads the whole file into memory
+  Returns the contents (not null terminated), or NULL if the file couldn't be read
+*/
+static char *read_file(const char *filename, size_t *len) {
+	FILE *f = fopen(filename, "rb");
+	char *buf = NULL;
+	size_t cap = 0, n;
+
+	*len = 0;
+
+	if (f == NULL)
+		return NULL;
+
+	do {
+		if (*len == cap) {
+			cap = cap == 0 ? 4096 : cap*2;
+			buf = realloc(buf, cap);
+		}
+
+		n = fread(buf + *len, 1, cap - *len, f);
+		*len += n;
+	} while (n > 0);
+
+	fclose(f);
+	return buf;
+}
+
+// I/O hooks for a job, input comes from the job's input file and output is kept to compare afterwards
+static void job_read_int(void *ctx, uint32_t *reg) {
+	JobIO *io = ctx;
+	size_t pos = io->in_pos;
+	int neg = 0, digits = 0;
+	uint32_t val = 0;
+
+	// same as scanf("%d"): skip whitespace, then an optional sign and at least one digit
+	while (pos < io->in_len && isspace((unsigned char)io->in[pos]))
+		pos++;
+
+	if (pos < io->in_len && (io->in[pos] == '-' || io->in[pos] == '+'))
+		neg = io->in[pos++] == '-';
+
+	while (pos < io->in_len && isdigit((unsigned char)io->in[pos])) {
+		val = val*10 + (io->in[pos++] - '0');
+		digits++;
+	}
+
+	if (digits > 0) {
+		*reg = neg ? -val : val;
+		io->in_pos = pos;
+	}
+}
+
+static void job_read_char(void *ctx, uint32_t *reg) {
+	JobIO *io = ctx;
+
+	if (io->in_pos < io->in_len)
+		*reg = (*reg & ~0xFF) | (uint8_t)io->in[io->in_pos++];
+}
+
+static void job_write(JobIO *io, const char *str, size_t len) {
+	if (io->out_len + len > MAX_OUTPUT) {
+		io->out_overflow = 1;
+		return;
+	}
+
+	if (io->out_len + len > io->out_cap) {
+		while (io->out_len + len > io->out_cap)
+			io->out_cap = io->out_cap == 0 ? 4096 : io->out_cap*2;
+		io->out = realloc(io->out, io->out_cap);
+	}
+
+	memcpy(io->out + io->out_len, str, len);
+	io->out_len += len;
+}
+
+static void job_write_int(void *ctx, uint32_t val) {
+	char str[16];
+
+	job_write(ctx, str, snprintf(str, sizeof(str), "%d", (int)val));
+}
+
+static void job_write_char(void *ctx, uint32_t val) {
+	char c = (char)val;
+
+	job_write(ctx, &c, 1);
+}
+
+static void job_error(void *ctx, const char *msg) {
+	JobIO *io = ctx;
+
+	if (*io->message == NULL)
+		*io->message = copy_str(msg);
+}
+
+static void ignore_error(void *ctx, const char *msg) {
+}
+
+static double now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Returns 1 if the output is exactly the same as the expected output file
+static int output_matches(JobIO *io, const char *expected) {
+	size_t len;
+	char *buf = read_file(expected, &len);
+	int match = buf != NULL && !io->out_overflow && len == io->out_len && memcmp(buf, io->out, len) == 0;
+
+	free(buf);
+	return match;
+}
+
+/*
+  Sets up the buffers for the job's I/O hooks, reading its input file into memory
+  Returns 1 on success, 0 if the input file couldn't be read (which fails the job)
+*/
+static int job_open_io(Job *job, JobIO *io) {
+	memset(io, 0, sizeof(JobIO));
+	io->message = &job->message;
+	job->result = JOB_ERROR;
+
+	if (job->input != NULL && (io->in = read_file(job->input, &io->in_len)) == NULL) {
+		job->message = malloc(strlen(job->input) + 32);
+		sprintf(job->message, "Error opening %s for reading", job->input);
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+  Works out the job's result from the status it stopped with, checking its output, and
+  frees the I/O buffers. fault is the message for a failed instruction that didn't report one
+*/
+static void job_finish(Job *job, JobIO *io, char *fault) {
+	if (job->status == STAT_HLT)
+		job->result = job->expected == NULL || output_matches(io, job->expected) ? JOB_PASS : JOB_FAIL;
+	else if (job->status == STAT_BUDGET)
+		job->result = max_instrs != 0 && job->instrs >= max_instrs ? JOB_INSTR_LIMIT : JOB_TIMEOUT;
+	else if (job->status != 0 && job->message == NULL)
+		job->message = copy_str(fault);
+
+	if (io->out_overflow && job->result == JOB_PASS)
+		job->result = JOB_FAIL;
+
+	free(io->in);
+	free(io->out);
+}
+
+/*
+  Runs the job on a machine of its own, in slices of SLICE_INSTRS instructions so the
+  time limit is checked regularly, and fills in its results
+*/
+static void run_job(Job *job) {
+	Y86Machine *m = y86_new_machine();
+	JobIO io;
+	Y86IO hooks = {job_read_int, job_read_char, job_write_int, job_write_char, job_error, &io};
+	uint64_t slice;
+	double start = now();
+	const char *instr;
+	char fault[64];
+
+	if (!job_open_io(job, &io)) {
+		y86_free_machine(m);
+		return;
+	}
+
+	if (m == NULL) {
+		job->message = copy_str("Not enough memory");
+		free(io.in);
+		return;
+	}
+
+	y86_set_io(m, &hooks);
+
+	y86_set_engine(m, engine); // falls back to the block engine, main has already warned about it
+	y86_set_mem_size(m, mem_size); // checked by main
+
+	if (y86_load_file(m, job->program)) {
+		do {
+			slice = SLICE_INSTRS;
+
+			if (max_instrs != 0 && max_instrs - y86_get_instr_count(m) < slice)
+				slice = max_instrs - y86_get_instr_count(m);
+
+			job->status = y86_run(m, slice);
+		} while (job->status == STAT_BUDGET && (max_instrs == 0 || y86_get_instr_count(m) < max_instrs)
+				 && (timeout == 0 || now() - start < timeout));
+
+		job->instrs = y86_get_instr_count(m);
+	}
+
+	// there is no failed instruction when the program didn't load
+	instr = y86_get_fault_instr(m);
+	snprintf(fault, sizeof(fault), "%s callback failed at 0x%x", instr != NULL ? instr : "load", y86_get_pc(m));
+	job_finish(job, &io, fault);
+	job->seconds = now() - start;
+	y86_free_machine(m);
+}
+
+/*
+  Runs jobs which all run the same program as the lanes of one Y86Lanes (see --lockstep),
+  a slice at a time like run_job. Every job's seconds is the time the whole group took.
+  Falls back to run_job if the program can't be loaded or there isn't enough memory
+*/
+static void run_lanes(int *job_nums, int n) {
+	Y86Machine *m = y86_new_machine();
+	Y86Lanes *l = NULL;
+	JobIO *io = calloc(n, sizeof(JobIO));
+	Y86IO *hooks = calloc(n, sizeof(Y86IO));
+	int *lane_jobs = calloc(n, sizeof(int));
+	int i, num_lanes = 0, remaining;
+	uint64_t target = 0;
+	Y86IO quiet = {NULL, NULL, NULL, NULL, ignore_error, NULL};
+	double start = now();
+	char fault[64];
+
+	if (m != NULL) {
+		y86_set_io(m, &quiet); // a program that doesn't load is reported by run_job for each job
+		y86_set_mem_size(m, mem_size); // y86_new_lanes only takes the default size, other sizes fall back to run_job
+	}
+
+	if (m != NULL && io != NULL && hooks != NULL && lane_jobs != NULL && y86_load_file(m, jobs[job_nums[0]].program)) {
+		// jobs whose input can't be read have already failed and don't get a lane
+		for (i = 0; i < n; i++) {
+			if (job_open_io(&jobs[job_nums[i]], &io[num_lanes])) {
+				Y86IO job_hooks = {job_read_int, job_read_char, job_write_int, job_write_char, job_error, &io[num_lanes]};
+
+				hooks[num_lanes] = job_hooks;
+				lane_jobs[num_lanes++] = job_nums[i];
+			}
+		}
+
+		if (num_lanes > 0 && (l = y86_new_lanes(m, num_lanes, hooks)) == NULL) {
+			for (i = 0; i < num_lanes; i++)
+				free(io[i].in);
+		}
+	}
+
+	y86_free_machine(m);
+
+	if (l == NULL) {
+		for (i = 0; i < n; i++)
+			if (jobs[job_nums[i]].message == NULL)
+				run_job(&jobs[job_nums[i]]);
+	} else {
+		do {
+			target += SLICE_INSTRS;
+
+			if (max_instrs != 0 && target > max_instrs)
+				target = max_instrs;
+
+			remaining = y86_run_lanes(l, target);
+		} while (remaining != 0 && (max_instrs == 0 || target < max_instrs) && (timeout == 0 || now() - start < timeout));
+
+		for (i = 0; i < num_lanes; i++) {
+			Job *job = &jobs[lane_jobs[i]];
+
+			job->status = y86_get_lane_status(l, i);
+			job->instrs = y86_get_lane_instr_count(l, i);
+			snprintf(fault, sizeof(fault), "Invalid instruction at 0x%x", y86_get_lane_pc(l, i));
+			job_finish(job, &io[i], fault);
+			job->seconds = now() - start;
+		}
+
+		y86_free_lanes(l);
+	}
+
+	free(io);
+	free(hooks);
+	free(lane_jobs);
+}
+
+// Worker thread, runs units of work until there are none left
+static void *worker(void *arg) {
+	Unit *unit;
+	int i;
+
+	for (;;) {
+		pthread_mutex_lock(&next_unit_lock);
+		i = next_unit++;
+		pthread_mutex_unlock(&next_unit_lock);
+
+		if (i >= num_units)
+			break;
+
+		unit = &units[i];
+
+		if (unit->count == 1)
+			run_job(&jobs[job_order[unit->first]]);
+		else
+			run_lanes(&job_order[unit->first], unit->count);
+	}
+
+	return NULL;
+}
+
+// jobs with the same program end up next to each other, otherwise they stay in the order given
+static int compare_job_programs(const void *a, const void *b) {
+	int x = *(int *)a, y = *(int *)b;
+	int cmp = strcmp(jobs[x].program, jobs[y].program);
+
+	return cmp != 0 ? cmp : x - y;
+}
+
+// Splits the jobs up into units of work (see Unit)
+static void plan_units() {
+	int i, count;
+
+	job_order = malloc(num_jobs * sizeof(int));
+	units = malloc(num_jobs * sizeof(Unit));
+
+	for (i = 0; i < num_jobs; i++)
+		job_order[i] = i;
+
+	if (lockstep)
+		qsort(job_order, num_jobs, sizeof(int), compare_job_programs);
+
+	for (i = 0; i < num_jobs; i += count) {
+		count = 1;
+
+		while (lockstep && i + count < num_jobs && count < MAX_LANES &&
+			   strcmp(jobs[job_order[i]].program, jobs[job_order[i + count]].program) == 0)
+			count++;
+
+		units[num_units].first = i;
+		units[num_units++].count = count;
+	}
+}
+
+static double job_mips(Job *job) {
+	return job->seconds > 0 ? job->instrs / job->seconds / 1e6 : 0;
+}
+
+static const char *status_name(int status) {
+	switch (status) {
+	case STAT_AOK: return "aok";
+	case STAT_HLT: return "hlt";
+	case STAT_ADR: return "adr";
+	case STAT_INS: return "ins";
+	case STAT_BUDGET: return "budget";
+	case STAT_BREAK: return "break";
+	}
+
+	return "none";
+}
+
+static void write_json_string(FILE *out, const char *str) {
+	if (str == NULL) {
+		fprintf(out, "null");
+		return;
+	}
+
+	fputc('"', out);
+
+	for (; *str != '\0'; str++) {
+		if (*str == '"' || *str == '\\')
+			fprintf(out, "\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			fprintf(out, "\\u%04x", *str);
+		else
+			fputc(*str, out);
+	}
+
+	fputc('"', out);
+}
+
+// fields are quoted only when they need to be
+static void write_csv_string(FILE *out, const char *str) {
+	if (str == NULL)
+		return;
+
+	if (strpbrk(str, ",\"\r\n") == NULL) {
+		fprintf(out, "%s", str);
+		return;
+	}
+
+	fputc('"', out);
+
+	for (; *str != '\0'; str++) {
+		if (*str == '"')
+			fputc('"', out);
+		fputc(*str, out);
+	}
+
+	fputc('"', out);
+}
+
+static void write_json_report(FILE *out, int passed, double seconds) {
+	int i;
+
+	fprintf(out, "{\n  \"total\": %d,\n  \"passed\": %d,\n  \"failed\": %d,\n  \"seconds\": %.3f,\n  \"jobs\": [",
+			num_jobs, passed, num_jobs - passed, seconds);
+
+	for (i = 0; i < num_jobs; i++) {
+		Job *job = &jobs[i];
+
+		fprintf(out, "%s\n    {\"program\": ", i == 0 ? "" : ",");
+		write_json_string(out, job->program);
+		fprintf(out, ", \"result\": \"%s\", \"status\": \"%s\", \"instructions\": %llu, \"seconds\": %.6f, \"mips\": %.2f, \"message\": ",
+				job_results[job->result], status_name(job->status), (unsigned long long)job->instrs, job->seconds, job_mips(job));
+		write_json_string(out, job->message);
+		fprintf(out, "}");
+	}
+
+	fprintf(out, "\n  ]\n}\n");
+}
+
+static void write_csv_report(FILE *out) {
+	int i;
+
+	fprintf(out, "program,result,status,instructions,seconds,mips,message\n");
+
+	for (i = 0; i < num_jobs; i++) {
+		Job *job = &jobs[i];
+
+		write_csv_string(out, job->program);
+		fprintf(out, ",%s,%s,%llu,%.6f,%.2f,", job_results[job->result], status_name(job->status),
+				(unsigned long long)job->instrs, job->seconds, job_mips(job));
+		write_csv_string(out, job->message);
+		fprintf(out, "\n");
+	}
+}
+
+int main(int argc, char *argv[]) {
+	int i, passed = 0, csv = 0;
+	long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	char *report_filename = NULL;
+	pthread_t *threads;
+	struct stat st;
+	double start;
+	FILE *out = stdout;
+	Y86Machine *m;
+	int engine_arg = 0;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-j") == 0 && i+1 < argc) {
+			num_threads = atol(argv[++i]);
+		}
+
+		else if (strcmp(argv[i], "--engine") == 0 && i+1 < argc) {
+			engine_arg = ++i;
+
+			if (strcmp(argv[i], "block") == 0)
+				engine = ENGINE_BLOCK;
+			else if (strcmp(argv[i], "callback") == 0)
+				engine = ENGINE_CALLBACK;
+			else if (strcmp(argv[i], "threaded") == 0)
+				engine = ENGINE_THREADED;
+			else if (strcmp(argv[i], "jit") == 0)
+				engine = ENGINE_JIT;
+			else {
+				fprintf(stderr, "Unknown engine %s\n", argv[i]);
+				return 2;
+			}
+		}
+
+		else if (strcmp(argv[i], "--max-instrs") == 0 && i+1 < argc) {
+			max_instrs = strtoull(argv[++i], NULL, 10);
+		}
+
+		else if (strcmp(argv[i], "--mem-size") == 0 && i+1 < argc) {
+			mem_size = strtoull(argv[++i], NULL, 0);
+		}
+
+		else if (strcmp(argv[i], "--timeout") == 0 && i+1 < argc) {
+			timeout = atof(argv[++i]);
+		}
+
+		else if (strcmp(argv[i], "--lockstep") == 0) {
+			lockstep = 1;
+		}
+
+		else if (strcmp(argv[i], "--format") == 0 && i+1 < argc) {
+			i++;
+
+			if (strcmp(argv[i], "csv") == 0)
+				csv = 1;
+			else if (strcmp(argv[i], "json") != 0) {
+				fprintf(stderr, "Unknown report format %s\n", argv[i]);
+				return 2;
+			}
+		}
+
+		else if (strcmp(argv[i], "-o") == 0 && i+1 < argc) {
+			report_filename = argv[++i];
+		}
+
+		else if (argv[i][0] == '-') {
+			print_usage(argv[0]);
+			return 2;
+		}
+
+		else if (stat(argv[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+			if (!add_dir_jobs(argv[i])) {
+				fprintf(stderr, "Error reading directory %s\n", argv[i]);
+				return 2;
+			}
+		}
+
+		else if (is_source_file(argv[i])) {
+			add_job(copy_str(argv[i]), sibling_file(argv[i], ".in"), sibling_file(argv[i], ".out"));
+		}
+
+		else if (!add_manifest_jobs(argv[i])) {
+			fprintf(stderr, "Error opening %s for reading\n", argv[i]);
+			return 2;
+		}
+	}
+
+	if (num_jobs == 0) {
+		print_usage(argv[0]);
+		return 2;
+	}
+
+	if (report_filename != NULL && (out = fopen(report_filename, "w")) == NULL) {
+		fprintf(stderr, "Error opening %s for writing\n", report_filename);
+		return 2;
+	}
+
+	if ((m = y86_new_machine()) == NULL) {
+		fprintf(stderr, "Not enough memory\n");
+		return 2;
+	}
+
+	if (!y86_set_engine(m, engine))
+		fprintf(stderr, "The %s engine isn't available, using the block engine\n", argv[engine_arg]);
+
+	if (!y86_set_mem_size(m, mem_size)) {
+		fprintf(stderr, "Invalid memory size %llu\n", (unsigned long long)mem_size);
+		y86_free_machine(m);
+		return 2;
+	}
+
+	y86_free_machine(m);
+
+	plan_units();
+
+	if (num_threads < 1)
+		num_threads = 1;
+	if (num_threads > num_units)
+		num_threads = num_units;
+
+	// each unit gets a machine of its own, so the workers don't share anything but the unit counter
+	start = now();
+	threads = malloc(num_threads * sizeof(pthread_t));
+
+	for (i = 0; i < num_threads; i++)
+		pthread_create(&threads[i], NULL, worker, NULL);
+	for (i = 0; i < num_threads; i++)
+		pthread_join(threads[i], NULL);
+
+	for (i = 0; i < num_jobs; i++)
+		passed += jobs[i].result == JOB_PASS;
+
+	if (csv)
+		write_csv_report(out);
+	else
+		write_json_report(out, passed, now() - start);
+
+	if (out != stdout)
+		fclose(out);
+
+	for (i = 0; i < num_jobs; i++) {
+		free(jobs[i].program);
+		free(jobs[i].input);
+		free(jobs[i].expected);
+		free(jobs[i].message);
+	}
+
+	free(jobs);
+	free(job_order);
+	free(units);
+	free(threads);
+	return passed == num_jobs ? 0 : 1;
+}
@@ -0,0 +1,111 @@
+// cache.c - Keeps an object file of every program assembled in ~/.cache/y86sim, so a source file that was assembled before loads without assembling it again
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "simulator.h"
+#include "object.h"
+#include "cache.h"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+// Adds len bytes of data to the 64 bit FNV-1a hash
+static uint64 hash_bytes(uint64 hash, uint8 *data, uint64 len) {
+	uint64 i;
+
+	for (i = 0; i < len; i++)
+		hash = (hash ^ data[i]) * FNV_PRIME;
+
+	return hash;
+}
+
+/*
+  Works out where the assembled image of a source file (its contents are src, src_size
+  bytes long) is cached, from a hash of its contents, the size of the address space (which
+  decides whether it fits) and the versions of the assembler and object format, and writes
+  the path to path (size bytes long)
+  Returns 1 on success, 0 if there is no cache: Y86SIM_NO_CACHE is set or there is neither
+  XDG_CACHE_HOME nor HOME
+*/
+int cache_path(Y86Machine *m, char *src, uint64 src_size, char *path, int size) {
+	uint64 hash = FNV_OFFSET, key[3];
+	char *base;
+	int len;
+
+	if (getenv("Y86SIM_NO_CACHE") != NULL)
+		return 0;
+
+	if ((base = getenv("XDG_CACHE_HOME")) != NULL && *base != '\0')
+		len = snprintf(path, size, "%s/y86sim/", base);
+	else if ((base = getenv("HOME")) != NULL && *base != '\0')
+		len = snprintf(path, size, "%s/.cache/y86sim/", base);
+	else
+		return 0;
+
+	key[0] = m->mem_size;
+	key[1] = CACHE_VERSION;
+	key[2] = OBJ_VERSION;
+	hash = hash_bytes(hash, (uint8*)key, sizeof(key));
+	hash = hash_bytes(hash, (uint8*)src, src_size);
+
+	return len < size && snprintf(path + len, size - len, "%016llx-%llx.obj",
+								  (unsigned long long)hash, (unsigned long long)src_size) < size - len;
+}
+
+// Creates the directory that path is in, and the one above that, if they don't exist
+static void make_cache_dir(char *path) {
+	char *dir = strdup(path), *slash;
+
+	if (dir == NULL)
+		return;
+
+	slash = strrchr(dir, '/');
+
+	if (slash != NULL && slash != dir) {
+		*slash = '\0';
+		slash = strrchr(dir, '/');
+
+		if (slash != NULL && slash != dir) {
+			*slash = '\0';
+			mkdir(dir, 0755);
+			*slash = '/';
+		}
+
+		mkdir(dir, 0755);
+	}
+
+	free(dir);
+}
+
+/*
+  Writes the assembled program to the cache file at path. The image is written to a
+  temporary file which is then renamed, so other processes (or threads) reading the cache
+  never see half an image, and two of them storing the same program at once is harmless.
+  Failing to write the cache isn't an error, the program is just assembled again next time
+*/
+void cache_store(Y86Machine *m, char *path) {
+	char *tmp_path = malloc(strlen(path) + 8);
+	int fd;
+
+	if (tmp_path == NULL)
+		return;
+
+	make_cache_dir(path);
+	sprintf(tmp_path, "%s.XXXXXX", path);
+	fd = mkstemp(tmp_path);
+
+	if (fd < 0) {
+		DBG_PRINT("Error creating a cache file for %s\n", path);
+		free(tmp_path);
+		return;
+	}
+
+	close(fd);
+
+	if (!gen_obj_file(m, tmp_path) || rename(tmp_path, path) != 0)
+		unlink(tmp_path);
+
+	free(tmp_path);
+}
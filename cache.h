@@ -0,0 +1,12 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "common.h"
+#include "simulator.h"
+
+#define CACHE_VERSION 4 // bump whenever the assembler gives different output for the same source, so old images aren't used
+
+int cache_path(Y86Machine *m, char *src, uint64 src_size, char *path, int size);
+void cache_store(Y86Machine *m, char *path);
+
+#endif
@@ -0,0 +1,441 @@
+// cgen.c - Translates an assembled y86 program ahead of time into a standalone C program (see gen_c_file)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cgen.h"
+#include "condition.h"
+#include "parser.h"
+#include "simulator.h"
+#include "memory.h"
+
+/*
+  Code placed at the top of every generated file. Registers, flags and memory live
+  in file scope arrays just like in the simulator, and the helpers below reproduce
+  the simulator's callbacks (including do_arithmetic's way of setting OF) so the
+  translated program behaves the same as it would under y86sim. Every store goes
+  through check_code, which stops the program if it would overwrite an instruction
+  (marked in code_bits, or jumped_data_bits for .long data that is jumped to, all
+  below CODE_END; see collect_code_bytes).
+*/
+static const char *c_prelude =
+	"#define ESP 4\n"
+	"\n"
+	"static uint32_t r[8];\n"
+	"static uint32_t OF, SF, ZF;\n"
+	"\n"
+	"static void fail(const char *msg, uint32_t pc) {\n"
+	"\tfflush(stdout);\n"
+	"\tfprintf(stderr, \"%s at PC=0x%x\\n\", msg, pc);\n"
+	"\texit(1);\n"
+	"}\n"
+	"\n"
+	"static inline int marked(const unsigned char *bits, uint32_t addr) {\n"
+	"\treturn (bits[addr >> 3] | bits[(addr+3) >> 3] << 8) >> (addr & 7) & 0xf;\n"
+	"}\n"
+	"\n"
+	"static inline void check_code(uint32_t addr, uint32_t pc) {\n"
+	"\tif (addr < CODE_END && (marked(code_bits, addr) || marked(jumped_data_bits, addr)))\n"
+	"\t\tfail(\"Store into translated code\", pc);\n"
+	"}\n"
+	"\n"
+	"static inline uint32_t load(uint32_t addr, uint32_t pc) {\n"
+	"\tif (addr > 4096-4)\n"
+	"\t\tfail(\"mrmovl offset out of bounds\", pc);\n"
+	"\treturn *((uint32_t*)&memory[addr]);\n"
+	"}\n"
+	"\n"
+	"static inline void store(uint32_t addr, uint32_t val, uint32_t pc) {\n"
+	"\tif (addr > 4096-4)\n"
+	"\t\tfail(\"rmmovl offset out of bounds\", pc);\n"
+	"\tcheck_code(addr, pc);\n"
+	"\t*((uint32_t*)&memory[addr]) = val;\n"
+	"}\n"
+	"\n"
+	"static inline void push(uint32_t val, uint32_t pc) {\n"
+	"\tif (r[ESP] > 4096 || r[ESP] < 4)\n"
+	"\t\tfail(\"Stack overflow\", pc);\n"
+	"\tcheck_code(r[ESP] - 4, pc);\n"
+	"\tr[ESP] -= 4;\n"
+	"\t*((uint32_t*)&memory[r[ESP]]) = val;\n"
+	"}\n"
+	"\n"
+	"static inline uint32_t pop(uint32_t pc) {\n"
+	"\tuint32_t val;\n"
+	"\n"
+	"\tif (r[ESP] > 4096-4)\n"
+	"\t\tfail(\"Stack overflow\", pc);\n"
+	"\tval = *((uint32_t*)&memory[r[ESP]]);\n"
+	"\tr[ESP] += 4;\n"
+	"\treturn val;\n"
+	"}\n"
+	"\n"
+	"static inline void arith(int op, int src, int dest, uint32_t pc) {\n"
+	"\tuint32_t orig_dest = r[dest];\n"
+	"\n"
+	"\tswitch (op) {\n"
+	"\tcase 0: r[dest] += r[src]; OF = (int32_t)orig_dest > 0 && (int32_t)r[src] > 0 && r[dest] > 0x7FFFFFFF; break;\n"
+	"\tcase 1: r[dest] -= r[src]; OF = (int32_t)orig_dest < 0 && (int32_t)r[src] < 0 && (int32_t)r[dest] < 0x7FFFFFFF; break;\n"
+	"\tcase 2: r[dest] &= r[src]; OF = 0; break;\n"
+	"\tcase 3: r[dest] ^= r[src]; OF = 0; break;\n"
+	"\tcase 4: r[dest] *= r[src]; OF = (int32_t)orig_dest > 0 && (int32_t)r[src] > 0 && r[dest] > 0x7FFFFFFF; break;\n"
+	"\tcase 5:\n"
+	"\t\tif (r[src] == 0)\n"
+	"\t\t\tfail(\"Division by zero\", pc);\n"
+	"\t\tr[dest] /= r[src]; OF = (int32_t)orig_dest > 0 && (int32_t)r[src] > 0 && r[dest] > 0x7FFFFFFF; break;\n"
+	"\tcase 6:\n"
+	"\t\tif (r[src] == 0)\n"
+	"\t\t\tfail(\"Division by zero\", pc);\n"
+	"\t\tr[dest] %= r[src]; OF = 0; break;\n"
+	"\t}\n"
+	"\n"
+	"\tSF = (int32_t)r[dest] < 0;\n"
+	"\tZF = r[dest] == 0;\n"
+	"}\n"
+	"\n"
+	"static inline uint32_t rdint(uint32_t old) {\n"
+	"\tint val;\n"
+	"\n"
+	"\tfflush(stdout);\n"
+	"\treturn scanf(\"%d\", &val) == 1 ? (uint32_t)val : old;\n"
+	"}\n"
+	"\n"
+	"static inline uint32_t rdch(uint32_t old) {\n"
+	"\tint c;\n"
+	"\n"
+	"\tfflush(stdout);\n"
+	"\tc = getchar();\n"
+	"\treturn c == EOF ? old : (old & ~0xffu) | (uint8_t)c;\n"
+	"}\n"
+	"\n";
+
+// Return 1 if reg_num is a valid register number and 0 if not
+static int valid_reg_num(int reg_num) {
+	return reg_num >= 0 && reg_num <= 7;
+}
+
+/*
+  Returns 1 if line holds an instruction (rather than a label or a directive).
+  .long lines count as well, since a program may jump into data just like it can
+  under the simulator
+*/
+static int is_instr_line(SourceLine *line) {
+	return !is_label_line(line->line) && (line->line[0] != '.' || strncmp(line->line, ".long", 5) == 0);
+}
+
+static int cmp_addr(const void *a, const void *b) {
+	return *(const uint16*)a - *(const uint16*)b;
+}
+
+/*
+  Collects the addresses of every instruction in the source into addrs (sorted, no
+  duplicates), setting is_start to 1 for each of them. Returns the number of addresses
+*/
+static int collect_instr_addrs(Y86Machine *m, uint16 *addrs, uint8 *is_start) {
+	SourceLine *cur_line;
+	int i, n = 0, num_unique = 0;
+
+	for (cur_line = m->source_lines; cur_line != NULL; cur_line = cur_line->next)
+		if (is_instr_line(cur_line) && cur_line->addr < 4096)
+			addrs[n++] = cur_line->addr;
+
+	qsort(addrs, n, sizeof(uint16), cmp_addr);
+
+	for (i = 0; i < n; i++) {
+		if (num_unique > 0 && addrs[num_unique-1] == addrs[i])
+			continue;
+
+		addrs[num_unique++] = addrs[i];
+		is_start[addrs[i]] = 1;
+	}
+
+	return num_unique;
+}
+
+/*
+  Sets the bit in code_bits (one per byte of memory) of every byte of an instruction,
+  which the translated program mustn't store into. .long data is translated as well, in
+  case it is jumped to, but storing into it is what it's for, so only the .long lines
+  that are direct jump or call targets (is_start of 2) are marked, in jumped_data_bits.
+  Returns the address after the last marked byte
+*/
+static int collect_code_bytes(Y86Machine *m, uint8 *is_start, uint8 *code_bits, uint8 *jumped_data_bits) {
+	SourceLine *cur_line;
+	DecodedInstr di;
+	uint8 *bits;
+	int i, end = 0;
+
+	for (cur_line = m->source_lines; cur_line != NULL; cur_line = cur_line->next) {
+		if (!is_instr_line(cur_line) || cur_line->addr >= 4096)
+			continue;
+
+		if (cur_line->line[0] != '.')
+			bits = code_bits;
+		else if (is_start[cur_line->addr] == 2)
+			bits = jumped_data_bits;
+		else
+			continue;
+
+		sim_decode(m, cur_line->addr, &di);
+
+		for (i = cur_line->addr; i < (int)di.next_pc && i < 4096; i++)
+			bits[i >> 3] |= 1 << (i & 7);
+
+		if (i > end)
+			end = i;
+	}
+
+	return end;
+}
+
+// Writes the bitmap bits as an array called name, up to the byte holding the bit of address end
+static void print_bits(FILE *out, char *name, uint8 *bits, int end) {
+	int i;
+
+	fprintf(out, "static const unsigned char %s[4096/8] = {", name);
+	for (i = 0; i < (end + 7) / 8; i++)
+		fprintf(out, "%s0x%02x,", i % 16 == 0 ? "\n\t" : " ", bits[i]);
+	fprintf(out, "\n};\n\n");
+}
+
+// Writes the C label used for the instruction at addr, using the y86 label name if it has one
+static void print_c_label(Y86Machine *m, FILE *out, uint16 addr) {
+	Label *label = find_label_by_addr(m, addr);
+
+	if (label != NULL)
+		fprintf(out, "L_%s", label->name);
+	else
+		fprintf(out, "A_%03x", addr);
+}
+
+// Writes a jump to target, as a goto when target is a known instruction or through the dispatch switch otherwise
+static void print_jump(Y86Machine *m, FILE *out, uint16 target, uint8 *is_start) {
+	if (target < 4096 && is_start[target] == 2) {
+		fprintf(out, "goto ");
+		print_c_label(m, out, target);
+		fprintf(out, ";");
+	} else {
+		fprintf(out, "{ pc = 0x%x; goto dispatch; }", target);
+	}
+}
+
+/*
+  Writes the C statements for a single decoded instruction at addr.
+  Returns 1 if execution can continue with the instruction at di->next_pc and 0 if
+  the statements always jump somewhere else or exit
+*/
+static int print_instr(Y86Machine *m, FILE *out, uint16 addr, DecodedInstr *di, uint8 *is_start) {
+	uint8 op = di->instr->opcode;
+	int regs_ok = valid_reg_num(di->rA) && valid_reg_num(di->rB);
+
+	fprintf(out, "\t\t");
+
+	switch (op) {
+	case 0x00: // nop
+		fprintf(out, ";");
+		break;
+	case 0x10: // halt
+		fprintf(out, "fflush(stdout); return 0;\n");
+		return 0;
+	case 0x30: // irmovl
+		if (!valid_reg_num(di->rB))
+			goto bad_operands;
+		fprintf(out, "r[%d] = 0x%x;", di->rB, di->imm);
+		break;
+	case 0x20: // rrmovl
+		if (!regs_ok)
+			goto bad_operands;
+		fprintf(out, "r[%d] = r[%d];", di->rB, di->rA);
+		break;
+	case 0x40: // rmmovl
+		if (!valid_reg_num(di->rA))
+			goto bad_operands;
+		if (di->rB == 8)
+			fprintf(out, "store(0x%x, r[%d], 0x%x);", di->imm, di->rA, addr);
+		else if (valid_reg_num(di->rB))
+			fprintf(out, "store(r[%d] + 0x%x, r[%d], 0x%x);", di->rB, di->imm, di->rA, addr);
+		else
+			goto bad_operands;
+		break;
+	case 0x50: // mrmovl
+		if (!valid_reg_num(di->rA))
+			goto bad_operands;
+		if (di->rB == 8)
+			fprintf(out, "r[%d] = load(0x%x, 0x%x);", di->rA, di->imm, addr);
+		else if (valid_reg_num(di->rB))
+			fprintf(out, "r[%d] = load(r[%d] + 0x%x, 0x%x);", di->rA, di->rB, di->imm, addr);
+		else
+			goto bad_operands;
+		break;
+	case 0x60: case 0x61: case 0x62: case 0x63: case 0x64: case 0x65: case 0x66: // addl..modl
+		if (!regs_ok)
+			goto bad_operands;
+		fprintf(out, "arith(%d, %d, %d, 0x%x);", op & 0xf, di->rA, di->rB, addr);
+		break;
+	case 0xf0: // rdch
+	case 0xf2: // rdint
+		if (!valid_reg_num(di->rA))
+			goto bad_operands;
+		fprintf(out, "r[%d] = %s(r[%d]);", di->rA, op == 0xf0 ? "rdch" : "rdint", di->rA);
+		break;
+	case 0xf1: // wrch
+		if (!valid_reg_num(di->rA))
+			goto bad_operands;
+		fprintf(out, "putchar((char)r[%d]);", di->rA);
+		break;
+	case 0xf3: // wrint
+		if (!valid_reg_num(di->rA))
+			goto bad_operands;
+		fprintf(out, "printf(\"%%d\", (int)r[%d]);", di->rA);
+		break;
+	case 0x70: // jmp
+		print_jump(m, out, di->imm, is_start);
+		fprintf(out, "\n");
+		return 0;
+	case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x76: { // jle, jl, je, jne, jge, jg
+		static const char *conds[] = {
+			"(SF ^ OF) | ZF", "SF ^ OF", "ZF", "!ZF", "!(SF ^ OF)", "!(SF ^ OF) & !ZF"
+		};
+
+		fprintf(out, "if (%s) ", conds[op - 0x71]);
+		print_jump(m, out, di->imm, is_start);
+		break;
+	}
+	case 0xa0: // pushl
+		if (!valid_reg_num(di->rA))
+			goto bad_operands;
+		fprintf(out, "push(r[%d], 0x%x);", di->rA, addr);
+		break;
+	case 0xb0: // popl
+		if (!valid_reg_num(di->rA))
+			goto bad_operands;
+		fprintf(out, "{ uint32_t val = pop(0x%x); r[%d] = val; }", addr, di->rA);
+		break;
+	case 0x80: // call
+		fprintf(out, "push(0x%x, 0x%x); ", di->next_pc, addr);
+		print_jump(m, out, di->imm, is_start);
+		fprintf(out, "\n");
+		return 0;
+	case 0x90: // ret
+		fprintf(out, "pc = pop(0x%x); goto dispatch;\n", addr);
+		return 0;
+	default:
+		fprintf(out, "fail(\"Could not find callback for opcode %x\", 0x%x);\n", mem_read8(m, addr), addr);
+		return 0;
+	}
+
+	fprintf(out, "\n");
+	return 1;
+
+ bad_operands:
+	fprintf(out, "fail(\"%s callback failed\", 0x%x);\n", di->instr->name, addr);
+	return 0;
+}
+
+/*
+  Writes a standalone C program equivalent to the assembled program in memory to
+  filename. Every instruction becomes a few C statements operating on a register
+  array, placed in one function under a switch on the PC with a case (and a C label
+  named after the y86 label, if any) for each instruction. Direct jumps and calls are
+  gotos, while ret and jumps to addresses that aren't instructions go through the
+  switch. The generated program reads from stdin, writes to stdout and exits with
+  status 0 on halt or 1 on any error the simulator would have reported.
+  Stores into the program's own instructions can't be reflected in the translated
+  code, so the generated program fails on them instead (self modifying programs must
+  be run in the simulator). Only the default 4 KiB
+  address space is supported, which the generated program keeps in a flat array.
+  Returns 1 on success, 0 if the file couldn't be written to
+*/
+int gen_c_file(Y86Machine *m, char *filename, char *source_name) {
+	uint16 *addrs;
+	uint8 is_start[4096], code_bits[4096/8], jumped_data_bits[4096/8];
+	int num_addrs, mem_end, code_end, i;
+	FILE *out;
+
+	if (m->mem_size != DEFAULT_MEM_SIZE)
+		return 0;
+
+	addrs = malloc(get_source_lines_size(m->source_lines) * sizeof(uint16) + sizeof(uint16));
+	if (addrs == NULL)
+		return 0;
+
+	out = fopen(filename, "w");
+	if (out == NULL) {
+		free(addrs);
+		return 0;
+	}
+
+	memset(is_start, 0, sizeof(is_start));
+	memset(code_bits, 0, sizeof(code_bits));
+	memset(jumped_data_bits, 0, sizeof(jumped_data_bits));
+	num_addrs = collect_instr_addrs(m, addrs, is_start);
+
+	// only direct jump and call targets get a C label, everything else is reached through the switch
+	for (i = 0; i < num_addrs; i++) {
+		DecodedInstr di;
+		uint8 op;
+
+		sim_decode(m, addrs[i], &di);
+		op = di.instr->opcode;
+
+		if ((op == 0x80 || (op >= 0x70 && op <= 0x76)) && (uint16)di.imm < 4096 && is_start[(uint16)di.imm])
+			is_start[(uint16)di.imm] = 2;
+	}
+
+	code_end = collect_code_bytes(m, is_start, code_bits, jumped_data_bits);
+
+	fprintf(out, "/* Generated by y86sim --emit-c from %s */\n", source_name);
+	fprintf(out, "#include <stdio.h>\n#include <stdlib.h>\n#include <stdint.h>\n\n");
+
+	// initial memory image, trailing zero bytes are left to the initializer
+	for (mem_end = 4096; mem_end > 0 && mem_read8(m, mem_end-1) == 0; mem_end--)
+		;
+
+	fprintf(out, "static unsigned char memory[4096] __attribute__((aligned(4))) = {");
+	for (i = 0; i < mem_end; i++)
+		fprintf(out, "%s0x%02x,", i % 16 == 0 ? "\n\t" : " ", mem_read8(m, i));
+	fprintf(out, "\n};\n\n");
+
+	fprintf(out, "#define CODE_END 0x%x\n", code_end);
+	print_bits(out, "code_bits", code_bits, code_end);
+	print_bits(out, "jumped_data_bits", jumped_data_bits, code_end);
+
+	fputs(c_prelude, out);
+
+	fprintf(out, "int main() {\n");
+	fprintf(out, "\tuint32_t pc = 0;\n\n");
+	fprintf(out, "\tgoto dispatch;\n");
+	fprintf(out, " dispatch:\n");
+	fprintf(out, "\tswitch (pc) {\n");
+
+	for (i = 0; i < num_addrs; i++) {
+		DecodedInstr di;
+		SourceLine *line = find_source_line(m, addrs[i]);
+
+		sim_decode(m, addrs[i], &di);
+
+		fprintf(out, "\tcase 0x%x: ", addrs[i]);
+		if (is_start[addrs[i]] == 2) {
+			print_c_label(m, out, addrs[i]);
+			fprintf(out, ": ");
+		}
+		fprintf(out, "/* %s */\n", line != NULL && strstr(line->line, "*/") == NULL ? line->line : di.instr->name);
+
+		// only fall through into the next case if it is the next instruction
+		if (print_instr(m, out, addrs[i], &di, is_start) && (i+1 == num_addrs || addrs[i+1] != di.next_pc))
+			fprintf(out, "\t\tpc = 0x%x; goto dispatch;\n", di.next_pc);
+	}
+
+	fprintf(out, "\tdefault:\n");
+	fprintf(out, "\t\tif (pc >= 4096) {\n");
+	fprintf(out, "\t\t\tfflush(stdout);\n");
+	fprintf(out, "\t\t\treturn 0;\n");
+	fprintf(out, "\t\t}\n");
+	fprintf(out, "\t\tfail(\"No translated instruction\", pc);\n");
+	fprintf(out, "\t}\n\n");
+	fprintf(out, "\treturn 1;\n");
+	fprintf(out, "}\n");
+
+	fclose(out);
+	free(addrs);
+	return 1;
+}
@@ -0,0 +1,8 @@
+#ifndef CGEN_H
+#define CGEN_H
+
+#include "common.h"
+
+int gen_c_file(Y86Machine *m, char *filename, char *source_name);
+
+#endif
@@ -134,11 +134,11 @@ long int stol(char *str) {
 }
 
 // Round "num" up to closest multiple of "to"
-int round_up_to_nearest(int num, int to) {
+long round_up_to_nearest(long num, long to) {
 	if (to == 0)
 		return num;
 	
-	int remainder = num % to;
+	long remainder = num % to;
 	
 	if (remainder == 0)
 		return num;
@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include "y86sim.h"
 
 // common to all functions
 #define SUCC 0
@@ -14,10 +15,13 @@
 // used by gen_byte_code
 #define INVALID_FILE 1
 #define PARSE_ERROR 2
+// used by load_obj_file
+#define NOT_AN_OBJECT 3
 
 typedef uint8_t uint8;
 typedef uint16_t uint16;
 typedef uint32_t uint32;
+typedef uint64_t uint64;
 
 //#define DEBUG
 
@@ -35,7 +39,7 @@ extern FILE *f_dbg;
 char *get_first_alphanumeric(char *buf);
 int is_alphanumeric(char c);
 int is_whitespace(char c);
-int round_up_to_nearest(int num, int to);
+long round_up_to_nearest(long num, long to);
 uint32 hex_char_to_val(char c);
 uint32 hexstr2long(char *str);
 int valid_stol_str(char *str);
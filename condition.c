@@ -4,23 +4,23 @@
 #include <string.h>
 #include <assert.h>
 #include "common.h"
-#include "console.h"
-#include "debugger.h"
 #include "simulator.h"
 #include "condition.h"
+#include "memory.h"
 
 // Returns 1 if val_desc is a valid value descriptor and 0 if it is not
-int valid_val_desc(char *val_desc) {
+int valid_val_desc(Y86Machine *m, char *val_desc) {
 	int err;
-	calc_value_descriptor(val_desc, &err);
+	calc_value_descriptor(m, val_desc, &err);
 	return err == SUCC;
 }
 
 /*
-  Takes an expression as a string and builds a struct Condition.
+  Takes an expression as a string and builds a struct Condition, with the value descriptors
+  x and y in arena (the machine's, or one of its own for a condition that is thrown away)
   Returns SUCC, INVALID_COND_EXPR or MEM_ERR
 */
-int build_cond_by_expr(Condition *cond, char *expr) {
+int build_cond_by_expr(Y86Machine *m, Arena *arena, Condition *cond, char *expr) {
 	char *lt, *gt, *eq, *neq, *op_str_ptr;
 	char *expr_copy;
 
@@ -86,17 +86,18 @@ int build_cond_by_expr(Condition *cond, char *expr) {
 		y_val_desc++;
 	}
 	
-	if (!valid_val_desc(x_val_desc) || !valid_val_desc(y_val_desc)) {
+	if (!valid_val_desc(m, x_val_desc) || !valid_val_desc(m, y_val_desc)) {
 		free(expr_copy);
 		return INVALID_COND_EXPR;
 	}
 	
-	cond->x = malloc(strlen(x_val_desc)+1);
-	cond->y = malloc(strlen(y_val_desc)+1);
-	strcpy(cond->x, x_val_desc);
-	strcpy(cond->y, y_val_desc);
-
+	cond->x = arena_strdup(arena, x_val_desc);
+	cond->y = arena_strdup(arena, y_val_desc);
 	free(expr_copy);
+
+	if (cond->x == NULL || cond->y == NULL)
+		return MEM_ERR;
+
 	return SUCC;
 }
 
@@ -106,7 +107,7 @@ int build_cond_by_expr(Condition *cond, char *expr) {
   Since 0 is a valid value descriptor, a pointer to an integer variable error is accepted
   If error is not NULL, it will be set to either SUCC or INVALID_VAL_DESC
 */
-uint32 calc_value_descriptor(char *val_desc, int *error) {
+uint32 calc_value_descriptor(Y86Machine *m, char *val_desc, int *error) {
 	DBG_PRINT("val_desc=%s\n", val_desc);
 	
 	if (*val_desc == '%') {
@@ -119,12 +120,12 @@ uint32 calc_value_descriptor(char *val_desc, int *error) {
 			return 0;
 		}
 		
-		DBG_PRINT("Register number = %d, val = %d\n", reg_num, registers[reg_num]);
+		DBG_PRINT("Register number = %d, val = %d\n", reg_num, m->registers[reg_num]);
 		
 		if (error != NULL)
 			*error = SUCC;
 		
-		return registers[reg_num];
+		return m->registers[reg_num];
 	}
 
 	else if (valid_stol_str(val_desc) || (*val_desc == '$' && valid_stol_str(val_desc+1))) {
@@ -178,12 +179,12 @@ uint32 calc_value_descriptor(char *val_desc, int *error) {
 		num_bytes = stol(num_bytes_str);
 		
 		/*
-		  Base cases:
+		  Base cases (with the default 4 KiB of memory):
 		  can read 1 byte from 4095
 		  can read 2 bytes from 4094
 		  can read 4 bytes from 4091
 		*/
-		if (addr > 4096 - num_bytes) {
+		if ((uint64)addr + num_bytes > m->mem_size) {
 			error_code = INVALID_VAL_DESC;
 			goto done; // read would overflow
 		}
@@ -191,11 +192,11 @@ uint32 calc_value_descriptor(char *val_desc, int *error) {
 		DBG_PRINT("addr=0x%x, num_bytes=0x%x\n", addr, num_bytes);
 		
 		if (num_bytes == 1)
-			ret = memory[addr];
+			ret = mem_read8(m, addr);
 		else if (num_bytes == 2)
-			ret = *((uint16*)&memory[addr]);
+			ret = mem_read8(m, addr) | (mem_read8(m, addr+1) << 8);
 		else if (num_bytes == 4)
-			ret = *((uint32*)&memory[addr]);
+			ret = mem_read32(m, addr);
 		
 	done:
 		// restore string
@@ -227,11 +228,11 @@ int get_cond_list_size(ConditionList *list) {
 }
 
 /*
-  Adds a condition to the linked list
+  Adds a condition to the linked list, the new node is allocated in arena
   Returns 0 on error and 1 on success
 */
-int add_condition_list(ConditionList **list, Condition *cond) {
-	ConditionList *new_entry = malloc(sizeof(ConditionList));
+int add_condition_list(Arena *arena, ConditionList **list, Condition *cond) {
+	ConditionList *new_entry = arena_alloc(arena, sizeof(ConditionList));
 	
 	if (new_entry == NULL || list == NULL)
 		return 0;
@@ -274,36 +275,34 @@ int remove_condition_list(ConditionList **list, Condition *cond) {
 	if (!found)
 		return 0;
 	
+	// the node and condition stay in the arena until the program is freed
 	if (prev == NULL) {
 		*list = (*(list))->next;
 	} else {
 		prev->next = cur->next;
 	}
 	
-	if (cur->con != NULL)
-		free(cur->con);
-	free(cur);
-	
 	return 1;
 }
 
 // Searches the linked list for a conditional expression supplied as a string
-Condition *find_cond_by_expr(ConditionList *list, char *expr) {
-	Condition *cond = malloc(sizeof(Condition));
+Condition *find_cond_by_expr(Y86Machine *m, ConditionList *list, char *expr) {
+	Arena scratch = {NULL};
+	Condition cond;
 	ConditionList *cur;
 	Condition *cond_in_list = NULL;
   
-	if (build_cond_by_expr(cond, expr) != SUCC) {
-		free(cond);
+	if (build_cond_by_expr(m, &scratch, &cond, expr) != SUCC) {
+		arena_free(&scratch);
 		return NULL;
 	}
 	
 	cur = list;
 	
 	while (cur != NULL) {
-		if (strcmp(cur->con->x, cond->x) == 0 &&
-			strcmp(cur->con->y, cond->y) == 0 &&
-			cur->con->op == cond->op) {
+		if (strcmp(cur->con->x, cond.x) == 0 &&
+			strcmp(cur->con->y, cond.y) == 0 &&
+			cur->con->op == cond.op) {
 			cond_in_list = cur->con;
 			break;
 		}
@@ -311,21 +310,18 @@ Condition *find_cond_by_expr(ConditionList *list, char *expr) {
 		cur = cur->next;
 	}
 
-	free(cond->x);
-	free(cond->y);
-	free(cond);
-	
+	arena_free(&scratch);
 	return cond_in_list;
 }
 
 // Returns 1 if the condition currently holds, and 0 if not
-int condition_holds(Condition *cond) {
+int condition_holds(Y86Machine *m, Condition *cond) {
 	int x_err, y_err, x_desc_val, y_desc_val;
   
 	assert(cond != NULL);
 	
-	x_desc_val = calc_value_descriptor(cond->x, &x_err);
-	y_desc_val = calc_value_descriptor(cond->y, &y_err);
+	x_desc_val = calc_value_descriptor(m, cond->x, &x_err);
+	y_desc_val = calc_value_descriptor(m, cond->y, &y_err);
 	
 	if (x_err != SUCC || y_err != SUCC)
 		return -1;
@@ -352,11 +348,11 @@ int condition_holds(Condition *cond) {
   Searches the linked list for the first condition that (currently) holds
   Returns the condition if one is found and NULL otherwise
 */
-Condition *find_true_condition_in_list(ConditionList *list) {
+Condition *find_true_condition_in_list(Y86Machine *m, ConditionList *list) {
 	ConditionList *cur_cond = list;
 	
 	while (cur_cond != NULL) {
-		if (condition_holds(cur_cond->con))
+		if (condition_holds(m, cur_cond->con))
 			return cur_cond->con;
 		
 		cur_cond = cur_cond->next;
@@ -364,28 +360,3 @@ Condition *find_true_condition_in_list(ConditionList *list) {
 	
 	return NULL;
 }
-
-// Frees the condition, including the value descriptors x and y
-void free_condition(Condition *cond) {
-	if (cond != NULL) {
-		if (cond->x != NULL)
-			free(cond->x);
-		if (cond->y != NULL)
-			free(cond->y);
-		free(cond);
-	}
-}
-
-// Frees all conditions in a linked list of conditions
-void free_condition_list(ConditionList *list) {
-	if (list != NULL) {
-		ConditionList *cur = list, *next = NULL;
-		
-		while (cur != NULL) {
-			free_condition(cur->con);
-			next = cur->next;
-			free(cur);
-			cur = next;
-		}
-	}
-}
@@ -2,6 +2,7 @@
 #define CONDITION_H
 
 #include "common.h"
+#include "arena.h"
 
 typedef enum {
 	OP_L, /* < */
@@ -22,17 +23,16 @@ typedef struct _ConditionList {
 	struct _ConditionList *next;
 } ConditionList;
 
-uint32 calc_value_descriptor(char *val_desc, int *error);
-Condition *find_true_condition_in_list(ConditionList *list);
-int add_condition_list(ConditionList **list, Condition *cond);
+uint32 calc_value_descriptor(Y86Machine *m, char *val_desc, int *error);
+Condition *find_true_condition_in_list(Y86Machine *m, ConditionList *list);
+int add_condition_list(Arena *arena, ConditionList **list, Condition *cond);
 int delete_condition_list(ConditionList **list, Condition *cond);
-Condition *find_cond_by_expr(ConditionList *list, char *expr);
-void free_condition_list(ConditionList *list);
-int build_cond_by_expr(Condition *cond, char *expr);
+Condition *find_cond_by_expr(Y86Machine *m, ConditionList *list, char *expr);
+int build_cond_by_expr(Y86Machine *m, Arena *arena, Condition *cond, char *expr);
 int get_cond_list_size(ConditionList *list);
-int add_condition_list(ConditionList **list, Condition *cond);
+int add_condition_list(Arena *arena, ConditionList **list, Condition *cond);
 int remove_condition_list(ConditionList **list, Condition *cond);
-Condition *find_cond_by_expr(ConditionList *list, char *expr);
-Condition *find_true_condition_in_list(ConditionList *list);
+Condition *find_cond_by_expr(Y86Machine *m, ConditionList *list, char *expr);
+Condition *find_true_condition_in_list(Y86Machine *m, ConditionList *list);
 
 #endif
@@ -396,3 +396,30 @@ void destroy_console() {
 	delwin(dbg);
 	endwin();
 }
+
+// I/O hooks for a machine running in the console (see Y86IO), rdint and rdch read from the simulator window
+static void console_read_int(void *ctx, uint32_t *reg) {
+	set_window_title(sim, "(STATUS: Waiting for integer input - rdint)");
+	read_from_win(sim, NULL, "%d", reg);
+	set_window_title(sim, NULL);
+}
+
+static void console_read_char(void *ctx, uint32_t *reg) {
+	set_window_title(sim, "(STATUS: Waiting for character input - rdch)");
+	read_from_win(sim, NULL, "%c", reg);
+	set_window_title(sim, NULL);
+}
+
+static void console_write_int(void *ctx, uint32_t val) {
+	write_to_sim("%d", val);
+}
+
+static void console_write_char(void *ctx, uint32_t val) {
+	write_to_sim("%c", val);
+}
+
+static void console_error(void *ctx, const char *msg) {
+	write_to_dbg("%s", msg);
+}
+
+Y86IO console_io = {console_read_int, console_read_char, console_write_int, console_write_char, console_error, NULL};
@@ -1,6 +1,7 @@
 #ifndef CONSOLE_H
 #define CONSOLE_H
 #include <curses.h>
+#include "y86sim.h"
 
 extern WINDOW *sim, *dbg;
 extern float dbg_win_frac;
@@ -8,6 +9,7 @@ extern int cur_sim_line, next_dbg_line, sim_window_overflow;
 extern int num_sim_lines, num_dbg_lines, line_width, num_lines;
 extern char **dbg_lines, **sim_lines;
 extern char sim_title[], dbg_title[];
+extern Y86IO console_io;
 
 void init_console();
 void resize_windows();
@@ -5,6 +5,7 @@
 #include <string.h>
 #include <limits.h>
 #include <assert.h>
+#include <signal.h>
 #include "assembler.h"
 #include "common.h"
 #include "console.h"
@@ -12,49 +13,86 @@
 #include "simulator.h"
 #include "condition.h"
 #include "pause.h"
+#include "memory.h"
 
-static void switch_to_debugger(char *title, ...);
-static void print_labels();
-static void print_source();
+static void switch_to_debugger(Y86Machine *m, char *title, ...);
+static void print_labels(Y86Machine *m);
+static void print_source(Y86Machine *m);
 
-int dbg_step = 0;
-ConditionList *watch_conditions = NULL;
+/*
+  The machine's dbg_armed is 0 while nothing could make the simulator stop for the
+  debugger (no breakpoints, conditional breakpoints, watch conditions or pending steps),
+  which lets it skip checking before each instruction. Everything it depends on can only
+  change while the debugger is active, so it is recomputed each time the debugger hands
+  control back (dbg_update_armed). The machine's interrupted flag is set by the SIGINT
+  handler and tells the simulator to suspend at the next instruction boundary even when
+  nothing is armed.
+*/
+static Y86Machine *interrupt_machine = NULL; // the machine Ctrl-C suspends
 
 /*
-  Called by simulator before executing each instruction.
-  Returns 1 if we should suspend execution to transfer control
-  to the debugger, and 0 if not. We transfer control to the debugger
-  when any of the following conditions hold:
-     1) The next instruction to execute has a (unconditional) breakpoint
-     2) The next instruction to execute has a conditional breakpoint,
-           and that condition is met
-     3) Any of the watch conditions are met
-     4) The user has requested suspension due to a step command in the debugger
+  Executes the program under the debugger, until the program ends
+  Control is transferred to the debugger whenever sim_run stops for it
 */
-int dbg_suspend_check() {
-	SourceLine *line = find_source_line(sim_get_pc());
-	
-	if (line == NULL)
-		return 0;
-	
-	return dbg_step == 1 ||
-		line->has_breakpoint ||
-		find_true_condition_in_list(line->cond_bp_list) != NULL ||
-		find_true_condition_in_list(watch_conditions) != NULL;
+void dbg_run_program(Y86Machine *m) {
+	int status;
+
+	m->dbg_step = 1; // start off suspended, waiting for debugger input
+	dbg_update_armed(m);
+
+	while ((status = sim_run(m, 0)) == STAT_BREAK || status == STAT_AOK)
+		dbg_suspend_program(m);
+
+	if ((status == STAT_ADR || status == STAT_INS) && !sim_fault_is_invalid_opcode(m))
+		write_to_dbg("%s callback failed, exiting...", sim_get_fault_instr(m));
+
+	get_key_and_exit();
 }
 
-// Called by the simulator to transfer control to the debugger
-void dbg_suspend_program() {
-	int PC = sim_get_pc();
-	SourceLine *line = find_source_line(PC);
+// Called when the simulator stops for the debugger, to transfer control to it
+void dbg_suspend_program(Y86Machine *m) {
+	int PC = sim_get_pc(m);
+	SourceLine *line = find_source_line(m, PC);
 	
 	DBG_PRINT("Suspending at PC=%d, line=%p\n", PC, line);
 	
 	if (line != NULL) {
-		switch_to_debugger("(STATUS Paused at 0x%x:%s)", line->addr, line->line);
+		switch_to_debugger(m, "(STATUS Paused at 0x%x:%s)", line->addr, line->line);
 	} else {
 		DBG_PRINT("Error suspending @ PC=%d\n", PC);
 	}
+
+	m->interrupted = 0; // a Ctrl-C while the debugger was waiting for a command shouldn't suspend again
+	dbg_update_armed(m);
+}
+
+// Recomputes dbg_armed from the breakpoints, watch conditions and step count
+void dbg_update_armed(Y86Machine *m) {
+	SourceLine *cur = m->source_lines;
+
+	m->dbg_armed = m->dbg_step != 0 || m->watch_conditions != NULL;
+
+	for (; cur != NULL && !m->dbg_armed; cur = cur->next)
+		m->dbg_armed = cur->has_breakpoint || cur->cond_bp_list != NULL;
+
+	DBG_PRINT("dbg_armed=%d\n", m->dbg_armed);
+}
+
+static void interrupt_handler(int sig) {
+	if (interrupt_machine != NULL)
+		y86_interrupt(interrupt_machine);
+}
+
+// Makes Ctrl-C (SIGINT) suspend the program running on m and activate the debugger
+void dbg_init_interrupt(Y86Machine *m) {
+	struct sigaction sa;
+
+	interrupt_machine = m;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = interrupt_handler;
+	sigemptyset(&sa.sa_mask);
+	sa.sa_flags = SA_RESTART;
+	sigaction(SIGINT, &sa, NULL);
 }
 
 // Pastes tokens together e.g. {"abc", "def", "ghi"} -> "abcdefghi"
@@ -78,7 +116,7 @@ static char *merge_tokens(char **tokens, int start, int end) {
   Switches control from the simulator to debugger
   Accepts commands until the user enters run, step, or exit
 */
-static void switch_to_debugger(char *title, ...) {
+static void switch_to_debugger(Y86Machine *m, char *title, ...) {
 	int run = 0;
 	char option;
 	char *view_mem_options = "ar";
@@ -102,8 +140,8 @@ static void switch_to_debugger(char *title, ...) {
 	}
     
 	do {
-		int i, found_one, num_args;
-		long addr;
+		int found_one, num_args;
+		long i, addr;
 		char *args[32], *cmd_name;
 		
 		read_from_win(dbg, NULL, "%s", command);
@@ -131,26 +169,28 @@ static void switch_to_debugger(char *title, ...) {
 			if (num_args >= 1 && valid_stol_str(args[0]) && stol(args[0]) > 0)
 				num_steps = stol(args[0])+1;
 
-			dbg_step = num_steps;
+			m->dbg_step = num_steps;
 			run = 1;
 		}
 		
 		else if (strcmp(cmd_name, "view") == 0) {
 			if (num_args > 0) {
 				if (strcmp(args[0], "s") == 0 || strcmp(args[0], "source") == 0)
-					print_source();
+					print_source(m);
 				else if (strcmp(args[0], "l") == 0 || strcmp(args[0], "labels") == 0)
-					print_labels();
+					print_labels(m);
 				else if (strcmp(args[0], "w") == 0 || strcmp(args[0], "watches") == 0)
-					print_condition_list("Conditions: ", watch_conditions);
+					print_condition_list("Conditions: ", m->watch_conditions);
 				
 				else if (strcmp(args[0], "r") == 0 || strcmp(args[0], "reg") == 0 ||
 						 strcmp(args[0], "regs") == 0 || strcmp(args[0], "registers") == 0) {
+					Flags *flgs = sim_get_flags(m);
+					
 					write_to_dbg("eax=0x%x, ecx=0x%x, edx=0x%x, ebx=0x%x, esp=0x%x, ebp=0x%x, esi=0x%x, edi=0x%x",
-								 registers[0], registers[1], registers[2], registers[3], registers[4], registers[5],
-								 registers[6], registers[7]);
+								 m->registers[0], m->registers[1], m->registers[2], m->registers[3], m->registers[4],
+								 m->registers[5], m->registers[6], m->registers[7]);
 					
-					write_to_dbg("OF=%d, SF=%d, ZF=%d", flgs.OF, flgs.SF, flgs.ZF);
+					write_to_dbg("OF=%d, SF=%d, ZF=%d", flgs->OF, flgs->SF, flgs->ZF);
 				}
 				
 				else if (strcmp(args[0], "breakpoints") == 0 ||
@@ -159,7 +199,7 @@ static void switch_to_debugger(char *title, ...) {
 					
 					if (addr == NULL) {
 						// printing all breakpoints
-						SourceLine *cur_line = source_lines;
+						SourceLine *cur_line = m->source_lines;
 
 						found_one = 0;
 											
@@ -183,7 +223,7 @@ static void switch_to_debugger(char *title, ...) {
 					} else {
 						// printing breakpoints at specified address
 						if (valid_stol_str(addr)) {
-							SourceLine *src_line = find_source_line(stol(addr));
+							SourceLine *src_line = find_source_line(m, stol(addr));
 
 							if (src_line != NULL) {
 								found_one = 0;
@@ -211,9 +251,9 @@ static void switch_to_debugger(char *title, ...) {
 				}
 				
 				else if (strcmp(args[0], "backtrace") == 0 || strcmp(args[0], "bt") == 0) {
-					StackFrame *top = stack_frames;
+					StackFrame *top = m->stack_frames;
 					
-					if (stack_frames == NULL) {
+					if (top == NULL) {
 						write_to_dbg("No stack frames to print");
 					}
 					
@@ -226,7 +266,7 @@ static void switch_to_debugger(char *title, ...) {
 				else if (strcmp(args[0], "m") == 0 || strcmp(args[0], "mem") == 0 ||
 						 strcmp(args[0], "memory") == 0) {
 					char addr_low[32], addr_high[32];
-					int low = 0, high = 0;
+					long low = 0, high = 0;
 					
 					read_from_win(dbg, "(a)ll, (r)ange", "%c", &option);
 					
@@ -248,34 +288,28 @@ static void switch_to_debugger(char *title, ...) {
 						high = stol(addr_high);
 					} else {
 						low = 0;
-						high = 4096;
-						
-						uint8 *p_high = &memory[4095];
 						
 						// we only print up to the point where the rest of memory is 0 
-						while (*p_high == 0)
-							p_high--;
-						
-						high = (int)(p_high - memory);
+						high = (long)mem_used_end(m) - 1;
 					}
 					
 					int count = 0;
 					
-					if (low <= high && low < 4096 && high < 4096) {
+					if (low >= 0 && low <= high && high < m->mem_size) {
 						char *formatted_mem_str = malloc(4096*6);
 						memset(formatted_mem_str, 0, 4096*6);
 						
 						for (i = low; i <= high; i++) {
 							if (count % 10 == 0) {
 								if (count == 0)
-									sprintf(formatted_mem_str, "0x%02x: %02x ", i, memory[i]);
+									sprintf(formatted_mem_str, "0x%02lx: %02x ", i, mem_read8(m, i));
 								else {
 									write_to_dbg("%s", formatted_mem_str);
 									memset(formatted_mem_str, 0, 4096*6);
-									sprintf(formatted_mem_str, "0x%02x: %02x ", i, memory[i]);
+									sprintf(formatted_mem_str, "0x%02lx: %02x ", i, mem_read8(m, i));
 								}
 							} else {
-								sprintf(formatted_mem_str, "%s%02x ", formatted_mem_str, memory[i]);
+								sprintf(formatted_mem_str, "%s%02x ", formatted_mem_str, mem_read8(m, i));
 							}
 							
 							count++;
@@ -299,23 +333,22 @@ static void switch_to_debugger(char *title, ...) {
 			
 			if (num_args > 0) {
 				if (strcmp(args[num_args-1], "del")) {
-					// adding a watch condition
-					cond = malloc(sizeof(Condition)); // never freed when used
+					// adding a watch condition, it lives in the arena with the program
+					cond = arena_alloc(&m->arena, sizeof(Condition));
 					
 					char *expr_no_spaces = merge_tokens(args, 0, num_args-1);
 					
-					err = build_cond_by_expr(cond, expr_no_spaces);
+					err = (cond == NULL) ? MEM_ERR : build_cond_by_expr(m, &m->arena, cond, expr_no_spaces);
 					
 					switch (err) {
 					case SUCC:
-						if (find_cond_by_expr(watch_conditions, expr_no_spaces) == NULL) {
-							if (add_condition_list(&watch_conditions, cond))
+						if (find_cond_by_expr(m, m->watch_conditions, expr_no_spaces) == NULL) {
+							if (add_condition_list(&m->arena, &m->watch_conditions, cond))
 								write_to_dbg("Added watch condition %s", expr_no_spaces);
 							else
 								write_to_dbg("Error adding watch condition");
 						} else {
 							write_to_dbg("Already watching for %s", expr_no_spaces);
-							free(cond);
 						}
 						break;
 					case MEM_ERR:
@@ -323,7 +356,6 @@ static void switch_to_debugger(char *title, ...) {
 						break;
 					case INVALID_COND_EXPR:
 						write_to_dbg("Invalid expression %s", expr_no_spaces);
-						free(cond);
 						break;
 					}
 					
@@ -331,16 +363,17 @@ static void switch_to_debugger(char *title, ...) {
 				}
 				
 				else if (strcmp(args[num_args-1], "del") == 0) {
-					// deleting a watch condition
-					cond = malloc(sizeof(Condition));
+					// deleting a watch condition, the one built to find it is thrown away
+					Arena scratch = {NULL};
+					Condition del_cond;
 					
 					char *expr_no_spaces = merge_tokens(args, 0, num_args-2);
 					
-					err = build_cond_by_expr(cond, expr_no_spaces);
+					err = build_cond_by_expr(m, &scratch, &del_cond, expr_no_spaces);
 					
 					switch (err) {
 					case SUCC:
-						if (remove_condition_list(&watch_conditions, cond))
+						if (remove_condition_list(&m->watch_conditions, &del_cond))
 							write_to_dbg("Deleted watch condition %s", expr_no_spaces);
 						else
 							write_to_dbg("Could not find watch condition %s", expr_no_spaces);
@@ -353,7 +386,7 @@ static void switch_to_debugger(char *title, ...) {
 						break;
 					}
 					
-					free(cond);
+					arena_free(&scratch);
 					free(expr_no_spaces);
 				}
 				else {
@@ -390,7 +423,7 @@ static void switch_to_debugger(char *title, ...) {
 			if (valid_stol_str(args[0])) // did we get an address?
 				addr = stol(args[0]);
 			
-			else if ((func_label = find_label(args[0])) != NULL) // or a label?
+			else if ((func_label = find_label(m, args[0])) != NULL) // or a label?
 				addr = func_label->addr;
 			
 			else {
@@ -399,7 +432,7 @@ static void switch_to_debugger(char *title, ...) {
 				continue;
 			}
 			
-			src_line = find_source_line(addr);
+			src_line = find_source_line(m, addr);
 			
 			if (src_line == NULL) {
 				write_to_dbg("No instruction at addr 0x%0x", addr);
@@ -417,9 +450,9 @@ static void switch_to_debugger(char *title, ...) {
 					if (option == 'y') {
 						src_line->has_breakpoint = 0;
 						src_line->has_cond_breakpoint = 0;
+						sim_flush_blocks(m);
 						
-						free_condition_list(src_line->cond_bp_list);
-						src_line->cond_bp_list = NULL;
+						src_line->cond_bp_list = NULL; // the conditions stay in the arena until the program is freed
 						
 						write_to_dbg("Deleted breakpoint at 0x%x", addr);
 					}
@@ -433,13 +466,15 @@ static void switch_to_debugger(char *title, ...) {
 						print_condition_list("Conditions: ", src_line->cond_bp_list);
 						read_from_win(dbg, "Enter a condition to delete", "%s", expr);
 						remove_whitespaces(expr);
-						cond = find_cond_by_expr(src_line->cond_bp_list, expr);
+						cond = find_cond_by_expr(m, src_line->cond_bp_list, expr);
 						
 						if (remove_condition_list(&src_line->cond_bp_list, cond)) {
 							write_to_dbg("Deleted breakpoint");
 							
 							if (get_cond_list_size(src_line->cond_bp_list) == 0)
 								src_line->has_cond_breakpoint = 0;
+							
+							sim_flush_blocks(m);
 						} else {
 							write_to_dbg("Invalid condition");
 						}
@@ -452,8 +487,8 @@ static void switch_to_debugger(char *title, ...) {
 			}
 			
 			else if (num_args > 1 && strcmp(args[1], "if") == 0) {
-				// adding a conditional breakpoint
-				cond = malloc(sizeof(Condition));
+				// adding a conditional breakpoint, it lives in the arena with the program
+				cond = arena_alloc(&m->arena, sizeof(Condition));
 				
 				if (cond == NULL)
 					return;
@@ -462,23 +497,22 @@ static void switch_to_debugger(char *title, ...) {
 				   so we ignore spaces by pasting all of the tokens together into full_expr */
 				char *expr_no_spaces = merge_tokens(args, 2, num_args-1);
 				
-				if (build_cond_by_expr(cond, expr_no_spaces) != SUCC) {
-					free(cond);
-					free(expr_no_spaces);
+				if (build_cond_by_expr(m, &m->arena, cond, expr_no_spaces) != SUCC) {
 					write_to_dbg("Invalid expression %s", expr_no_spaces);
+					free(expr_no_spaces);
 					continue;
 				}
 				
-				if (find_cond_by_expr(src_line->cond_bp_list, expr_no_spaces) == NULL) {
-					if (add_condition_list(&src_line->cond_bp_list, cond)) {
+				if (find_cond_by_expr(m, src_line->cond_bp_list, expr_no_spaces) == NULL) {
+					if (add_condition_list(&m->arena, &src_line->cond_bp_list, cond)) {
 						write_to_dbg("Added conditional breakpoint at 0x%x", src_line->addr);
 						src_line->has_cond_breakpoint = 1;
+						sim_flush_blocks(m);
 					} else {
 						write_to_dbg("Error adding breakpoint");
 					}
 				} else {
 					write_to_dbg("Conditional breakpoint %s exists", expr_no_spaces);
-					free(cond);
 				}
 				
 				free(expr_no_spaces);
@@ -488,6 +522,7 @@ static void switch_to_debugger(char *title, ...) {
 				// adding an unconditional breakpoint
 				if (!src_line->has_breakpoint) {
 					src_line->has_breakpoint = 1;
+					sim_flush_blocks(m);
 					write_to_dbg("Added breakpoint at 0x%x", addr);
 				} else {
 					write_to_dbg("Already have a breakpoint at 0x%x", addr);
@@ -497,7 +532,7 @@ static void switch_to_debugger(char *title, ...) {
 		
 		else if (strcmp(cmd_name, "pause") == 0) {
 			if (num_args > 0) {
-				if (gen_pause_file(args[0]))
+				if (gen_pause_file(m, args[0]))
 					write_to_dbg("Wrote simulator state to %s", args[0]);
 				else {
 					write_to_dbg("Error writing simulator state to %s", args[0]);
@@ -512,7 +547,7 @@ static void switch_to_debugger(char *title, ...) {
 		
 		else if (strcmp(cmd_name, "restore") == 0) {
 			if (num_args > 0) {
-				if (!restore_simulator_state(args[0])) {
+				if (!restore_simulator_state(m, args[0])) {
 					get_key_and_exit();
 				}
 			} else {
@@ -522,7 +557,7 @@ static void switch_to_debugger(char *title, ...) {
 		
 		else if (strcmp(cmd_name, "makeyis") == 0) {
 			if (num_args > 0) {
-				if (gen_yo_file(args[0]))
+				if (gen_yo_file(m, args[0]))
 					write_to_dbg("Wrote yo file to %s", args[0]);
 				else
 					write_to_dbg("Error writing to yo file at %s", args[0]);
@@ -614,8 +649,8 @@ static void switch_to_debugger(char *title, ...) {
 }
 
 // Prints a single SourceLine node to the window
-static void print_source_line(SourceLine *line) {
-	int i;
+static void print_source_line(Y86Machine *m, SourceLine *line) {
+	long i;
 	char out[512];
 	
 	sprintf(out, "0x%03x: ", line->addr);
@@ -623,8 +658,8 @@ static void print_source_line(SourceLine *line) {
 	if (!is_label_line(line->line) && strncmp(line->line, ".pos", 4) && strncmp(line->line, ".align", 6)) {
 		int instr_size = get_instr_size(line->line, line->addr);
 		
-		for (i = line->addr; i < line->addr + instr_size; i++)
-			sprintf(out, "%s%02x", out, memory[i]);
+		for (i = line->addr; i < (long)line->addr + instr_size; i++)
+			sprintf(out, "%s%02x", out, mem_read8(m, i));
 		
 		for (i = 0; i < 13 - 2*instr_size; i++)
 			strcat(out, " ");
@@ -648,17 +683,18 @@ static void print_source_line(SourceLine *line) {
 }
 
 // Prints the source code to the y86 file
-static void print_source() {
+static void print_source(Y86Machine *m) {
 	char option;
-	int key, start_addr, num_printed = 0;
-	SourceLine *cur = source_lines;
+	int key, num_printed = 0;
+	long start_addr;
+	SourceLine *cur = m->source_lines;
 	
 	read_from_win(dbg, "Print from (t)op, (c)urrent instruction or an (a)ddress", "%c", &option);
 	
 	if (option == 't')
 		start_addr = 0;
 	else if (option == 'c')
-		start_addr = sim_get_pc();
+		start_addr = sim_get_pc(m);
 	else {
 		char addr[32];
 		
@@ -672,7 +708,7 @@ static void print_source() {
 	// dont print more source than will fit into console
 	while (num_printed < num_dbg_lines-5 && cur != NULL) {
 		if (cur->addr >= start_addr) {
-			print_source_line(cur);
+			print_source_line(m, cur);
 			num_printed++;
 		}
 		
@@ -685,7 +721,7 @@ static void print_source() {
 		key = wgetch(dbg);
 		
 		if (key == 'p') {
-			print_source_line(cur);
+			print_source_line(m, cur);
 			cur = cur->next;
 		} else {
 			break;
@@ -694,27 +730,27 @@ static void print_source() {
 }
 
 // Prints all labels and their addresses
-static void print_labels() {
+static void print_labels(Y86Machine *m) {
 	int key_in;
 	int num_printed = 0;
 	
-	if (num_labels == 0) {
+	if (m->num_labels == 0) {
 		write_to_dbg("No labels to print");
 		return;
 	}
 	
 	// dont print more than will fit into console
-	while (num_printed < num_dbg_lines-5 && num_printed < num_labels) {
-		write_to_dbg("Label- 0x%x:%s", labels[num_printed]->addr, labels[num_printed]->name);
+	while (num_printed < num_dbg_lines-5 && num_printed < m->num_labels) {
+		write_to_dbg("Label- 0x%x:%s", m->labels[num_printed]->addr, m->labels[num_printed]->name);
 		num_printed++;
 	}
 	
-	while (num_printed < num_labels) {
+	while (num_printed < m->num_labels) {
 		mvwprintw(dbg, num_dbg_lines-2, 1, "Press p to print another label, d for done");
 		key_in = wgetch(dbg);
 		
 		if (key_in == 'p') {
-			write_to_dbg("Label- 0x%x:%s", labels[num_printed]->addr, labels[num_printed]->name);
+			write_to_dbg("Label- 0x%x:%s", m->labels[num_printed]->addr, m->labels[num_printed]->name);
 			num_printed++;
 		} else {
 			break;
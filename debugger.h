@@ -4,11 +4,10 @@
 #include "common.h"
 #include "condition.h"
 
-extern int dbg_step;
-extern ConditionList *watch_conditions;
-
-int dbg_suspend_check();
-void dbg_suspend_program();
+void dbg_run_program(Y86Machine *m);
+void dbg_suspend_program(Y86Machine *m);
+void dbg_update_armed(Y86Machine *m);
+void dbg_init_interrupt(Y86Machine *m);
 void print_condition_list(char *list_title, ConditionList *list);
 
 #endif
@@ -0,0 +1,102 @@
+// handlergen.c - Generates handlers.h, the register specialized handlers used by the simulator (see sim_decode)
+#include <stdio.h>
+
+/*
+  The two register instructions get one handler per (rA, rB) pair, with the register
+  numbers and the operation baked in, so executing them doesn't need to check the
+  register numbers or go through the switch in do_arithmetic. Each handler does
+  exactly what the generic callback would for that pair.
+*/
+typedef struct {
+	char *name;
+	int opcode;
+	char *arith_op; // ARITH_* constant, NULL for rrmovl
+	char *c_op; // C compound assignment operator applied to the destination register
+} SpecializedInstr;
+
+static SpecializedInstr specialized[] = {
+	{"rrmovl", 0x20, NULL, "="},
+	{"addl", 0x60, "ARITH_ADD", "+="},
+	{"subl", 0x61, "ARITH_SUB", "-="},
+	{"andl", 0x62, "ARITH_AND", "&="},
+	{"xorl", 0x63, "ARITH_XOR", "^="},
+	{"multl", 0x64, "ARITH_MULT", "*="},
+	{"divl", 0x65, "ARITH_DIV", "/="},
+	{"modl", 0x66, "ARITH_MOD", "%="}
+};
+
+#define NUM_SPECIALIZED (int)(sizeof(specialized) / sizeof(SpecializedInstr))
+
+static void gen_handler(SpecializedInstr *instr, int src, int dest) {
+	printf("static int %s_%d_%d(Y86Machine *m, DecodedInstr *di) {\n", instr->name, src, dest);
+
+	if (instr->opcode == 0x65 || instr->opcode == 0x66) {
+		// same as do_arithmetic, dividing by zero fails the instruction
+		printf("\tif (m->registers[%d] == 0) {\n", src);
+		printf("\t\tsim_error(m, \"%s by zero\");\n", instr->name);
+		printf("\t\tm->fault_status = STAT_INS;\n");
+		printf("\t\treturn 0;\n");
+		printf("\t}\n\n");
+	}
+
+	if (instr->arith_op != NULL) {
+		// same order as do_arithmetic: the source is read again after the destination is written
+		printf("\tm->lazy_flags.op = %s;\n", instr->arith_op);
+		printf("\tm->lazy_flags.orig_dest = m->registers[%d];\n", dest);
+		printf("\tm->registers[%d] %s m->registers[%d];\n", dest, instr->c_op, src);
+		printf("\tm->lazy_flags.src = m->registers[%d];\n", src);
+		printf("\tm->lazy_flags.result = m->registers[%d];\n", dest);
+	} else {
+		printf("\tm->registers[%d] %s m->registers[%d];\n", dest, instr->c_op, src);
+	}
+
+	printf("\tm->PC = di->next_pc;\n");
+	printf("\treturn 1;\n");
+	printf("}\n\n");
+}
+
+int main() {
+	int i, src, dest;
+
+	printf("// handlers.h - Generated by handlergen, do not edit\n\n");
+
+	for (i = 0; i < NUM_SPECIALIZED; i++)
+		for (src = 0; src < 8; src++)
+			for (dest = 0; dest < 8; dest++)
+				gen_handler(&specialized[i], src, dest);
+
+	// handler_table[i][(rA << 3) | rB] is the handler for specialized[i] with registers rA, rB
+	printf("static int (*const handler_table[%d][64])(Y86Machine *, DecodedInstr *) = {\n", NUM_SPECIALIZED);
+
+	for (i = 0; i < NUM_SPECIALIZED; i++) {
+		printf("\t{");
+
+		for (src = 0; src < 8; src++)
+			for (dest = 0; dest < 8; dest++)
+				printf("%s%s_%d_%d,", (src | dest) == 0 ? "" : (dest == 0 ? "\n\t " : " "),
+					   specialized[i].name, src, dest);
+
+		printf("},\n");
+	}
+
+	printf("};\n\n");
+
+	// maps an opcode to its row in handler_table
+	printf("/*\n");
+	printf("  Returns the specialized handler for the instruction with the given opcode and\n");
+	printf("  register numbers, or NULL if there isn't one\n");
+	printf("*/\n");
+	printf("static int (*specialized_handler(uint8 opcode, uint8 rA, uint8 rB))(Y86Machine *, DecodedInstr *) {\n");
+	printf("\tif (rA > 7 || rB > 7)\n");
+	printf("\t\treturn NULL;\n\n");
+	printf("\tswitch (opcode) {\n");
+
+	for (i = 0; i < NUM_SPECIALIZED; i++)
+		printf("\tcase 0x%02x: return handler_table[%d][(rA << 3) | rB];\n", specialized[i].opcode, i);
+
+	printf("\t}\n\n");
+	printf("\treturn NULL;\n");
+	printf("}\n");
+
+	return 0;
+}
@@ -0,0 +1,661 @@
+// jit.c - Compiles hot basic blocks into native x86-64 code, used by the jit engine
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "simulator.h"
+#include "jit.h"
+#include "memory.h"
+
+#ifdef JIT_ENGINE
+#include <sys/mman.h>
+
+/*
+  Compiled blocks are functions taking a JitContext * (in rdi) and returning the guest PC
+  to continue at in the low 32 bits of rax, with the number of guest instructions the
+  block retired in the bits above it. While a block runs, the 8 guest registers live in host
+  registers r8d-r15d (guest register g is host register 8+g), rbx holds the address
+  of the context's page of guest memory, rbp the address of its code map and rsi the
+  address of the guest flags. rax, rcx and rdx are scratch. Guest flags are stored to
+  memory after every arithmetic instruction, computed from the host EFLAGS with setcc.
+
+  Loads and stores to the context's page go straight to it. One to any other page calls
+  jit_switch_page, which makes that page the context's page (a one entry cache like the
+  machine's last_page, kept from one block to the next in jit_page_num). Whenever the guest would fault (an out of bounds mrmovl/rmmovl,
+  a stack overflow), or an access straddles two pages, the block exits with the PC of that
+  instruction, so the interpreter runs it again and reports the error exactly like it always did. Instructions the JIT doesn't
+  compile (rdint, rdch, wrint, wrch, halt, call, ret, multl, divl, modl) end the
+  compiled code the same way.
+*/
+
+#define JIT_BUF_SIZE (4*1024*1024)
+#define JIT_MAX_BLOCK_CODE (MAX_BLOCK_INSTRS*256 + 128) // generous upper bound on the code for one block
+
+// host registers
+#define RAX 0
+#define RCX 1
+#define RDX 2
+#define RBX 3
+#define RBP 5
+#define RSI 6
+#define RDI 7
+#define HOST(guest_reg) (8 + (guest_reg))
+
+// x86 condition codes (for jcc, setcc, cmovcc)
+#define CC_O 0x0
+#define CC_B 0x2
+#define CC_Z 0x4
+#define CC_NZ 0x5
+#define CC_BE 0x6
+#define CC_A 0x7
+#define CC_S 0x8
+
+// offsets into Flags and JitContext
+#define OFF_OF 0
+#define OFF_SF 4
+#define OFF_ZF 8
+#define OFF_REGISTERS 0
+#define OFF_FLAGS 8
+#define OFF_PAGE 16
+#define OFF_CODE_MAP 24
+#define OFF_SMC_ADDR 32
+#define OFF_SMC_HIT 36
+#define OFF_PAGE_NUM 40
+
+/*
+  Each machine has its own code buffer (jit_buf), with the shared epilogue at its start.
+  The emitters below only keep track of where they are while a block is being compiled,
+  which is per thread so machines on different threads can compile at the same time.
+*/
+static __thread uint8 *epilogue = NULL; // shared exit code at the start of the machine's jit_buf
+static __thread uint8 *cur = NULL; // where the next byte of code is emitted
+static __thread int cur_instr = 0; // index in its block of the instruction being compiled
+
+static void emit8(uint8 b) {
+	*cur++ = b;
+}
+
+static void emit32(uint32 v) {
+	emit8(v);
+	emit8(v >> 8);
+	emit8(v >> 16);
+	emit8(v >> 24);
+}
+
+// Emits a REX prefix for an instruction whose modrm reg field is r and r/m field is b, if one is needed
+static void emit_rex(int w, int r, int b) {
+	uint8 rex = 0x40 | (w << 3) | ((r >> 3) << 2) | (b >> 3);
+
+	if (rex != 0x40)
+		emit8(rex);
+}
+
+// op r/m32, r32 with two registers (0x89 mov, 0x01 add, 0x29 sub, 0x21 and, 0x31 xor, 0x09 or, 0x85 test)
+static void emit_rr(uint8 op, int dst, int src) {
+	emit_rex(0, src, dst);
+	emit8(op);
+	emit8(0xC0 | ((src & 7) << 3) | (dst & 7));
+}
+
+// mov r32, imm32
+static void emit_mov_imm(int reg, uint32 imm) {
+	emit_rex(0, 0, reg);
+	emit8(0xB8 | (reg & 7));
+	emit32(imm);
+}
+
+// add r32, imm32
+static void emit_add_imm(int reg, uint32 imm) {
+	emit_rex(0, 0, reg);
+	emit8(0x81);
+	emit8(0xC0 | (reg & 7));
+	emit32(imm);
+}
+
+// cmp r32, imm32
+static void emit_cmp_imm(int reg, uint32 imm) {
+	emit_rex(0, 0, reg);
+	emit8(0x81);
+	emit8(0xF8 | (reg & 7));
+	emit32(imm);
+}
+
+// op reg, [base+disp8] or op [base+disp8], reg (base must not be rsp/r12)
+static void emit_mem_disp8(int w, uint8 op, int reg, int base, int disp) {
+	emit_rex(w, reg, base);
+	emit8(op);
+	emit8(0x40 | ((reg & 7) << 3) | (base & 7));
+	emit8(disp);
+}
+
+// op reg, [rbx+rcx] or op [rbx+rcx], reg (the offset into the context's page in ecx, see emit_page_offset)
+static void emit_guest_mem(uint8 op, int reg) {
+	emit_rex(0, reg, 0);
+	emit8(op);
+	emit8(0x04 | ((reg & 7) << 3));
+	emit8(0x0B); // SIB: index rcx, base rbx
+}
+
+// setcc r8 (al, cl or dl)
+static void emit_setcc(int cc, int reg) {
+	emit8(0x0F);
+	emit8(0x90 | cc);
+	emit8(0xC0 | reg);
+}
+
+// Stores the 0/1 value in the low byte of reg to the guest flag at offset off
+static void emit_store_flag(int reg, int off) {
+	emit8(0x0F); // movzx reg, reg8
+	emit8(0xB6);
+	emit8(0xC0 | (reg << 3) | reg);
+	emit_mem_disp8(0, 0x89, reg, RSI, off);
+}
+
+// Returned by compiled code when it stops at pc after retiring retired instructions
+#define EXIT_VAL(pc, retired) (((uint64)(retired) << 32) | (uint32)(pc))
+
+// mov r64, imm64
+static void emit_mov_imm64(int reg, uint64 imm) {
+	emit_rex(1, 0, reg);
+	emit8(0xB8 | (reg & 7));
+	emit32(imm);
+	emit32(imm >> 32);
+}
+
+// Leaves the compiled code after retiring the given number of instructions, continuing at guest address pc (15 bytes)
+static void emit_exit(uint32 pc, int retired) {
+	emit_mov_imm64(RAX, EXIT_VAL(pc, retired));
+	emit8(0xE9); // jmp rel32
+	emit32(epilogue - (cur + 4));
+}
+
+/*
+  Exits to pc (the current instruction, which would fault) unless the last compare
+  gave condition cc (a jump over the 15 byte exit)
+*/
+static void emit_exit_unless(int cc, uint32 pc) {
+	emit8(0x70 | cc);
+	emit8(15);
+	emit_exit(pc, cur_instr);
+}
+
+/*
+  After a store to guest address eax, checks the code map and leaves the compiled
+  code (continuing at next_pc) if the store wrote over translated code, so jit_exec
+  can invalidate it
+*/
+static void emit_smc_check(uint32 next_pc) {
+	emit8(0x8B); // mov edx, [rbp+rcx]
+	emit8(0x54);
+	emit8(0x0D);
+	emit8(0x00);
+	emit_rr(0x85, RDX, RDX);
+	emit8(0x70 | CC_Z); // jz over the exit path (3 + 7 + 15 bytes)
+	emit8(25);
+	emit_mem_disp8(0, 0x89, RAX, RDI, OFF_SMC_ADDR);
+	emit8(0xC7); // mov dword [rdi+OFF_SMC_HIT], 1
+	emit8(0x47);
+	emit8(OFF_SMC_HIT);
+	emit32(1);
+	emit_exit(next_pc, cur_instr+1);
+}
+
+// Computes the guest address reg + offset (or just the address when rB is 8) into eax
+static void emit_guest_addr(DecodedInstr *di) {
+	if (di->rB == 8) {
+		emit_mov_imm(RAX, di->imm);
+	} else {
+		emit_rr(0x89, RAX, HOST(di->rB));
+		emit_add_imm(RAX, di->imm);
+	}
+}
+
+// zero code map for pages without a code page
+static uint8 no_code_map[PAGE_SIZE];
+
+/*
+  Called from compiled code when a load or store at addr isn't on the context's page:
+  makes the page holding addr the context's page. Returns the page's data, or NULL if
+  the interpreter has to run the instruction (addr is out of bounds, nothing was stored
+  on the page yet and this is a load, or the page couldn't be allocated)
+*/
+static uint8 *jit_switch_page(JitContext *ctx, uint32 addr, int write) {
+	Y86Machine *m = ctx->m;
+	CodePage *code;
+	uint8 *data;
+
+	if (addr > m->mem_size-4)
+		return NULL;
+
+	if ((data = mem_page_data(m, addr >> PAGE_BITS, write)) == NULL)
+		return NULL;
+
+	code = sim_find_code_page(m, addr >> PAGE_BITS);
+	ctx->page_num = addr >> PAGE_BITS;
+	ctx->page = data;
+	ctx->code_map = code != NULL ? code->block_code : no_code_map;
+	return data;
+}
+
+/*
+  Turns the guest address in eax into an offset into the context's page in ecx (for
+  emit_guest_mem), calling jit_switch_page first if the address is on another page.
+  Exits to pc if the access can't be done here: the switch failed, or it straddles two pages.
+  Leaves eax as it was, and rdx holds garbage
+*/
+static void emit_page_offset(uint32 pc, int write) {
+	uint8 *skip;
+
+	emit_rr(0x89, RCX, RAX);
+	emit8(0xC1); // shr ecx, PAGE_BITS
+	emit8(0xE9);
+	emit8(PAGE_BITS);
+	emit_mem_disp8(0, 0x3B, RCX, RDI, OFF_PAGE_NUM);
+	emit8(0x70 | CC_Z); // jz over the call
+	skip = cur;
+	emit8(0);
+
+	// save the caller saved registers we use (7 pushes keep the stack 16 byte aligned for the call)
+	emit8(0x50); // push rax
+	emit8(0x56); // push rsi
+	emit8(0x57); // push rdi
+	emit8(0x41); emit8(0x50); // push r8
+	emit8(0x41); emit8(0x51); // push r9
+	emit8(0x41); emit8(0x52); // push r10
+	emit8(0x41); emit8(0x53); // push r11
+	emit_rr(0x89, RSI, RAX);
+	emit_mov_imm(RDX, write);
+	emit_mov_imm64(RAX, (uint64)(uintptr_t)jit_switch_page);
+	emit8(0xFF); // call rax
+	emit8(0xD0);
+	emit8(0x48); // mov rdx, rax
+	emit8(0x89);
+	emit8(0xC2);
+	emit8(0x41); emit8(0x5B); // pop r11
+	emit8(0x41); emit8(0x5A); // pop r10
+	emit8(0x41); emit8(0x59); // pop r9
+	emit8(0x41); emit8(0x58); // pop r8
+	emit8(0x5F); // pop rdi
+	emit8(0x5E); // pop rsi
+	emit8(0x58); // pop rax
+	emit8(0x48); // test rdx, rdx
+	emit8(0x85);
+	emit8(0xD2);
+	emit8(0x70 | CC_NZ); // jnz over the exit
+	emit8(15);
+	emit_exit(pc, cur_instr);
+	emit_mem_disp8(1, 0x8B, RBX, RDI, OFF_PAGE);
+	emit_mem_disp8(1, 0x8B, RBP, RDI, OFF_CODE_MAP);
+	*skip = cur - (skip + 1);
+
+	emit_rr(0x89, RCX, RAX);
+	emit_rex(0, 0, RCX); // and ecx, PAGE_MASK
+	emit8(0x81);
+	emit8(0xE1);
+	emit32(PAGE_MASK);
+	emit_cmp_imm(RCX, PAGE_SIZE-4);
+	emit_exit_unless(CC_BE, pc);
+}
+
+/*
+  Emits addl, subl, andl or xorl, storing the flags the same way do_arithmetic
+  computes them (which is not always what the host means by OF)
+*/
+static void emit_arithmetic(DecodedInstr *di) {
+	int src = HOST(di->rA), dest = HOST(di->rB);
+	int same = di->rA == di->rB;
+
+	switch (di->instr->opcode) {
+	case 0x60: // addl: OF is only set when two positive numbers give a negative result
+		emit_rr(0x01, dest, src);
+		emit_setcc(CC_S, RCX);
+		emit_setcc(CC_Z, RDX);
+		emit_setcc(CC_O, RAX);
+		emit_rr(0x21, RAX, RCX);
+		break;
+	case 0x61: // subl: OF is set when both operands were negative, unless the result is 0x7fffffff
+		emit_rr(0x89, RAX, dest);
+		emit_rr(0x21, RAX, src);
+		emit8(0xC1); // shr eax, 31
+		emit8(0xE8);
+		emit8(31);
+		emit_rr(0x29, dest, src);
+		emit_setcc(CC_S, RCX);
+		emit_setcc(CC_Z, RDX);
+		emit_store_flag(RCX, OFF_SF);
+		emit_store_flag(RDX, OFF_ZF);
+		emit_cmp_imm(dest, 0x7FFFFFFF);
+		emit_setcc(CC_NZ, RCX);
+		emit8(0x0F); // movzx ecx, cl
+		emit8(0xB6);
+		emit8(0xC9);
+		emit_rr(0x21, RAX, RCX);
+
+		if (same)
+			emit_rr(0x31, RAX, RAX);
+
+		emit_mem_disp8(0, 0x89, RAX, RSI, OFF_OF);
+		return;
+	case 0x62: // andl
+		emit_rr(0x21, dest, src);
+		emit_setcc(CC_S, RCX);
+		emit_setcc(CC_Z, RDX);
+		emit_rr(0x31, RAX, RAX);
+		break;
+	case 0x63: // xorl
+		emit_rr(0x31, dest, src);
+		emit_setcc(CC_S, RCX);
+		emit_setcc(CC_Z, RDX);
+		emit_rr(0x31, RAX, RAX);
+		break;
+	}
+
+	// do_arithmetic reads the source after writing the destination, so OF can't be set when they are the same register
+	if (same)
+		emit_rr(0x31, RAX, RAX);
+
+	emit_store_flag(RAX, OFF_OF);
+	emit_store_flag(RCX, OFF_SF);
+	emit_store_flag(RDX, OFF_ZF);
+}
+
+/*
+  Emits a conditional jump: loads the guest flags, computes the condition,
+  and exits to either the target or the fall through address
+*/
+static void emit_cond_jump(DecodedInstr *di) {
+	int cmov_cc;
+
+	emit_mem_disp8(0, 0x8B, RAX, RSI, OFF_SF); // eax = SF ^ OF
+	emit_mem_disp8(0, 0x33, RAX, RSI, OFF_OF);
+	emit_mem_disp8(0, 0x8B, RCX, RSI, OFF_ZF); // ecx = ZF
+
+	switch (di->instr->opcode) {
+	case 0x73: // je
+		emit_rr(0x85, RCX, RCX);
+		cmov_cc = CC_NZ;
+		break;
+	case 0x74: // jne
+		emit_rr(0x85, RCX, RCX);
+		cmov_cc = CC_Z;
+		break;
+	case 0x72: // jl
+		emit_rr(0x85, RAX, RAX);
+		cmov_cc = CC_NZ;
+		break;
+	case 0x75: // jge
+		emit_rr(0x85, RAX, RAX);
+		cmov_cc = CC_Z;
+		break;
+	case 0x71: // jle
+		emit_rr(0x09, RAX, RCX);
+		cmov_cc = CC_NZ;
+		break;
+	default: // jg
+		emit_rr(0x09, RAX, RCX);
+		cmov_cc = CC_Z;
+		break;
+	}
+
+	emit_mov_imm64(RAX, EXIT_VAL(di->next_pc, cur_instr+1));
+	emit_mov_imm64(RDX, EXIT_VAL(di->imm, cur_instr+1));
+	emit8(0x48); // cmovcc rax, rdx
+	emit8(0x0F);
+	emit8(0x40 | cmov_cc);
+	emit8(0xC2);
+	emit8(0xE9); // jmp epilogue
+	emit32(epilogue - (cur + 4));
+}
+
+/*
+  Emits the code for one instruction at guest address pc
+  Returns 1 if the instruction was compiled, or 0 if the interpreter has to run it
+*/
+static int compile_instr(DecodedInstr *di, uint32 pc) {
+	int valid_a = di->rA <= 7, valid_b = di->rB <= 7;
+
+	switch (di->instr->opcode) {
+	case 0x00: // nop
+		return 1;
+
+	case 0x30: // irmovl
+		if (!valid_b)
+			return 0;
+		emit_mov_imm(HOST(di->rB), di->imm);
+		return 1;
+
+	case 0x20: // rrmovl
+		if (!valid_a || !valid_b)
+			return 0;
+		emit_rr(0x89, HOST(di->rB), HOST(di->rA));
+		return 1;
+
+	case 0x60: case 0x61: case 0x62: case 0x63: // addl, subl, andl, xorl
+		if (!valid_a || !valid_b)
+			return 0;
+		emit_arithmetic(di);
+		return 1;
+
+	case 0x50: // mrmovl
+		if (!valid_a || (!valid_b && di->rB != 8))
+			return 0;
+
+		emit_guest_addr(di);
+		emit_page_offset(pc, 0);
+		emit_guest_mem(0x8B, HOST(di->rA));
+		return 1;
+
+	case 0x40: // rmmovl
+		if (!valid_a || (!valid_b && di->rB != 8))
+			return 0;
+
+		emit_guest_addr(di);
+		emit_page_offset(pc, 1);
+		emit_guest_mem(0x89, HOST(di->rA));
+		emit_smc_check(di->next_pc);
+		return 1;
+
+	case 0xa0: // pushl (the value is read before esp changes, in case it is esp)
+		if (!valid_a)
+			return 0;
+
+		emit_rr(0x89, RAX, HOST(ESP));
+		emit_cmp_imm(RAX, 4);
+		emit_exit_unless(0x3, pc); // jae
+		emit_add_imm(RAX, -4);
+		emit_page_offset(pc, 1); // also catches esp past the end of memory
+		emit_rr(0x89, RDX, HOST(di->rA));
+		emit_rr(0x89, HOST(ESP), RAX);
+		emit_guest_mem(0x89, RDX);
+		emit_smc_check(di->next_pc);
+		return 1;
+
+	case 0xb0: // popl (the destination is written before esp is incremented, like popl())
+		if (!valid_a)
+			return 0;
+
+		emit_rr(0x89, RAX, HOST(ESP));
+		emit_page_offset(pc, 0);
+		emit_guest_mem(0x8B, RDX);
+		emit_rr(0x89, HOST(di->rA), RDX);
+		emit_add_imm(HOST(ESP), 4);
+		return 1;
+
+	case 0x70: // jmp
+		emit_exit(di->imm, cur_instr+1);
+		return 1;
+
+	case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x76: // jXX
+		emit_cond_jump(di);
+		return 1;
+	}
+
+	return 0;
+}
+
+// Emits the epilogue shared by every compiled block: store the guest registers back and return
+static void emit_epilogue() {
+	int g;
+
+	emit_mem_disp8(1, 0x8B, RCX, RDI, OFF_REGISTERS);
+
+	for (g = 0; g < 8; g++)
+		emit_mem_disp8(0, 0x89, HOST(g), RCX, 4*g);
+
+	emit8(0x41); emit8(0x5F); // pop r15
+	emit8(0x41); emit8(0x5E); // pop r14
+	emit8(0x41); emit8(0x5D); // pop r13
+	emit8(0x41); emit8(0x5C); // pop r12
+	emit8(0x5D); // pop rbp
+	emit8(0x5B); // pop rbx
+	emit8(0xC3); // ret
+}
+
+// Emits the start of a compiled block: save callee saved registers and load the guest state
+static void emit_prologue() {
+	int g;
+
+	emit8(0x53); // push rbx
+	emit8(0x55); // push rbp
+	emit8(0x41); emit8(0x54); // push r12
+	emit8(0x41); emit8(0x55); // push r13
+	emit8(0x41); emit8(0x56); // push r14
+	emit8(0x41); emit8(0x57); // push r15
+
+	emit_mem_disp8(1, 0x8B, RBX, RDI, OFF_PAGE);
+	emit_mem_disp8(1, 0x8B, RBP, RDI, OFF_CODE_MAP);
+	emit_mem_disp8(1, 0x8B, RSI, RDI, OFF_FLAGS);
+	emit_mem_disp8(1, 0x8B, RCX, RDI, OFF_REGISTERS);
+
+	for (g = 0; g < 8; g++)
+		emit_mem_disp8(0, 0x8B, HOST(g), RCX, 4*g);
+}
+
+/*
+  Allocates the machine's executable code buffer
+  Returns 1 on success, 0 if the buffer could not be mapped (the jit engine then
+  runs blocks through the interpreter)
+*/
+int jit_init(Y86Machine *m) {
+	uint8 *buf;
+
+	if (m->jit_buf != NULL)
+		return 1;
+
+	buf = mmap(NULL, JIT_BUF_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+			   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (buf == MAP_FAILED) {
+		DBG_PRINT("Could not map jit buffer\n");
+		return 0;
+	}
+
+	m->jit_buf = buf;
+	jit_reset(m);
+	return 1;
+}
+
+// Throws away all compiled code, called whenever the block cache is flushed
+void jit_reset(Y86Machine *m) {
+	m->jit_page_num = NO_PAGE; // memory may be about to be cleared
+
+	if (m->jit_buf == NULL)
+		return;
+
+	cur = m->jit_buf;
+	epilogue = cur;
+	emit_epilogue();
+	m->jit_used = cur - m->jit_buf;
+}
+
+// Unmaps the machine's code buffer
+void jit_free(Y86Machine *m) {
+	if (m->jit_buf != NULL)
+		munmap(m->jit_buf, JIT_BUF_SIZE);
+
+	m->jit_buf = NULL;
+	m->jit_used = 0;
+}
+
+/*
+  Compiles the longest prefix of the block made of instructions the jit supports
+  Returns the native code, or NULL if the first instruction isn't supported or
+  the code buffer is full (in which case the block cache is flushed to make room)
+*/
+void *jit_compile(Y86Machine *m, Block *block) {
+	uint8 *start;
+	uint32 pc = block->start;
+	int i, num_compiled = 0;
+	DecodedInstr *di;
+
+	if (m->jit_buf == NULL)
+		return NULL;
+
+	if (m->jit_used + JIT_MAX_BLOCK_CODE > JIT_BUF_SIZE) {
+		sim_flush_blocks(m);
+		return NULL;
+	}
+
+	epilogue = m->jit_buf;
+	start = cur = m->jit_buf + m->jit_used;
+	emit_prologue();
+
+	for (i = 0; i < block->num_instrs; i++) {
+		di = &block->instrs[i];
+		cur_instr = i;
+
+		if (!compile_instr(di, pc)) {
+			emit_exit(pc, i);
+			break;
+		}
+
+		num_compiled++;
+		pc = di->next_pc;
+
+		if (di->instr->opcode >= 0x70 && di->instr->opcode <= 0x76)
+			break; // jumps already exited
+	}
+
+	if (i == block->num_instrs)
+		emit_exit(block->end, i);
+
+	if (num_compiled == 0)
+		return NULL;
+
+	m->jit_used = cur - m->jit_buf;
+	DBG_PRINT("Compiled block at 0x%x (%d instructions, %d bytes)\n", block->start, num_compiled, (int)(cur - start));
+	return start;
+}
+
+/*
+  Runs a block compiled by jit_compile, returning the address of the next instruction
+  to execute and setting retired to the number of instructions that ran. If the block
+  stored into translated code, the code is invalidated here
+*/
+uint32 jit_exec(Y86Machine *m, void *code, int *retired) {
+	JitContext ctx;
+	uint64 exit_val;
+
+	ctx.registers = m->registers;
+	ctx.flags = sim_get_flags(m); // compiled code reads and writes flgs directly, so evaluate them first
+	ctx.m = m;
+	ctx.smc_hit = 0;
+	ctx.page_num = NO_PAGE;
+	ctx.page = NULL;
+	ctx.code_map = no_code_map;
+
+	// start on the page the last compiled block left off on
+	if (m->jit_page_num != NO_PAGE)
+		jit_switch_page(&ctx, m->jit_page_num << PAGE_BITS, 0);
+
+	exit_val = ((uint64 (*)(JitContext *))code)(&ctx);
+	m->jit_page_num = ctx.page_num;
+
+	if (ctx.smc_hit)
+		sim_invalidate_decoded(m, ctx.smc_addr, 4);
+
+	*retired = exit_val >> 32;
+	return (uint32)exit_val;
+}
+
+#endif
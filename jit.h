@@ -0,0 +1,29 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "common.h"
+#include "simulator.h"
+
+#ifdef JIT_ENGINE
+
+// Passed to compiled blocks, which find everything they need through it
+typedef struct _JitContext {
+	uint32 *registers; // guest registers, loaded on entry and stored back on exit
+	Flags *flags;
+	uint8 *page; // data of the page loads and stores go to without leaving compiled code
+	uint8 *code_map; // block_code of that page: nonzero for every byte that belongs to a translated block
+	uint32 smc_addr; // set along with smc_hit when a store wrote to code_map'd memory
+	uint32 smc_hit;
+	uint32 page_num; // number of the page in page, or NO_PAGE
+	Y86Machine *m;
+} JitContext;
+
+int jit_init(Y86Machine *m);
+void *jit_compile(Y86Machine *m, Block *block);
+uint32 jit_exec(Y86Machine *m, void *code, int *retired);
+void jit_reset(Y86Machine *m);
+void jit_free(Y86Machine *m);
+
+#endif
+
+#endif
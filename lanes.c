@@ -0,0 +1,637 @@
+// lanes.c - Runs many copies of one program side by side in lockstep, one lane per copy (see y86_new_lanes)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "simulator.h"
+#include "memory.h"
+
+#ifdef LANE_ENGINE
+
+#define LANE_WIDTH 8 // lanes per vector, 8 x 32 bits fills an AVX2 register (or two SSE ones)
+#define LANE_MEM_SIZE DEFAULT_MEM_SIZE // lanes only run programs with the default 4 KiB of memory
+#define MAX_STEPS_UNCOUNTED (1 << 30) // steps between folding steps[] into counts[], so it can't overflow
+
+/*
+  On x86-64 the functions doing the vector work are compiled twice, for AVX2 and for the
+  SSE2 every x86-64 has, and the dynamic linker picks the one the CPU can run
+*/
+#if defined(__x86_64__) && defined(__linux__)
+#define LANE_TARGETS __attribute__((target_clones("avx2", "default")))
+#else
+#define LANE_TARGETS
+#endif
+
+typedef uint32 LaneVec __attribute__((vector_size(LANE_WIDTH * sizeof(uint32))));
+typedef int32_t LaneSVec __attribute__((vector_size(LANE_WIDTH * sizeof(uint32))));
+
+/*
+  The lanes are kept in structure of arrays form: lanes g*LANE_WIDTH to g*LANE_WIDTH+7
+  make up group g, and every register, the PC and each flag of a group is one vector,
+  so an instruction executes for a whole group with a few vector operations. Flags
+  are worked out eagerly (all ones when set) since that's cheap with vectors. Each lane
+  has a memory of its own, LANE_MEM_SIZE bytes starting at memory + lane*LANE_MEM_SIZE.
+
+  Every step runs the instruction at the lowest PC of any running lane, for all the
+  lanes whose PC is equal to it. Lanes split up when they take different ways at a jXX,
+  and since the lanes that are behind always go first they come back together where
+  the paths meet again (such as the instruction after an if, or the end of a loop).
+*/
+struct _Y86Lanes {
+	int num_lanes, num_groups;
+	LaneVec *regs; // register r of group g is regs[r*num_groups + g]
+	LaneVec *pc;
+	LaneVec *zf, *sf, *of;
+	LaneVec *running; // all ones for lanes which haven't stopped
+	LaneVec *mask; // lanes taking part in the current step
+	LaneVec *steps; // instructions retired since they were last added to counts
+	uint64 *counts, *limits;
+	int *status; // STAT_* code each lane stopped with, 0 while it's running
+	Y86IO *io;
+	uint8 *memory;
+
+	/*
+	  Decoded instructions shared by all lanes. Only instructions none of the lanes has
+	  stored into are cached here, the others are decoded from the memory of the first
+	  lane at the PC (see lane_step), and lanes whose bytes differ wait for a later step.
+	*/
+	DecodedInstr decoded[LANE_MEM_SIZE];
+	uint8 written[LANE_MEM_SIZE]; // set for bytes some lane has stored into
+};
+
+#define REG(l, r, g) ((l)->regs[(r) * (l)->num_groups + (g)])
+
+#define LANE_SPLAT(val) ((LaneVec){0} + (uint32)(val))
+
+// lanes set in mask get a, the others b
+#define LANE_BLEND(mask, a, b) (((a) & (mask)) | ((b) & ~(mask)))
+
+static inline int lane_any(LaneVec *v) {
+	int i;
+
+	for (i = 0; i < LANE_WIDTH; i++)
+		if ((*v)[i])
+			return 1;
+
+	return 0;
+}
+
+static uint32 *lane_reg(Y86Lanes *l, int reg_num, int lane) {
+	return (uint32 *)&REG(l, reg_num, lane / LANE_WIDTH) + lane % LANE_WIDTH;
+}
+
+static uint8 *lane_memory(Y86Lanes *l, int lane) {
+	return l->memory + (size_t)lane * LANE_MEM_SIZE;
+}
+
+// Stops the lane with the given STAT_* code, reporting fmt through its error hook unless it's NULL
+static void lane_stop(Y86Lanes *l, int lane, int status, char *fmt, ...) {
+	char msg[512];
+	va_list args;
+
+	if (fmt != NULL) {
+		va_start(args, fmt);
+		vsnprintf(msg, sizeof(msg), fmt, args);
+		va_end(args);
+		l->io[lane].error(l->io[lane].ctx, msg);
+	}
+
+	l->status[lane] = status;
+	l->running[lane / LANE_WIDTH][lane % LANE_WIDTH] = 0;
+}
+
+// Stops every lane in the step with status, see lane_stop
+static void lane_stop_all(Y86Lanes *l, int status) {
+	int g, i;
+
+	for (g = 0; g < l->num_groups; g++)
+		for (i = 0; i < LANE_WIDTH; i++)
+			if (l->mask[g][i])
+				lane_stop(l, g*LANE_WIDTH + i, status, NULL);
+}
+
+// Records a store into a lane's memory, forgetting decoded instructions that overlap it
+static void lane_written(Y86Lanes *l, uint32 addr) {
+	int i;
+
+	for (i = (int)addr - 5; i < (int)addr + 4; i++)
+		if (i >= 0)
+			l->decoded[i].valid = 0;
+
+	memset(&l->written[addr], 1, 4);
+}
+
+/*
+  Y86Lanes *y86_new_lanes(Y86Machine *m, int num_lanes, Y86IO *io)
+  Sets up num_lanes copies of the program loaded in m, each starting with m's memory,
+  registers, flags and PC. Lane i uses the hooks in io[i], where hooks that are NULL are
+  taken from m (as with y86_set_io). m isn't used again and may be freed.
+  Returns NULL if there isn't enough memory, or if m's address space isn't the default 4 KiB
+*/
+Y86Lanes *y86_new_lanes(Y86Machine *m, int num_lanes, Y86IO *io) {
+	Y86Lanes *l;
+	Flags *flgs = sim_get_flags(m);
+	int i, r, g, num_groups = (num_lanes + LANE_WIDTH - 1) / LANE_WIDTH;
+	void *vecs;
+
+	if (num_lanes <= 0 || m->mem_size != LANE_MEM_SIZE || (l = calloc(1, sizeof(Y86Lanes))) == NULL)
+		return NULL;
+
+	if (posix_memalign(&vecs, sizeof(LaneVec), 15 * num_groups * sizeof(LaneVec)) != 0) {
+		free(l);
+		return NULL;
+	}
+
+	l->num_lanes = num_lanes;
+	l->num_groups = num_groups;
+	l->regs = vecs;
+	l->pc = l->regs + 8*num_groups;
+	l->zf = l->pc + num_groups;
+	l->sf = l->zf + num_groups;
+	l->of = l->sf + num_groups;
+	l->running = l->of + num_groups;
+	l->mask = l->running + num_groups;
+	l->steps = l->mask + num_groups;
+	l->counts = calloc(num_lanes, sizeof(uint64));
+	l->limits = calloc(num_lanes, sizeof(uint64));
+	l->status = calloc(num_lanes, sizeof(int));
+	l->io = calloc(num_lanes, sizeof(Y86IO));
+	l->memory = malloc((size_t)num_lanes * LANE_MEM_SIZE);
+
+	if (l->counts == NULL || l->limits == NULL || l->status == NULL || l->io == NULL || l->memory == NULL) {
+		y86_free_lanes(l);
+		return NULL;
+	}
+
+	for (g = 0; g < num_groups; g++) {
+		for (r = 0; r < 8; r++)
+			REG(l, r, g) = LANE_SPLAT(m->registers[r]);
+
+		l->pc[g] = LANE_SPLAT(m->PC);
+		l->zf[g] = LANE_SPLAT(flgs->ZF ? ~0 : 0);
+		l->sf[g] = LANE_SPLAT(flgs->SF ? ~0 : 0);
+		l->of[g] = LANE_SPLAT(flgs->OF ? ~0 : 0);
+		l->running[g] = LANE_SPLAT(0);
+		l->steps[g] = LANE_SPLAT(0);
+	}
+
+	for (i = 0; i < num_lanes; i++) {
+		l->io[i] = m->io;
+
+		if (io[i].read_int != NULL)
+			l->io[i].read_int = io[i].read_int;
+		if (io[i].read_char != NULL)
+			l->io[i].read_char = io[i].read_char;
+		if (io[i].write_int != NULL)
+			l->io[i].write_int = io[i].write_int;
+		if (io[i].write_char != NULL)
+			l->io[i].write_char = io[i].write_char;
+		if (io[i].error != NULL)
+			l->io[i].error = io[i].error;
+
+		l->io[i].ctx = io[i].ctx;
+		l->status[i] = STAT_BUDGET; // so the first y86_run_lanes starts it
+		mem_read(m, 0, lane_memory(l, i), LANE_MEM_SIZE);
+	}
+
+	return l;
+}
+
+void y86_free_lanes(Y86Lanes *l) {
+	if (l == NULL)
+		return;
+
+	free(l->regs);
+	free(l->counts);
+	free(l->limits);
+	free(l->status);
+	free(l->io);
+	free(l->memory);
+	free(l);
+}
+
+// Adds steps[] to counts[], and returns how many steps can run before a lane could reach its limit
+static uint64 lane_count_steps(Y86Lanes *l) {
+	uint64 until = MAX_STEPS_UNCOUNTED;
+	int i;
+
+	for (i = 0; i < l->num_lanes; i++) {
+		l->counts[i] += l->steps[i / LANE_WIDTH][i % LANE_WIDTH];
+
+		if (l->status[i] == 0) {
+			if (l->counts[i] >= l->limits[i])
+				lane_stop(l, i, STAT_BUDGET, NULL);
+			else if (l->limits[i] - l->counts[i] < until)
+				until = l->limits[i] - l->counts[i];
+		}
+	}
+
+	for (i = 0; i < l->num_groups; i++)
+		l->steps[i] = LANE_SPLAT(0);
+
+	return until;
+}
+
+// Sets taken to whether a jXX (or jmp) with the given opcode is taken, for each lane of group g
+static inline void lane_cond(Y86Lanes *l, uint8 opcode, int g, LaneVec *taken) {
+	LaneVec lt = l->sf[g] ^ l->of[g];
+
+	switch (opcode) {
+	case 0x71: *taken = lt | l->zf[g]; break; // jle
+	case 0x72: *taken = lt; break; // jl
+	case 0x73: *taken = l->zf[g]; break; // je
+	case 0x74: *taken = ~l->zf[g]; break; // jne
+	case 0x75: *taken = ~lt; break; // jge
+	case 0x76: *taken = ~lt & ~l->zf[g]; break; // jg
+	default: *taken = LANE_SPLAT(~0); break; // jmp
+	}
+}
+
+// addl, subl, andl, xorl, multl, divl and modl for a whole group at a time, see do_arithmetic
+LANE_TARGETS static void lane_arith(Y86Lanes *l, DecodedInstr *di, int g) {
+	LaneVec mask = l->mask[g], src = REG(l, di->rA, g), dest = REG(l, di->rB, g), res, zero;
+	uint8 opcode = di->instr->opcode;
+	int i;
+
+	if (opcode == 0x65 || opcode == 0x66) {
+		// as in do_arithmetic, a lane dividing by zero stops with STAT_INS, the others go on
+		zero = mask & (LaneVec)(src == 0);
+
+		for (i = 0; i < LANE_WIDTH && lane_any(&zero); i++)
+			if (zero[i])
+				lane_stop(l, g*LANE_WIDTH + i, STAT_INS, "%s by zero", di->instr->name);
+
+		mask &= ~zero;
+		src = LANE_BLEND(mask, src, LANE_SPLAT(1));
+	}
+
+	switch (opcode) {
+	case 0x60: res = dest + src; break;
+	case 0x61: res = dest - src; break;
+	case 0x62: res = dest & src; break;
+	case 0x63: res = dest ^ src; break;
+	case 0x64: res = dest * src; break;
+	case 0x65: res = dest / src; break;
+	default: res = dest % src; break;
+	}
+
+	REG(l, di->rB, g) = LANE_BLEND(mask, res, dest);
+
+	// the flags see the source register after the write, as in do_arithmetic and update_flags
+	if (di->rA == di->rB)
+		src = res;
+
+	l->zf[g] = LANE_BLEND(mask, (LaneVec)(res == 0), l->zf[g]);
+	l->sf[g] = LANE_BLEND(mask, (LaneVec)((LaneSVec)res < 0), l->sf[g]);
+
+	if (opcode == 0x60 || opcode == 0x64 || opcode == 0x65)
+		l->of[g] = LANE_BLEND(mask, (LaneVec)((LaneSVec)dest > 0) & (LaneVec)((LaneSVec)src > 0) &
+							  (LaneVec)(res > 0x7FFFFFFF), l->of[g]);
+	else if (opcode == 0x61)
+		l->of[g] = LANE_BLEND(mask, (LaneVec)((LaneSVec)dest < 0) & (LaneVec)((LaneSVec)src < 0) &
+							  (LaneVec)((LaneSVec)res < 0x7FFFFFFF), l->of[g]);
+	else
+		l->of[g] &= ~mask;
+
+	l->pc[g] = LANE_BLEND(mask, LANE_SPLAT(di->next_pc), l->pc[g]);
+	l->steps[g] -= mask;
+}
+
+// Pushes val onto the lane's stack, see pushl. Returns 1 on success, 0 if the lane stopped
+static int lane_push(Y86Lanes *l, int lane, uint32 val) {
+	uint32 *esp = lane_reg(l, ESP, lane);
+
+	// also catches %esp below 4, which would wrap around past the end of memory
+	if (*esp > LANE_MEM_SIZE || *esp < 4) {
+		lane_stop(l, lane, STAT_ADR, "Stack overflow");
+		return 0;
+	}
+
+	*esp -= 4;
+	memcpy(lane_memory(l, lane) + *esp, &val, 4);
+	lane_written(l, *esp);
+	return 1;
+}
+
+// Pops a value off the lane's stack into val, see popl. Returns 1 on success, 0 if the lane stopped
+static int lane_pop(Y86Lanes *l, int lane, uint32 *val) {
+	uint32 esp = *lane_reg(l, ESP, lane);
+
+	if (esp > LANE_MEM_SIZE-4) {
+		lane_stop(l, lane, STAT_ADR, "Stack overflow");
+		return 0;
+	}
+
+	memcpy(val, lane_memory(l, lane) + esp, 4);
+	return 1;
+}
+
+/*
+  Executes an instruction the vector code doesn't handle (memory, stack and I/O) for one lane,
+  the same way its callback in simulator.c would
+  Returns 1 if the instruction retired, 0 if the lane stopped
+*/
+static int lane_exec(Y86Lanes *l, int lane, DecodedInstr *di) {
+	uint8 *memory = lane_memory(l, lane);
+	uint32 *pc = (uint32 *)&l->pc[lane / LANE_WIDTH] + lane % LANE_WIDTH;
+	uint32 addr, val;
+	Y86IO *io = &l->io[lane];
+
+	switch (di->instr->opcode) {
+	case 0x40: // rmmovl
+	case 0x50: // mrmovl
+		addr = di->rB == 8 ? di->imm : *lane_reg(l, di->rB, lane) + (int)di->imm;
+
+		if (addr > LANE_MEM_SIZE-4) {
+			lane_stop(l, lane, STAT_ADR, "%s offset out of bounds", di->instr->name);
+			return 0;
+		}
+
+		if (di->instr->opcode == 0x40) {
+			memcpy(memory + addr, lane_reg(l, di->rA, lane), 4);
+			lane_written(l, addr);
+		} else {
+			memcpy(lane_reg(l, di->rA, lane), memory + addr, 4);
+		}
+		break;
+	case 0xf2: // rdint
+		io->read_int(io->ctx, lane_reg(l, di->rA, lane));
+		break;
+	case 0xf0: // rdch
+		io->read_char(io->ctx, lane_reg(l, di->rA, lane));
+		break;
+	case 0xf3: // wrint
+		io->write_int(io->ctx, *lane_reg(l, di->rA, lane));
+		break;
+	case 0xf1: // wrch
+		io->write_char(io->ctx, *lane_reg(l, di->rA, lane));
+		break;
+	case 0xa0: // pushl
+		if (!lane_push(l, lane, *lane_reg(l, di->rA, lane)))
+			return 0;
+		break;
+	case 0xb0: // popl
+		if (!lane_pop(l, lane, &val))
+			return 0;
+
+		*lane_reg(l, di->rA, lane) = val;
+		*lane_reg(l, ESP, lane) += 4;
+		break;
+	case 0x80: // call
+		if (!lane_push(l, lane, di->next_pc))
+			return 0;
+
+		*pc = di->imm;
+		return 1;
+	case 0x90: // ret
+		if (!lane_pop(l, lane, &val))
+			return 0;
+
+		*lane_reg(l, ESP, lane) += 4;
+		*pc = val;
+		return 1;
+	}
+
+	*pc = di->next_pc;
+	return 1;
+}
+
+// Returns 1 if the instruction's register numbers are ones its callback accepts
+static int lane_regs_valid(DecodedInstr *di) {
+	switch (di->instr->opcode) {
+	case 0x30: // irmovl
+		return di->rB <= 7;
+	case 0x40: // rmmovl
+	case 0x50: // mrmovl
+		return di->rA <= 7 && di->rB <= 8;
+	case 0x20: // rrmovl
+	case 0x60: case 0x61: case 0x62: case 0x63: case 0x64: case 0x65: case 0x66:
+		return di->rA <= 7 && di->rB <= 7;
+	case 0xf0: case 0xf1: case 0xf2: case 0xf3: // rdch, wrch, rdint, wrint
+	case 0xa0: case 0xb0: // pushl, popl
+		return di->rA <= 7;
+	}
+
+	return 1;
+}
+
+// Runs di for every lane in l->mask
+LANE_TARGETS static void lane_step(Y86Lanes *l, DecodedInstr *di) {
+	uint8 opcode = di->instr->opcode;
+	LaneVec mask, done, taken;
+	int g, i;
+
+	if (di->instr->cmd_callback == invalid_opcode_callback) {
+		for (g = 0; g < l->num_groups; g++)
+			for (i = 0; i < LANE_WIDTH; i++)
+				if (l->mask[g][i])
+					lane_stop(l, g*LANE_WIDTH + i, STAT_INS, "Could not find callback for opcode %x at PC=0x%x",
+							  lane_memory(l, g*LANE_WIDTH + i)[l->pc[g][i]], l->pc[g][i]);
+		return;
+	}
+
+	if (!lane_regs_valid(di)) {
+		lane_stop_all(l, STAT_INS);
+		return;
+	}
+
+	for (g = 0; g < l->num_groups; g++) {
+		if (!lane_any(&l->mask[g]))
+			continue;
+
+		mask = l->mask[g];
+
+		switch (opcode) {
+		case 0x00: // nop
+			l->pc[g] = LANE_BLEND(mask, LANE_SPLAT(di->next_pc), l->pc[g]);
+			break;
+		case 0x10: // halt, which retires
+			for (i = 0; i < LANE_WIDTH; i++)
+				if (mask[i])
+					lane_stop(l, g*LANE_WIDTH + i, STAT_HLT, NULL);
+			break;
+		case 0x20: // rrmovl
+			REG(l, di->rB, g) = LANE_BLEND(mask, REG(l, di->rA, g), REG(l, di->rB, g));
+			l->pc[g] = LANE_BLEND(mask, LANE_SPLAT(di->next_pc), l->pc[g]);
+			break;
+		case 0x30: // irmovl
+			REG(l, di->rB, g) = LANE_BLEND(mask, LANE_SPLAT(di->imm), REG(l, di->rB, g));
+			l->pc[g] = LANE_BLEND(mask, LANE_SPLAT(di->next_pc), l->pc[g]);
+			break;
+		case 0x60: case 0x61: case 0x62: case 0x63: case 0x64: case 0x65: case 0x66:
+			lane_arith(l, di, g);
+			continue; // counts its own steps
+		case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x76:
+			lane_cond(l, opcode, g, &taken);
+			taken &= mask;
+			l->pc[g] = LANE_BLEND(taken, LANE_SPLAT(di->imm), LANE_BLEND(mask, LANE_SPLAT(di->next_pc), l->pc[g]));
+			break;
+		default:
+			done = LANE_SPLAT(0);
+
+			for (i = 0; i < LANE_WIDTH; i++)
+				if (mask[i] && lane_exec(l, g*LANE_WIDTH + i, di))
+					done[i] = ~0;
+
+			mask = done;
+			break;
+		}
+
+		l->steps[g] -= mask;
+	}
+}
+
+/*
+  Picks the lanes for the next step: sets l->mask to the running lanes at the lowest PC
+  of any running lane and min_pc to that PC, since the lanes that are furthest behind go
+  first. Every PC past the end of memory counts as LANE_MEM_SIZE, so those lanes all
+  halt together. Returns the first lane in the step, or -1 if no lanes are running
+*/
+LANE_TARGETS static int lane_schedule(Y86Lanes *l, uint32 *min_pc) {
+	LaneVec min = LANE_SPLAT(~0), end = LANE_SPLAT(LANE_MEM_SIZE), pc, waiting;
+	int g, i, lead = -1;
+
+	// stopped lanes are never the lowest
+	for (g = 0; g < l->num_groups; g++) {
+		pc = LANE_BLEND((LaneVec)(l->pc[g] < end), l->pc[g], end);
+		waiting = pc | ~l->running[g];
+		min = LANE_BLEND((LaneVec)(waiting < min), waiting, min);
+	}
+
+	for (*min_pc = ~0, i = 0; i < LANE_WIDTH; i++)
+		if (min[i] < *min_pc)
+			*min_pc = min[i];
+
+	if (*min_pc == (uint32)~0)
+		return -1;
+
+	for (g = 0; g < l->num_groups; g++) {
+		pc = LANE_BLEND((LaneVec)(l->pc[g] < end), l->pc[g], end);
+		l->mask[g] = l->running[g] & (LaneVec)(pc == *min_pc);
+
+		for (i = 0; i < LANE_WIDTH && lead < 0; i++)
+			if (l->mask[g][i])
+				lead = g*LANE_WIDTH + i;
+	}
+
+	return lead;
+}
+
+/*
+  Runs the lanes until each one halts, fails or has executed max_instrs instructions in
+  total (0 means no limit). Lanes stop with the same STAT_* codes as y86_run, apart from
+  STAT_BREAK and STAT_AOK as the debugger isn't consulted. Unlike y86_run the limit counts
+  from y86_new_lanes, so lanes which are ahead don't run further ahead when the lanes are
+  run a slice at a time, and lanes stopped by STAT_BUDGET carry on with the next call if
+  it allows them more instructions.
+  Returns the number of lanes stopped by STAT_BUDGET, so 0 once every lane is finished
+*/
+int y86_run_lanes(Y86Lanes *l, uint64_t max_instrs) {
+	DecodedInstr di, *cached;
+	uint64 step = 0, next_count;
+	uint32 min_pc;
+	int i, lead, len, budget_stops = 0;
+	uint8 *lead_mem;
+
+	for (i = 0; i < l->num_lanes; i++) {
+		if (l->status[i] == STAT_BUDGET) {
+			l->status[i] = 0;
+			l->running[i / LANE_WIDTH][i % LANE_WIDTH] = ~0;
+			l->limits[i] = max_instrs != 0 ? max_instrs : UINT64_MAX;
+		}
+	}
+
+	next_count = lane_count_steps(l);
+
+	for (;;) {
+		if (step == next_count)
+			next_count = step + lane_count_steps(l);
+
+		if ((lead = lane_schedule(l, &min_pc)) < 0)
+			break;
+
+		// ran off the end of memory
+		if (min_pc >= LANE_MEM_SIZE) {
+			lane_stop_all(l, STAT_HLT);
+			continue;
+		}
+
+		cached = &l->decoded[min_pc];
+
+		if (!cached->valid) {
+			lead_mem = lane_memory(l, lead);
+			sim_decode_mem(lead_mem, LANE_MEM_SIZE, min_pc, &di);
+			len = min_pc + di.len <= LANE_MEM_SIZE ? di.len : LANE_MEM_SIZE - min_pc;
+
+			if (memchr(&l->written[min_pc], 1, len) == NULL) {
+				*cached = di;
+			} else {
+				/* some lane has stored into the instruction, so it only runs for the lanes
+				   whose bytes are the same as the first lane's */
+				for (i = lead+1; i < l->num_lanes; i++)
+					if (l->mask[i / LANE_WIDTH][i % LANE_WIDTH] && memcmp(lane_memory(l, i) + min_pc, lead_mem + min_pc, len) != 0)
+						l->mask[i / LANE_WIDTH][i % LANE_WIDTH] = 0;
+
+				cached = &di;
+			}
+		}
+
+		lane_step(l, cached);
+		step++;
+	}
+
+	lane_count_steps(l);
+
+	for (i = 0; i < l->num_lanes; i++)
+		budget_stops += l->status[i] == STAT_BUDGET;
+
+	return budget_stops;
+}
+
+int y86_get_lane_status(Y86Lanes *l, int lane) {
+	return l->status[lane];
+}
+
+uint64_t y86_get_lane_instr_count(Y86Lanes *l, int lane) {
+	return l->counts[lane];
+}
+
+uint32_t y86_get_lane_pc(Y86Lanes *l, int lane) {
+	return l->pc[lane / LANE_WIDTH][lane % LANE_WIDTH];
+}
+
+uint32_t y86_get_lane_reg(Y86Lanes *l, int lane, int reg_num) {
+	return reg_num >= 0 && reg_num <= 7 ? *lane_reg(l, reg_num, lane) : 0;
+}
+
+#else
+
+// Vectors need GCC's vector extensions, without them there is no lane engine
+Y86Lanes *y86_new_lanes(Y86Machine *m, int num_lanes, Y86IO *io) {
+	return NULL;
+}
+
+void y86_free_lanes(Y86Lanes *l) {
+}
+
+int y86_run_lanes(Y86Lanes *l, uint64_t max_instrs) {
+	return 0;
+}
+
+int y86_get_lane_status(Y86Lanes *l, int lane) {
+	return 0;
+}
+
+uint64_t y86_get_lane_instr_count(Y86Lanes *l, int lane) {
+	return 0;
+}
+
+uint32_t y86_get_lane_pc(Y86Lanes *l, int lane) {
+	return 0;
+}
+
+uint32_t y86_get_lane_reg(Y86Lanes *l, int lane, int reg_num) {
+	return 0;
+}
+
+#endif
@@ -0,0 +1,153 @@
+// machine.c - The public interface of liby86sim (see y86sim.h), a thin layer over the simulator and assembler
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "simulator.h"
+#include "assembler.h"
+#include "object.h"
+#include "jit.h"
+#include "memory.h"
+
+// the dispatch table is shared by every machine, and built by whichever machine is created first
+static pthread_once_t dispatch_table_once = PTHREAD_ONCE_INIT;
+
+// Returns a new machine with nothing loaded, or NULL if there is not enough memory
+Y86Machine *y86_new_machine() {
+	Y86Machine *m;
+
+	pthread_once(&dispatch_table_once, sim_init_dispatch_table);
+	m = malloc(sizeof(Y86Machine));
+
+	if (m != NULL && !sim_init_machine(m)) {
+		free(m);
+		return NULL;
+	}
+
+	return m;
+}
+
+// Frees the machine and everything it allocated
+void y86_free_machine(Y86Machine *m) {
+	if (m == NULL)
+		return;
+
+	sim_free_machine(m);
+	free(m);
+}
+
+// Replaces the machine's I/O hooks, hooks that are NULL in io are left as they were
+void y86_set_io(Y86Machine *m, Y86IO *io) {
+	if (io->read_int != NULL)
+		m->io.read_int = io->read_int;
+	if (io->read_char != NULL)
+		m->io.read_char = io->read_char;
+	if (io->write_int != NULL)
+		m->io.write_int = io->write_int;
+	if (io->write_char != NULL)
+		m->io.write_char = io->write_char;
+	if (io->error != NULL)
+		m->io.error = io->error;
+
+	m->io.ctx = io->ctx;
+}
+
+/*
+  Selects the execution core (one of the ENGINE_* constants)
+  Returns 1 on success, 0 if the engine isn't available in this build or the jit
+  couldn't allocate its code buffer, in which case the machine uses the block engine
+*/
+int y86_set_engine(Y86Machine *m, int engine) {
+	m->engine = ENGINE_BLOCK;
+
+	switch (engine) {
+	case ENGINE_CALLBACK:
+	case ENGINE_BLOCK:
+		break;
+#ifdef THREADED_ENGINE
+	case ENGINE_THREADED:
+		break;
+#endif
+#ifdef JIT_ENGINE
+	case ENGINE_JIT:
+		if (!jit_init(m))
+			return 0;
+		break;
+#endif
+	default:
+		return 0;
+	}
+
+	m->engine = engine;
+	return 1;
+}
+
+/*
+  Sets the size of the machine's address space to size bytes, a multiple of 4 KiB up to
+  4 GiB (4 KiB by default), and clears memory. Memory is only allocated a page at a time
+  as the program uses it, so a large address space costs nothing until it is touched
+  Returns 1 on success, 0 if size isn't valid
+*/
+int y86_set_mem_size(Y86Machine *m, uint64_t size) {
+	return mem_set_size(m, size);
+}
+
+/*
+  Assembles the y86 source file (or loads the object file written by y86sim --emit-obj) into
+  the machine's memory, replacing whatever was loaded, and resets the registers, flags and PC so the program runs from the start
+  Returns 1 on success, 0 on error (after reporting it through the error hook)
+*/
+int y86_load_file(Y86Machine *m, char *filename) {
+	switch (load_program(m, filename)) {
+	case INVALID_FILE:
+		sim_error(m, "Error opening %s for reading", filename);
+		return 0;
+	case PARSE_ERROR:
+		sim_error(m, "Error parsing %s", filename);
+		return 0;
+	}
+
+	sim_init_registers(m);
+	sim_init_flags(m);
+	sim_set_pc(m, 0);
+
+	sim_free_stack_frames(m);
+	m->instr_count = 0;
+	m->fault_status = 0;
+	m->fault_instr = NULL;
+	m->skip_break_check = 0;
+	return 1;
+}
+
+/*
+  Runs the loaded program for at most max_instrs instructions (0 means no limit)
+  Returns one of the STAT_* codes, see sim_run
+*/
+int y86_run(Y86Machine *m, uint64_t max_instrs) {
+	return sim_run(m, max_instrs);
+}
+
+/*
+  Makes y86_run return STAT_AOK at the next instruction boundary. Only sets a flag,
+  so it may be called from a signal handler or another thread
+*/
+void y86_interrupt(Y86Machine *m) {
+	m->interrupted = 1;
+}
+
+// Returns the value of a register (EAX...EDI), or 0 if reg_num is not a register number
+uint32_t y86_get_reg(Y86Machine *m, int reg_num) {
+	return reg_num >= 0 && reg_num <= 7 ? m->registers[reg_num] : 0;
+}
+
+uint32_t y86_get_pc(Y86Machine *m) {
+	return sim_get_pc(m);
+}
+
+uint64_t y86_get_instr_count(Y86Machine *m) {
+	return sim_get_instr_count(m);
+}
+
+// Returns the name of the instruction y86_run last stopped on with STAT_ADR or STAT_INS
+const char *y86_get_fault_instr(Y86Machine *m) {
+	return sim_get_fault_instr(m);
+}
@@ -1,35 +1,194 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "console.h"
 #include "assembler.h"
 #include "simulator.h"
+#include "debugger.h"
+#include "cgen.h"
+#include "batch.h"
+#include "object.h"
 #include "common.h"
 
+static void print_usage(char *prog_name) {
+	printf("Usage: %s [options] <y86 source, .yo or object file>\n", prog_name);
+	printf("Options:\n");
+	printf("  --engine <block|callback|threaded|jit>  Selects the execution core (default block)\n");
+	printf("  --emit-c <file>                         Translates the program to a standalone C program instead of running it\n");
+	printf("  --emit-obj <file>                       Assembles the program to an object file, which loads without assembling, instead of running it\n");
+	printf("  --batch                                 Runs the program without the console or debugger, using stdin and stdout\n");
+	printf("  --mem-size <bytes>                      Size of the address space, a multiple of 4096 up to 4 GiB (default 4096)\n");
+}
+
+/*
+  Runs the program to completion with rdint/rdch reading from stdin and wrint/wrch writing to stdout
+  Returns the exit status: 0 if the program halted, 1 if it couldn't be loaded or hit an error
+*/
+static int run_batch(Y86Machine *m, char *filename) {
+	static BatchOutput out;
+	int status;
+
+	batch_init_output(&out, STDOUT_FILENO);
+	batch_set_io(m, &out);
+
+	if (!y86_load_file(m, filename))
+		return 1;
+
+	status = y86_run(m, 0);
+	batch_flush(&out);
+
+	// invalid opcodes have already been reported by the instruction itself
+	if ((status == STAT_ADR || status == STAT_INS) && !sim_fault_is_invalid_opcode(m))
+		fprintf(stderr, "%s callback failed at 0x%x\n", y86_get_fault_instr(m), y86_get_pc(m));
+
+	return status == STAT_HLT && !out.failed ? 0 : 1;
+}
+
 int main(int argc, char *argv[]) {
-	if (argc < 2) {
-		printf("Usage: %s <y86 source file>\n", argv[0]);
+	int i, status, engine = ENGINE_BLOCK, batch = 0;
+	char *filename = NULL;
+	char *emit_c_filename = NULL;
+	char *emit_obj_filename = NULL;
+	uint64 mem_size = DEFAULT_MEM_SIZE;
+	Y86Machine *m;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--engine") == 0 && i+1 < argc) {
+			i++;
+			
+			if (strcmp(argv[i], "block") == 0)
+				engine = ENGINE_BLOCK;
+			else if (strcmp(argv[i], "callback") == 0)
+				engine = ENGINE_CALLBACK;
+#ifdef THREADED_ENGINE
+			else if (strcmp(argv[i], "threaded") == 0)
+				engine = ENGINE_THREADED;
+#endif
+#ifdef JIT_ENGINE
+			else if (strcmp(argv[i], "jit") == 0)
+				engine = ENGINE_JIT;
+#endif
+			else {
+				fprintf(stderr, "Unknown engine %s\n", argv[i]);
+				return 1;
+			}
+		}
+		
+		else if (strcmp(argv[i], "--emit-c") == 0 && i+1 < argc) {
+			emit_c_filename = argv[++i];
+		}
+		
+		else if (strcmp(argv[i], "--emit-obj") == 0 && i+1 < argc) {
+			emit_obj_filename = argv[++i];
+		}
+		
+		else if (strcmp(argv[i], "--batch") == 0) {
+			batch = 1;
+		}
+		
+		else if (strcmp(argv[i], "--mem-size") == 0 && i+1 < argc) {
+			mem_size = strtoull(argv[++i], NULL, 0);
+		}
+		
+		else if (argv[i][0] == '-') {
+			print_usage(argv[0]);
+			return 0;
+		}
+		
+		else {
+			filename = argv[i];
+		}
+	}
+
+	if (filename == NULL) {
+		print_usage(argv[0]);
 		return 0;
 	}
 
 	init_dbg_print();
+	m = y86_new_machine();
+
+	if (m == NULL) {
+		printf("Not enough memory\n");
+		destroy_dbg_print();
+		return 0;
+	}
+
+	if (!y86_set_mem_size(m, mem_size) || (emit_c_filename != NULL && mem_size != DEFAULT_MEM_SIZE)) {
+		fprintf(stderr, "Invalid memory size %llu%s\n", (unsigned long long)mem_size,
+				emit_c_filename != NULL ? ", --emit-c only supports 4096" : "");
+		y86_free_machine(m);
+		destroy_dbg_print();
+		return 1;
+	}
+
+	/*
+	  Translating doesn't need the console, any errors are printed once load_program returns.
+	  These modes are run from build scripts, so a failure exits with 1, like --batch
+	*/
+	if (emit_c_filename != NULL || emit_obj_filename != NULL) {
+		status = 1;
+
+		switch (load_program(m, filename)) {
+		case SUCC:
+			status = 0;
+
+			if (emit_c_filename != NULL && !gen_c_file(m, emit_c_filename, filename)) {
+				fprintf(stderr, "Error opening %s for writing\n", emit_c_filename);
+				status = 1;
+			}
+			if (emit_obj_filename != NULL && !gen_obj_file(m, emit_obj_filename)) {
+				fprintf(stderr, "Error writing %s\n", emit_obj_filename);
+				status = 1;
+			}
+			break;
+		case INVALID_FILE:
+			fprintf(stderr, "Error opening %s for reading\n", filename);
+			break;
+		case PARSE_ERROR:
+			fprintf(stderr, "Error parsing %s\n", filename);
+			break;
+		}
+
+		y86_free_machine(m);
+		destroy_dbg_print();
+		return status;
+	}
+
+	if (!y86_set_engine(m, engine))
+		fprintf(batch ? stderr : stdout, "Could not allocate memory for the jit, using the block engine\n");
+
+	/* Batch mode never touches ncurses, so it works without a terminal */
+	if (batch) {
+		status = run_batch(m, filename);
+		y86_free_machine(m);
+		destroy_dbg_print();
+		return status;
+	}
+
 	init_console();
+	y86_set_io(m, &console_io);
 	
-	switch (gen_bytecode(argv[1])) {
+	switch (load_program(m, filename)) {
 	case SUCC:
-		sim_init_registers();
-		sim_init_flags();
-		sim_exec_bytecode();
+		sim_init_registers(m);
+		sim_init_flags(m);
+		dbg_init_interrupt(m);
+		dbg_run_program(m);
 		break;
 	case INVALID_FILE:
 		destroy_console(); // need to destory console so we can use printf again
-		printf("Error opening %s for reading\n", argv[1]);
+		printf("Error opening %s for reading\n", filename);
 		break;
 	case PARSE_ERROR:
-		destroy_console();
-		printf("Error parsing %s\n", argv[1]);
+		// the parser has already reported the line it failed on in the debugger window
+		get_key_and_exit();
 		break;
 	}
 	
 	destroy_console();
+	y86_free_machine(m);
 	destroy_dbg_print();
 	return 0;
 }
@@ -0,0 +1,315 @@
+// memory.c - Guest memory: pages allocated on demand, found through a two level page table or (with GUARD_MEMORY) mapped by the host (see Y86Machine)
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "simulator.h"
+#include "memory.h"
+
+#ifdef GUARD_MEMORY
+#include <pthread.h>
+#include <sys/mman.h>
+
+/*
+  With GUARD_MEMORY there is no page table. Each machine maps MEM_RESERVE bytes with no
+  access allowed, and opens up the first mem_size of them for reading and writing.
+  The mapping is MAP_NORESERVE, so the kernel only finds a page of memory for the guest
+  the first time it touches the page, and pages that are only read share the zero page.
+  A load or store that goes past mem_size lands on the inaccessible part and raises
+  SIGSEGV, which guard_handler turns into a jump back to sim_run for the machine
+  running on that thread. Faults anywhere else go to whatever handler was there before
+*/
+
+static pthread_once_t guard_handler_once = PTHREAD_ONCE_INIT;
+static struct sigaction prev_segv_action;
+static __thread Y86Machine *guarded_machine; // the machine sim_run is running on this thread (see mem_guard)
+
+static void guard_handler(int sig, siginfo_t *info, void *context) {
+	Y86Machine *m = guarded_machine;
+	uint8 *addr = info->si_addr;
+
+	if (m != NULL && addr >= m->mem_base && addr < m->mem_base + MEM_RESERVE)
+		siglongjmp(m->fault_jmp, 1);
+
+	if (prev_segv_action.sa_flags & SA_SIGINFO) {
+		prev_segv_action.sa_sigaction(sig, info, context);
+	} else if (prev_segv_action.sa_handler == SIG_DFL || prev_segv_action.sa_handler == SIG_IGN) {
+		// the faulting instruction runs again and crashes the usual way
+		sigaction(SIGSEGV, &prev_segv_action, NULL);
+	} else {
+		prev_segv_action.sa_handler(sig);
+	}
+}
+
+static void install_guard_handler() {
+	struct sigaction action;
+
+	memset(&action, 0, sizeof(action));
+	action.sa_sigaction = guard_handler;
+	// SIGSEGV isn't blocked in the handler, since it jumps out without restoring the signal mask
+	action.sa_flags = SA_SIGINFO | SA_NODEFER;
+	sigemptyset(&action.sa_mask);
+	sigaction(SIGSEGV, &action, &prev_segv_action);
+}
+
+/*
+  Makes loads and stores past the end of m's memory made on this thread jump to
+  m->fault_jmp, until mem_guard(NULL). Called by sim_run around running the program
+*/
+void mem_guard(Y86Machine *m) {
+	guarded_machine = m;
+}
+
+/*
+  Maps the machine's memory (mem_size must be set). Returns 1 on success, 0 if the
+  address space or the page_used map couldn't be allocated
+*/
+int mem_init(Y86Machine *m) {
+	pthread_once(&guard_handler_once, install_guard_handler);
+
+	m->mem_base = mmap(NULL, MEM_RESERVE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+	if (m->mem_base == MAP_FAILED) {
+		m->mem_base = NULL;
+		return 0;
+	}
+
+	m->page_used = calloc(MAX_MEM_SIZE >> PAGE_BITS, 1);
+
+	if (m->page_used == NULL || mprotect(m->mem_base, m->mem_size, PROT_READ | PROT_WRITE) != 0) {
+		mem_free(m);
+		return 0;
+	}
+
+	return 1;
+}
+
+// Unmaps the machine's memory
+void mem_free(Y86Machine *m) {
+	sim_free_code_pages(m);
+
+	if (m->mem_base != NULL)
+		munmap(m->mem_base, MEM_RESERVE);
+
+	free(m->page_used);
+	m->mem_base = NULL;
+	m->page_used = NULL;
+}
+
+// Returns the data of page page_num, which loads and stores may go to directly (see jit_switch_page)
+uint8 *mem_page_data(Y86Machine *m, uint32 page_num, int alloc) {
+	m->page_used[page_num] = 1;
+	return m->mem_base + ((uint64)page_num << PAGE_BITS);
+}
+
+/*
+  Finds the first page numbered page_num or above that anything was stored into, for
+  going through all of the memory in use. Returns the page's data and sets page_num
+  to its number, or returns NULL
+*/
+uint8 *mem_next_page(Y86Machine *m, uint64 *page_num) {
+	uint64 n;
+
+	for (n = *page_num; n < (m->mem_size >> PAGE_BITS); n++) {
+		if (m->page_used[n]) {
+			*page_num = n;
+			return m->mem_base + (n << PAGE_BITS);
+		}
+	}
+
+	return NULL;
+}
+
+// Sets every byte of memory back to 0, handing the pages back to the kernel
+void mem_clear(Y86Machine *m) {
+	sim_free_code_pages(m);
+	madvise(m->mem_base, m->mem_size, MADV_DONTNEED);
+	memset(m->page_used, 0, m->mem_size >> PAGE_BITS);
+}
+
+/*
+  Sets the size of the address space, clearing memory
+  Returns 1 on success, 0 if size isn't a multiple of the page size between 4 KiB and 4 GiB
+  (or the protection of the mapping couldn't be changed)
+*/
+int mem_set_size(Y86Machine *m, uint64 size) {
+	if (size < PAGE_SIZE || size > MAX_MEM_SIZE || (size & PAGE_MASK) != 0)
+		return 0;
+
+	mem_clear(m);
+
+	if (size < m->mem_size && mprotect(m->mem_base + size, m->mem_size - size, PROT_NONE) != 0)
+		return 0;
+
+	if (size > m->mem_size && mprotect(m->mem_base, size, PROT_READ | PROT_WRITE) != 0)
+		return 0;
+
+	m->mem_size = size;
+	return 1;
+}
+#else
+
+/*
+  Walks the page table for the page with the given number, making it the last page
+  if it is there. Returns NULL if nothing has been stored on that page yet
+*/
+Page *mem_find_page(Y86Machine *m, uint32 page_num) {
+	PageTable *table = m->page_dir[page_num >> PAGE_TABLE_BITS];
+	Page *page;
+
+	if (table == NULL)
+		return NULL;
+
+	page = table->pages[page_num & (PAGE_TABLE_SIZE-1)];
+
+	if (page != NULL) {
+		m->last_page_num = page_num;
+		m->last_page = page;
+	}
+
+	return page;
+}
+
+// Returns the page with the given number, allocating it (zeroed) if needed, or NULL if there is not enough memory
+Page *mem_alloc_page(Y86Machine *m, uint32 page_num) {
+	PageTable **table = &m->page_dir[page_num >> PAGE_TABLE_BITS];
+	Page **page;
+
+	if (*table == NULL && (*table = calloc(1, sizeof(PageTable))) == NULL) {
+		DBG_PRINT("Out of memory allocating page table for page 0x%x\n", page_num);
+		return NULL;
+	}
+
+	page = &(*table)->pages[page_num & (PAGE_TABLE_SIZE-1)];
+
+	if (*page == NULL && (*page = calloc(1, sizeof(Page))) == NULL) {
+		DBG_PRINT("Out of memory allocating page 0x%x\n", page_num);
+		return NULL;
+	}
+
+	m->last_page_num = page_num;
+	m->last_page = *page;
+	return *page;
+}
+
+// Nothing to set up, pages are allocated as they are stored into
+int mem_init(Y86Machine *m) {
+	m->last_page_num = NO_PAGE;
+	return 1;
+}
+
+void mem_free(Y86Machine *m) {
+	mem_clear(m);
+}
+
+/*
+  Returns the data of page page_num, which loads and stores may go to directly (see
+  jit_switch_page). If nothing was stored on the page yet, it is allocated if alloc
+  is set, otherwise NULL is returned. Also NULL if there is not enough memory
+*/
+uint8 *mem_page_data(Y86Machine *m, uint32 page_num, int alloc) {
+	Page *page = mem_page(m, page_num << PAGE_BITS);
+
+	if (page == NULL && alloc)
+		page = mem_alloc_page(m, page_num);
+
+	return page != NULL ? page->data : NULL;
+}
+
+/*
+  Finds the first allocated page numbered page_num or above, for going through all of
+  the memory in use. Returns the page's data and sets page_num to its number, or returns NULL
+*/
+uint8 *mem_next_page(Y86Machine *m, uint64 *page_num) {
+	PageTable *table;
+	uint64 n;
+
+	for (n = *page_num; n < (MAX_MEM_SIZE >> PAGE_BITS); n++) {
+		table = m->page_dir[n >> PAGE_TABLE_BITS];
+
+		if (table == NULL) {
+			n |= PAGE_TABLE_SIZE-1; // skip the rest of the table
+			continue;
+		}
+
+		if (table->pages[n & (PAGE_TABLE_SIZE-1)] != NULL) {
+			*page_num = n;
+			return table->pages[n & (PAGE_TABLE_SIZE-1)]->data;
+		}
+	}
+
+	return NULL;
+}
+
+// Slow path of mem_write32, for stores to pages that aren't allocated yet or that straddle two pages
+int mem_write32_slow(Y86Machine *m, uint32 addr, uint32 val) {
+	int i;
+
+	for (i = 0; i < 4; i++)
+		if (!mem_write8(m, addr+i, val >> (8*i)))
+			return 0;
+
+	return 1;
+}
+
+// Frees every page of memory (and the code caches that go with them), leaving memory all zeros
+void mem_clear(Y86Machine *m) {
+	int i, j;
+
+	sim_free_code_pages(m);
+
+	for (i = 0; i < PAGE_TABLE_SIZE; i++) {
+		if (m->page_dir[i] == NULL)
+			continue;
+
+		for (j = 0; j < PAGE_TABLE_SIZE; j++)
+			free(m->page_dir[i]->pages[j]);
+
+		free(m->page_dir[i]);
+		m->page_dir[i] = NULL;
+	}
+
+	m->last_page_num = NO_PAGE;
+	m->last_page = NULL;
+}
+
+/*
+  Sets the size of the address space, clearing memory
+  Returns 1 on success, 0 if size isn't a multiple of the page size between 4 KiB and 4 GiB
+*/
+int mem_set_size(Y86Machine *m, uint64 size) {
+	if (size < PAGE_SIZE || size > MAX_MEM_SIZE || (size & PAGE_MASK) != 0)
+		return 0;
+
+	mem_clear(m);
+	m->mem_size = size;
+	return 1;
+}
+#endif
+
+// Copies len bytes of guest memory starting at addr into buf
+void mem_read(Y86Machine *m, uint32 addr, uint8 *buf, uint32 len) {
+	uint32 i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = mem_read8(m, addr+i);
+}
+
+// Returns the address just past the last nonzero byte of memory (0 if it is all zero)
+uint64 mem_used_end(Y86Machine *m) {
+	uint64 page_num = 0, end = 0;
+	uint8 *data;
+	int i;
+
+	while ((data = mem_next_page(m, &page_num)) != NULL) {
+		for (i = PAGE_SIZE-1; i >= 0; i--) {
+			if (data[i] != 0) {
+				end = (page_num << PAGE_BITS) + i + 1;
+				break;
+			}
+		}
+
+		page_num++;
+	}
+
+	return end;
+}
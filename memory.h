@@ -0,0 +1,120 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <string.h>
+#include "common.h"
+#include "simulator.h"
+
+#ifdef GUARD_MEMORY
+#define MEM_RESERVE (MAX_MEM_SIZE + PAGE_SIZE) // the page past 4 GiB catches accesses that straddle the top of the address space
+#endif
+
+int mem_init(Y86Machine *m);
+void mem_free(Y86Machine *m);
+uint8 *mem_page_data(Y86Machine *m, uint32 page_num, int alloc);
+uint8 *mem_next_page(Y86Machine *m, uint64 *page_num);
+void mem_read(Y86Machine *m, uint32 addr, uint8 *buf, uint32 len);
+uint64 mem_used_end(Y86Machine *m);
+int mem_set_size(Y86Machine *m, uint64 size);
+void mem_clear(Y86Machine *m);
+
+/*
+  The loads and stores below are the fast path for every memory access, so they are
+  inline: when an access falls on the same page as the one before it, all it costs is
+  a compare against last_page_num. With GUARD_MEMORY they go straight to mem_base.
+  They don't check addr against mem_size, the callers do (the callbacks through
+  mem_out_of_bounds32)
+*/
+
+#ifdef GUARD_MEMORY
+void mem_guard(Y86Machine *m);
+
+// An access past the end of memory faults in the host, which sim_run turns into STAT_ADR, so there is nothing to check
+static inline int mem_out_of_bounds32(Y86Machine *m, uint32 addr) {
+	return 0;
+}
+
+static inline uint8 mem_read8(Y86Machine *m, uint32 addr) {
+	return m->mem_base[addr];
+}
+
+static inline uint32 mem_read32(Y86Machine *m, uint32 addr) {
+	uint32 val;
+
+	memcpy(&val, m->mem_base + addr, 4);
+	return val;
+}
+
+// Always returns 1, the kernel finds a page of memory the first time it is written
+static inline int mem_write8(Y86Machine *m, uint32 addr, uint8 val) {
+	m->mem_base[addr] = val;
+	m->page_used[addr >> PAGE_BITS] = 1;
+	return 1;
+}
+
+static inline int mem_write32(Y86Machine *m, uint32 addr, uint32 val) {
+	memcpy(m->mem_base + addr, &val, 4);
+	m->page_used[addr >> PAGE_BITS] = 1;
+	m->page_used[(addr+3) >> PAGE_BITS] = 1;
+	return 1;
+}
+#else
+Page *mem_find_page(Y86Machine *m, uint32 page_num);
+Page *mem_alloc_page(Y86Machine *m, uint32 page_num);
+int mem_write32_slow(Y86Machine *m, uint32 addr, uint32 val);
+
+// Returns 1 if a 4 byte load or store at addr would go past the end of memory
+static inline int mem_out_of_bounds32(Y86Machine *m, uint32 addr) {
+	return addr > m->mem_size-4;
+}
+
+// Returns the page holding addr, or NULL if nothing has been stored on that page yet
+static inline Page *mem_page(Y86Machine *m, uint32 addr) {
+	if ((addr >> PAGE_BITS) == m->last_page_num)
+		return m->last_page;
+
+	return mem_find_page(m, addr >> PAGE_BITS);
+}
+
+static inline uint8 mem_read8(Y86Machine *m, uint32 addr) {
+	Page *page = mem_page(m, addr);
+
+	return page != NULL ? page->data[addr & PAGE_MASK] : 0;
+}
+
+// Reads the 4 byte integer at addr (which may straddle two pages)
+static inline uint32 mem_read32(Y86Machine *m, uint32 addr) {
+	Page *page = mem_page(m, addr);
+
+	if ((addr & PAGE_MASK) <= PAGE_SIZE-4)
+		return page != NULL ? *((uint32*)&page->data[addr & PAGE_MASK]) : 0;
+
+	return mem_read8(m, addr) | (mem_read8(m, addr+1) << 8) |
+		(mem_read8(m, addr+2) << 16) | ((uint32)mem_read8(m, addr+3) << 24);
+}
+
+// Returns 1 on success, 0 if there isn't enough memory for the page
+static inline int mem_write8(Y86Machine *m, uint32 addr, uint8 val) {
+	Page *page = mem_page(m, addr);
+
+	if (page == NULL && (page = mem_alloc_page(m, addr >> PAGE_BITS)) == NULL)
+		return 0;
+
+	page->data[addr & PAGE_MASK] = val;
+	return 1;
+}
+
+// Stores the 4 byte integer val at addr. Returns 1 on success, 0 if there isn't enough memory for the page
+static inline int mem_write32(Y86Machine *m, uint32 addr, uint32 val) {
+	Page *page = mem_page(m, addr);
+
+	if (page != NULL && (addr & PAGE_MASK) <= PAGE_SIZE-4) {
+		*((uint32*)&page->data[addr & PAGE_MASK]) = val;
+		return 1;
+	}
+
+	return mem_write32_slow(m, addr, val);
+}
+#endif
+
+#endif
@@ -0,0 +1,482 @@
+// object.c - Contains code to save an assembled program to a binary object file, and to load object files and yis .yo listings without assembling them
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "simulator.h"
+#include "assembler.h"
+#include "parser.h"
+#include "memory.h"
+#include "object.h"
+
+/*
+  Finds the parts of memory that hold the program: each run of consecutive pages in use
+  becomes one segment, without the zeros at the end of it. Pages that are all zeros
+  are left out. Returns the segments (their offsets aren't set) or NULL if there are none
+*/
+static ObjSegment *find_segments(Y86Machine *m, uint32 *num_segments) {
+	ObjSegment *segs = NULL, *seg = NULL;
+	uint64 page_num = 0, last_page_num = 0;
+	uint32 start;
+	uint8 *data;
+	int i;
+
+	*num_segments = 0;
+
+	while ((data = mem_next_page(m, &page_num)) != NULL) {
+		for (i = PAGE_SIZE-1; i >= 0 && data[i] == 0; i--)
+			;
+
+		if (i >= 0) {
+			start = page_num << PAGE_BITS;
+
+			if (seg == NULL || page_num != last_page_num+1) {
+				segs = realloc(segs, (*num_segments + 1) * sizeof(ObjSegment));
+				seg = &segs[(*num_segments)++];
+				seg->addr = start;
+			}
+
+			seg->size = start + i + 1 - seg->addr;
+			last_page_num = page_num;
+		}
+
+		page_num++;
+	}
+
+	return segs;
+}
+
+// Writes size bytes of memory starting at addr to the file
+static void write_segment_data(FILE *out, Y86Machine *m, uint32 addr, uint32 size) {
+	uint32 len;
+
+	while (size > 0) {
+		len = PAGE_SIZE - (addr & PAGE_MASK);
+		if (len > size)
+			len = size;
+
+		fwrite(mem_page_data(m, addr >> PAGE_BITS, 0) + (addr & PAGE_MASK), 1, len, out);
+		addr += len;
+		size -= len;
+	}
+}
+
+/*
+  Writes the assembled program to an object file: its memory, labels and source lines
+  (see object.h). Returns 1 on success, 0 if the file couldn't be written
+*/
+int gen_obj_file(Y86Machine *m, char *filename) {
+	FILE *out;
+	ObjHeader header;
+	ObjSegment *segs;
+	ObjSymbol sym;
+	ObjLine line;
+	SourceLine *cur_line;
+	uint64 offset;
+	uint32 i, str_offset = 0;
+	int succ;
+
+	out = fopen(filename, "w");
+
+	if (out == NULL)
+		return 0;
+
+	segs = find_segments(m, &header.num_segments);
+
+	memcpy(header.magic, OBJ_MAGIC, 4);
+	header.version = OBJ_VERSION;
+	header.num_symbols = m->num_labels;
+	header.num_lines = get_source_lines_size(m->source_lines);
+	header.strings_size = 0;
+
+	for (i = 0; i < m->num_labels; i++)
+		header.strings_size += strlen(m->labels[i]->name) + 1;
+
+	for (cur_line = m->source_lines; cur_line != NULL; cur_line = cur_line->next)
+		header.strings_size += strlen(cur_line->line) + 1;
+
+	// the data of the segments comes after all of the tables
+	offset = sizeof(header) + header.num_segments * sizeof(ObjSegment) + header.num_symbols * sizeof(ObjSymbol) +
+		header.num_lines * sizeof(ObjLine) + header.strings_size;
+
+	for (i = 0; i < header.num_segments; i++) {
+		segs[i].offset = offset;
+		offset += segs[i].size;
+	}
+
+	fwrite(&header, 1, sizeof(header), out);
+	fwrite(segs, sizeof(ObjSegment), header.num_segments, out);
+
+	for (i = 0; i < m->num_labels; i++) {
+		sym.name = str_offset;
+		sym.addr = m->labels[i]->addr;
+		fwrite(&sym, 1, sizeof(sym), out);
+		str_offset += strlen(m->labels[i]->name) + 1;
+	}
+
+	for (cur_line = m->source_lines; cur_line != NULL; cur_line = cur_line->next) {
+		line.line = str_offset;
+		line.addr = cur_line->addr;
+		fwrite(&line, 1, sizeof(line), out);
+		str_offset += strlen(cur_line->line) + 1;
+	}
+
+	for (i = 0; i < m->num_labels; i++)
+		fwrite(m->labels[i]->name, 1, strlen(m->labels[i]->name) + 1, out);
+
+	for (cur_line = m->source_lines; cur_line != NULL; cur_line = cur_line->next)
+		fwrite(cur_line->line, 1, strlen(cur_line->line) + 1, out);
+
+	for (i = 0; i < header.num_segments; i++)
+		write_segment_data(out, m, segs[i].addr, segs[i].size);
+
+	free(segs);
+	succ = !ferror(out);
+
+	if (fclose(out) != 0)
+		succ = 0;
+
+	return succ;
+}
+
+// Copies size bytes of data into memory starting at addr. Returns 1 on success, 0 if there isn't enough memory
+static int copy_segment(Y86Machine *m, uint32 addr, uint8 *data, uint32 size) {
+	uint8 *page;
+	uint32 len;
+
+	while (size > 0) {
+		page = mem_page_data(m, addr >> PAGE_BITS, 1);
+
+		if (page == NULL)
+			return 0;
+
+		len = PAGE_SIZE - (addr & PAGE_MASK);
+		if (len > size)
+			len = size;
+
+		memcpy(page + (addr & PAGE_MASK), data, len);
+		addr += len;
+		data += len;
+		size -= len;
+	}
+
+	return 1;
+}
+
+/*
+  Loads the object file mapped at file (size bytes long) into the machine, building the labels
+  and source lines from its tables. Returns NULL on success, or what is wrong with the file
+*/
+static const char *read_obj(Y86Machine *m, uint8 *file, uint64 size) {
+	ObjHeader *header = (ObjHeader*)file;
+	ObjSegment *segs;
+	ObjSymbol *syms;
+	ObjLine *lines;
+	char *strings;
+	uint64 tables_size;
+	uint32 i;
+
+	tables_size = sizeof(ObjHeader) + (uint64)header->num_segments * sizeof(ObjSegment) +
+		(uint64)header->num_symbols * sizeof(ObjSymbol) + (uint64)header->num_lines * sizeof(ObjLine) + header->strings_size;
+
+	if (header->version != OBJ_VERSION || tables_size > size)
+		return "Unsupported or truncated object file";
+
+	segs = (ObjSegment*)(file + sizeof(ObjHeader));
+	syms = (ObjSymbol*)(segs + header->num_segments);
+	lines = (ObjLine*)(syms + header->num_symbols);
+	strings = (char*)(lines + header->num_lines);
+
+	// every string has to end inside the table
+	if (header->strings_size > 0 && strings[header->strings_size-1] != '\0')
+		return "Corrupt string table in object file";
+
+	for (i = 0; i < header->num_segments; i++) {
+		if (segs[i].offset > size || segs[i].size > size - segs[i].offset)
+			return "Truncated object file";
+
+		if ((uint64)segs[i].addr + segs[i].size > m->mem_size)
+			return "Program does not fit in memory";
+
+		if (!copy_segment(m, segs[i].addr, file + segs[i].offset, segs[i].size))
+			return "Not enough memory for the program";
+
+		m->mem_len = segs[i].addr + segs[i].size;
+	}
+
+	for (i = 0; i < header->num_symbols; i++) {
+		if (syms[i].name >= header->strings_size || strlen(strings + syms[i].name) >= MAX_LABEL_NAME)
+			return "Invalid label in object file";
+
+		if (!add_label(m, strings + syms[i].name, syms[i].addr))
+			return "Not enough memory for the labels";
+	}
+
+	for (i = 0; i < header->num_lines; i++) {
+		if (lines[i].line >= header->strings_size)
+			return "Invalid source line in object file";
+
+		if (!add_source_line(m, strings + lines[i].line, lines[i].addr))
+			return "Not enough memory for the source lines";
+	}
+
+	return NULL;
+}
+
+/*
+  Loads an object file written by gen_obj_file into memory in place of whatever was loaded
+  Returns SUCC on success, INVALID_FILE if the file couldn't be opened, NOT_AN_OBJECT if
+  it isn't an object file and PARSE_ERROR if it is broken (after reporting why, if report is set)
+*/
+int load_obj_file(Y86Machine *m, char *filename, int report) {
+	const char *err;
+	struct stat st;
+	uint8 *file;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+
+	if (fd < 0) {
+		DBG_PRINT("Error opening %s for reading\n", filename);
+		return INVALID_FILE;
+	}
+
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(ObjHeader)) {
+		close(fd);
+		return NOT_AN_OBJECT;
+	}
+
+	file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (file == MAP_FAILED)
+		return INVALID_FILE;
+
+	if (memcmp(file, OBJ_MAGIC, 4) != 0) {
+		munmap(file, st.st_size);
+		return NOT_AN_OBJECT;
+	}
+
+	m->mem_len = 0;
+	mem_clear(m);
+
+	free_program(m);
+
+	err = read_obj(m, file, st.st_size);
+	munmap(file, st.st_size);
+
+	if (err != NULL && report)
+		sim_error(m, "%s: %s", filename, err);
+
+	return err == NULL ? SUCC : PARSE_ERROR;
+}
+
+/*
+  Adds the source column of a .yo line at addr: a label, an instruction or directive, or
+  a label followed by an instruction (which yas allows, e.g. "Loop: addl %eax,%ebx").
+  Comments and blank text add nothing. Returns 1 on success, 0 if the text isn't valid
+*/
+static int add_yo_source(Y86Machine *m, char *text, uint32 addr, int has_addr) {
+	char buf[4096], *comment, *colon;
+
+	comment = strchr(text, '#');
+	if (comment != NULL)
+		*comment = '\0';
+
+	colon = strchr(text, ':');
+
+	if (colon != NULL) {
+		if (!has_addr || !format_y86_line(text, colon + 1 - text, buf, sizeof(buf)) || !str_ends_with(buf, ':'))
+			return 0;
+
+		if (!add_source_line(m, buf, addr))
+			return 0;
+
+		buf[strlen(buf)-1] = '\0';
+
+		if (!add_label(m, buf, addr))
+			return 0;
+
+		text = colon+1;
+	}
+
+	if (!format_y86_line(text, strlen(text), buf, sizeof(buf)))
+		return 0;
+
+	if (*buf == '\0')
+		return 1;
+
+	return has_addr && add_source_line(m, buf, addr);
+}
+
+/*
+  Loads one line of a .yo file, "0x014: 30f202000000 | irmovl $2,%edx": the bytes are
+  stored at the address and the source after the | is added to the labels and source
+  lines. Lines with no address only have a comment. Returns 1 on success, 0 on error
+*/
+static int read_yo_line(Y86Machine *m, char *line) {
+	char *p = line, *bar, *end;
+	uint32 hi, lo;
+	uint64 addr = 0, cur;
+	int has_addr = 0;
+
+	bar = strchr(line, '|');
+
+	if (bar == NULL) {
+		// only blank lines have no source column
+		while (is_whitespace(*p))
+			p++;
+
+		return *p == '\0';
+	}
+
+	*bar = '\0';
+
+	while (is_whitespace(*p))
+		p++;
+
+	if (*p != '\0') {
+		if (strncmp(p, "0x", 2) != 0)
+			return 0;
+
+		addr = strtoull(p+2, &end, 16);
+
+		if (end == p+2 || *end != ':')
+			return 0;
+
+		if (addr > m->mem_size) {
+			sim_error(m, "yo: Program does not fit in memory");
+			return 0;
+		}
+
+		has_addr = 1;
+		cur = addr;
+
+		for (p = end+1; *p != '\0'; p += 2) {
+			while (is_whitespace(*p))
+				p++;
+
+			if (*p == '\0')
+				break;
+
+			hi = hex_char_to_val(p[0]);
+			lo = hex_char_to_val(p[1]);
+
+			if (hi > 15 || lo > 15)
+				return 0;
+
+			if (cur >= m->mem_size) {
+				sim_error(m, "yo: Program does not fit in memory");
+				return 0;
+			}
+
+			if (!mem_write8(m, cur, (hi << 4) | lo)) {
+				sim_error(m, "Not enough memory for the page at 0x%x", (uint32)cur & ~PAGE_MASK);
+				return 0;
+			}
+
+			cur++;
+		}
+
+		if (cur > m->mem_len)
+			m->mem_len = cur;
+	}
+
+	return add_yo_source(m, bar+1, addr, has_addr);
+}
+
+/*
+  Loads a yis .yo listing (written by yas, or by gen_yo_file) into memory in place of whatever
+  was loaded, rebuilding the labels and source lines from its source column. Nothing is
+  assembled. Returns SUCC, INVALID_FILE if the file couldn't be read or PARSE_ERROR (after
+  reporting the line it failed on)
+*/
+int load_yo_file(Y86Machine *m, char *filename) {
+	struct stat st;
+	char *file = NULL, *p, *eol, line[4096];
+	int fd, line_num = 0, ret = SUCC;
+	size_t len;
+
+	fd = open(filename, O_RDONLY);
+
+	if (fd < 0) {
+		DBG_PRINT("Error opening %s for reading\n", filename);
+		return INVALID_FILE;
+	}
+
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return INVALID_FILE;
+	}
+
+	if (st.st_size > 0 && (file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		close(fd);
+		return INVALID_FILE;
+	}
+
+	close(fd);
+
+	m->mem_len = 0;
+	mem_clear(m);
+
+	free_program(m);
+
+	for (p = file; p != NULL && p < file + st.st_size; p = eol + 1) {
+		eol = memchr(p, '\n', file + st.st_size - p);
+
+		if (eol == NULL)
+			eol = file + st.st_size;
+
+		len = eol - p;
+		line_num++;
+
+		if (len > 0 && p[len-1] == '\r')
+			len--;
+
+		if (len >= sizeof(line)) {
+			sim_error(m, "yo: Line %d of %s is too long", line_num, filename);
+			ret = PARSE_ERROR;
+			break;
+		}
+
+		memcpy(line, p, len);
+		line[len] = '\0';
+
+		if (!read_yo_line(m, line)) {
+			sim_error(m, "yo: Error processing line %d of %s", line_num, filename);
+			ret = PARSE_ERROR;
+			break;
+		}
+	}
+
+	if (file != NULL)
+		munmap(file, st.st_size);
+
+	return ret;
+}
+
+// Checks if filename ends with ext (e.g. ".yo")
+static int has_extension(char *filename, char *ext) {
+	size_t len = strlen(filename), ext_len = strlen(ext);
+
+	return len > ext_len && strcmp(filename + len - ext_len, ext) == 0;
+}
+
+/*
+  Loads a program into memory: an object file is loaded as it is, a file ending in .yo is
+  read as a yis listing, anything else is assembled by gen_bytecode
+  Returns SUCC, INVALID_FILE or PARSE_ERROR
+*/
+int load_program(Y86Machine *m, char *filename) {
+	int ret;
+
+	if (has_extension(filename, ".yo"))
+		return load_yo_file(m, filename);
+
+	ret = load_obj_file(m, filename, 1);
+
+	return ret == NOT_AN_OBJECT ? gen_bytecode(m, filename) : ret;
+}
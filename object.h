@@ -0,0 +1,48 @@
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include "common.h"
+#include "simulator.h"
+
+#define OBJ_MAGIC "Y86O"
+#define OBJ_VERSION 1
+
+/*
+  An object file is an ObjHeader followed by num_segments ObjSegments, num_symbols
+  ObjSymbols, num_lines ObjLines, the string table (strings_size bytes of NUL
+  terminated strings) and then the data of each segment. Integers are stored in the
+  host's byte order, as in the pause file
+*/
+typedef struct _ObjHeader {
+	char magic[4];
+	uint32 version;
+	uint32 num_segments;
+	uint32 num_symbols;
+	uint32 num_lines;
+	uint32 strings_size;
+} ObjHeader;
+
+// size bytes of memory starting at addr, stored at offset in the file
+typedef struct _ObjSegment {
+	uint32 addr;
+	uint32 size;
+	uint64 offset;
+} ObjSegment;
+
+// A label (symbol) or a source line, name/line is an offset into the string table
+typedef struct _ObjSymbol {
+	uint32 name;
+	uint32 addr;
+} ObjSymbol;
+
+typedef struct _ObjLine {
+	uint32 line;
+	uint32 addr;
+} ObjLine;
+
+int gen_obj_file(Y86Machine *m, char *filename);
+int load_obj_file(Y86Machine *m, char *filename, int report);
+int load_yo_file(Y86Machine *m, char *filename);
+int load_program(Y86Machine *m, char *filename);
+
+#endif
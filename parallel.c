@@ -0,0 +1,390 @@
+// parallel.c - Assembles very large sources on several threads, each taking a run of whole lines (a chunk) of the source
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "simulator.h"
+#include "common.h"
+#include "assembler.h"
+#include "parser.h"
+#include "memory.h"
+#include "parallel.h"
+
+/*
+  A chunk of the source, from start up to end, assembled by one thread. Where a line goes
+  depends on every line before it, so the chunks are first sized on their own (the code
+  before their first .pos or .align just adds up), then given their base addresses in
+  order, and only then placed and encoded
+*/
+typedef struct _AsmChunk {
+	Y86Machine *m;
+	char *start, *end;
+	Arena arena; // holds the chunk's source lines until they are moved to the machine's arena
+	SourceLine *first, *last;
+	SourceLine *first_directive; // the first .pos or .align, from which on addresses depend on base
+	uint64 size; // bytes of code before first_directive
+	uint64 base; // address of the chunk's first line
+	SourceLine **labels; // the label lines, in order
+	int num_labels, labels_size;
+	uint32 *pages; // the pages the chunk's code is stored on
+	int num_pages, pages_size;
+	int failed;
+} AsmChunk;
+
+// Adds item to the array *items (num items, room for size), which doubles in size when it fills up. Returns 1 on success, 0 if there is not enough memory
+static int push_item(void **items, int *num, int *size, void *item, int item_size) {
+	void *grown;
+
+	if (*num == *size) {
+		grown = realloc(*items, (*size ? *size * 2 : 64) * item_size);
+
+		if (grown == NULL)
+			return 0;
+
+		*items = grown;
+		*size = *size ? *size * 2 : 64;
+	}
+
+	memcpy((char*)*items + (long)*num * item_size, item, item_size);
+	(*num)++;
+	return 1;
+}
+
+// Returns the mnemonic of a .pos or .align line, which move the address instead of storing anything, or NULL
+static Mnemonic *addr_directive(char *line) {
+	Mnemonic *mn = find_mnemonic(line, mnemonic_len(line));
+
+	return mn != NULL && mn->size == 0 && *mn->name == '.' ? mn : NULL;
+}
+
+// Formats the lines of a chunk into source lines, and adds up the size of its code up to the first .pos or .align
+static void *format_chunk(void *arg) {
+	AsmChunk *c = arg;
+	char line[MAX_LINE_LEN], *p, *eol;
+	SourceLine *node;
+
+	for (p = c->start; p < c->end; p = eol + 1) {
+		eol = memchr(p, '\n', c->end - p);
+
+		if (eol == NULL)
+			eol = c->end;
+
+		// a line that isn't understood ends the program, which is left to the serial assembler
+		if (!format_y86_line(p, eol - p, line, sizeof(line))) {
+			c->failed = 1;
+			return NULL;
+		}
+
+		if (*line == '\0')
+			continue;
+
+		node = arena_alloc(&c->arena, sizeof(SourceLine));
+
+		if (node == NULL || (node->line = arena_strdup(&c->arena, line)) == NULL) {
+			c->failed = 1;
+			return NULL;
+		}
+
+		node->addr = 0;
+		node->next = NULL;
+		node->has_breakpoint = 0;
+		node->has_cond_breakpoint = 0;
+		node->cond_bp_list = NULL;
+
+		if (c->first == NULL)
+			c->first = node;
+		else
+			c->last->next = node;
+
+		c->last = node;
+
+		if (str_ends_with(line, ':')) {
+			if (!push_item((void**)&c->labels, &c->num_labels, &c->labels_size, &node, sizeof(SourceLine*))) {
+				c->failed = 1;
+				return NULL;
+			}
+		} else if (c->first_directive == NULL) {
+			if (addr_directive(line) != NULL)
+				c->first_directive = node;
+			else
+				c->size += get_instr_size(line, 0);
+		}
+	}
+
+	return NULL;
+}
+
+// Gives every line of a chunk its address, and notes which pages the code is stored on
+static void *place_chunk(void *arg) {
+	AsmChunk *c = arg;
+	SourceLine *line;
+	Mnemonic *mn;
+	uint64 addr = c->base;
+	uint32 page, last_page;
+	long size;
+
+	for (line = c->first; line != NULL; line = line->next) {
+		line->addr = addr;
+
+		if (str_ends_with(line->line, ':'))
+			continue;
+
+		mn = find_mnemonic(line->line, mnemonic_len(line->line));
+
+		if (mn == NULL || mn->size == 0) {
+			addr += get_instr_size(line->line, addr);
+			continue;
+		}
+
+		size = mn->size;
+		last_page = (addr + size - 1) >> PAGE_BITS;
+
+		for (page = addr >> PAGE_BITS; page <= last_page; page++) {
+			if (c->num_pages > 0 && c->pages[c->num_pages-1] == page)
+				continue;
+
+			if (!push_item((void**)&c->pages, &c->num_pages, &c->pages_size, &page, sizeof(uint32))) {
+				c->failed = 1;
+				return NULL;
+			}
+		}
+
+		addr += size;
+	}
+
+	return NULL;
+}
+
+// Errors of the machines encoding chunks aren't reported, the serial assembler reports them when it goes over the source again
+static void quiet_error(void *ctx, const char *msg) {
+}
+
+/*
+  Encodes the lines of a chunk into memory, on a copy of the machine so it has a mem_len
+  and fixups of its own. The labels are all known by now, so a fixup means a label that
+  is never defined, which fails the chunk
+*/
+static void *encode_chunk(void *arg) {
+	AsmChunk *c = arg;
+	SourceLine *line;
+	Y86Machine *w = malloc(sizeof(Y86Machine));
+	int i;
+
+	if (w == NULL) {
+		c->failed = 1;
+		return NULL;
+	}
+
+	memcpy(w, c->m, sizeof(Y86Machine));
+	w->fixups = NULL;
+	w->num_fixups = 0;
+	w->asm_end = 0;
+	w->io.error = quiet_error;
+
+	for (line = c->first; line != NULL && !c->failed; line = line->next) {
+		if (str_ends_with(line->line, ':'))
+			continue;
+
+		w->mem_len = line->addr;
+
+		if (!encode_line(w, line->line))
+			c->failed = 1;
+	}
+
+	for (i = 0; i < w->num_fixups; i++)
+		if (!w->fixups[i].weak)
+			c->failed = 1;
+
+	free_fixups(w);
+	free(w);
+	return NULL;
+}
+
+// Runs func on every chunk, each on a thread of its own (or this one, if a thread can't be started), and waits for them all
+static void run_chunks(AsmChunk *chunks, int num_chunks, void *(*func)(void*)) {
+	pthread_t threads[MAX_ASM_THREADS];
+	int i, started[MAX_ASM_THREADS];
+
+	for (i = 0; i < num_chunks; i++) {
+		started[i] = pthread_create(&threads[i], NULL, func, &chunks[i]) == 0;
+
+		if (!started[i])
+			func(&chunks[i]);
+	}
+
+	for (i = 0; i < num_chunks; i++)
+		if (started[i])
+			pthread_join(threads[i], NULL);
+}
+
+// Returns 1 if any of the chunks failed
+static int any_failed(AsmChunk *chunks, int num_chunks) {
+	int i;
+
+	for (i = 0; i < num_chunks; i++)
+		if (chunks[i].failed)
+			return 1;
+
+	return 0;
+}
+
+/*
+  Works out the base address of every chunk and where the program ends (in *end), going
+  through the chunks in order. Returns 1 on success, 0 if the program doesn't fit in
+  memory or a .pos moves backwards, since chunks could then store over each other
+*/
+static int base_chunks(Y86Machine *m, AsmChunk *chunks, int num_chunks, uint64 *end) {
+	SourceLine *line;
+	uint64 addr = 0;
+	long size;
+	int i;
+
+	for (i = 0; i < num_chunks; i++) {
+		chunks[i].base = addr;
+		addr += chunks[i].size;
+
+		if (addr > m->mem_size)
+			return 0;
+
+		for (line = chunks[i].first_directive; line != NULL; line = line->next) {
+			if (str_ends_with(line->line, ':'))
+				continue;
+
+			size = get_instr_size(line->line, addr);
+
+			if (size < 0 || addr + size > m->mem_size)
+				return 0;
+
+			addr += size;
+		}
+	}
+
+	*end = addr;
+	return 1;
+}
+
+// Defines the labels of every chunk, in order. Returns 1 on success, 0 if a label is defined twice or there is not enough memory
+static int define_labels(Y86Machine *m, AsmChunk *chunks, int num_chunks) {
+	char name[MAX_LABEL_NAME];
+	SourceLine *line;
+	int i, j, len;
+
+	for (i = 0; i < num_chunks; i++) {
+		for (j = 0; j < chunks[i].num_labels; j++) {
+			line = chunks[i].labels[j];
+			len = strlen(line->line) - 1;
+
+			if (len > MAX_LABEL_NAME-1)
+				len = MAX_LABEL_NAME-1;
+
+			memcpy(name, line->line, len);
+			name[len] = '\0';
+
+			// which definition a use gets depends on the order of the source, so that's left to the serial assembler
+			if (find_label(m, name) != NULL || !add_label(m, name, line->addr))
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+/*
+  Assembles the source (size bytes at src) on several threads, one for every
+  PARALLEL_MIN_CHUNK bytes of it up to the number of processors (or Y86SIM_ASM_THREADS),
+  building the same program memory, source lines and labels as the serial pass in
+  gen_bytecode. The machine must be empty (see free_program and mem_clear)
+  Returns 1 on success, 0 if the source is too small to be worth it or has anything the
+  serial pass handles differently or reports (a line that isn't understood or doesn't
+  assemble, an undefined or repeated label, a .pos that moves backwards). The machine is
+  then left empty again, for the serial pass
+*/
+int gen_bytecode_parallel(Y86Machine *m, char *src, uint64 size) {
+	AsmChunk chunks[MAX_ASM_THREADS];
+	char *threads = getenv("Y86SIM_ASM_THREADS");
+	long num_cpus = threads != NULL ? atol(threads) : sysconf(_SC_NPROCESSORS_ONLN);
+	int i, j, num_chunks, succ = 0;
+	char *p, *split;
+	uint64 end;
+
+	num_chunks = num_cpus < MAX_ASM_THREADS ? (int)num_cpus : MAX_ASM_THREADS;
+
+	if (size / PARALLEL_MIN_CHUNK < (uint64)num_chunks)
+		num_chunks = size / PARALLEL_MIN_CHUNK;
+
+	if (num_chunks < 2)
+		return 0;
+
+	memset(chunks, 0, sizeof(chunks));
+
+	// the chunks split the source at the end of a line
+	for (i = 0, p = src; i < num_chunks; i++) {
+		chunks[i].m = m;
+		chunks[i].start = p;
+		split = src + size * (i+1) / num_chunks;
+
+		if (split < p)
+			split = p;
+
+		if (i == num_chunks - 1 || (p = memchr(split, '\n', src + size - split)) == NULL)
+			p = src + size;
+		else
+			p++;
+
+		chunks[i].end = p;
+	}
+
+	run_chunks(chunks, num_chunks, format_chunk);
+
+	if (any_failed(chunks, num_chunks) || !base_chunks(m, chunks, num_chunks, &end))
+		goto done;
+
+	run_chunks(chunks, num_chunks, place_chunk);
+
+	if (any_failed(chunks, num_chunks) || !define_labels(m, chunks, num_chunks))
+		goto done;
+
+	// the pages are allocated up front, so the threads only store into them
+	for (i = 0; i < num_chunks; i++)
+		for (j = 0; j < chunks[i].num_pages; j++)
+			if (mem_page_data(m, chunks[i].pages[j], 1) == NULL)
+				goto done;
+
+	run_chunks(chunks, num_chunks, encode_chunk);
+
+	if (any_failed(chunks, num_chunks))
+		goto done;
+
+	// hand the chunks' source lines over to the machine
+	for (i = 0; i < num_chunks; i++) {
+		if (chunks[i].first == NULL)
+			continue;
+
+		if (m->source_lines == NULL)
+			m->source_lines = chunks[i].first;
+		else
+			m->last_source_line->next = chunks[i].first;
+
+		m->last_source_line = chunks[i].last;
+		arena_merge(&m->arena, &chunks[i].arena);
+	}
+
+	m->mem_len = end;
+	succ = 1;
+
+done:
+	for (i = 0; i < num_chunks; i++) {
+		arena_free(&chunks[i].arena);
+		free(chunks[i].labels);
+		free(chunks[i].pages);
+	}
+
+	if (!succ) {
+		free_program(m);
+		mem_clear(m);
+		m->mem_len = 0;
+	}
+
+	return succ;
+}
@@ -0,0 +1,14 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "common.h"
+#include "simulator.h"
+
+#ifndef PARALLEL_MIN_CHUNK
+#define PARALLEL_MIN_CHUNK (256 * 1024) // bytes of source for each thread, smaller sources are assembled on one
+#endif
+#define MAX_ASM_THREADS 64
+
+int gen_bytecode_parallel(Y86Machine *m, char *src, uint64 size);
+
+#endif
@@ -7,375 +7,268 @@
 #include "common.h"
 #include "simulator.h"
 #include "assembler.h"
-#include "debugger.h"
 #include "parser.h"
-#include "console.h"
 
-Label **labels = NULL;
-int num_labels = 0;
+/*
+  Encodes the instruction or directive on a line, formatted by format_y86_line, at mem_len,
+  passing it to the necessary codegen function in assembler.c. Labels that aren't defined
+  yet get a fixup (see add_fixup). Returns 1 on success, 0 if the line isn't valid
+*/
+int encode_line(Y86Machine *m, char *line) {
+	char *space, *p, *args[8], operands[MAX_LINE_LEN];
+	int i, num_args = 0;
+	Mnemonic *mn = find_mnemonic(line, mnemonic_len(line));
+	
+	space = strchr(line, ' ');
+	
+	for (i = 0; i < 8; i++)
+		args[i] = NULL;
+	
+	if (space != NULL) {
+		// split the parameters at the commas, in a copy since the codegen functions modify them
+		if (strlen(space + 1) >= sizeof(operands))
+			return 0;
+		
+		strcpy(operands, space + 1);
+		args[num_args++] = operands;
+		
+		for (p = operands; *p != '\0' && num_args < 8; p++) {
+			if (*p == ',') {
+				*p = '\0';
+				args[num_args++] = p + 1;
+			}
+		}
+		
+		for (i = 0; i < num_args; i++)
+			if (*args[i] == '\0')
+				return 0; // an empty parameter
+	}
 
-SourceLine *source_lines = NULL;
+	DBG_PRINT("Instruction: %s, num_args=%d\n", mn != NULL ? mn->name : "(unknown)", num_args);
+	
+	return mn != NULL && num_args == mn->num_args && mn->codegen(m, mn, args);
+}
 
 /*
-  Takes as input a line, read by read_y86_line, and calls the necessary codegen function
-   in assembler.c to build the program memory
+  Takes as input a line, formatted by format_y86_line, and assembles it: the line is added to
+   source_lines at the current address, a label line defines the label there, and any
+   other line is encoded by encode_line to build the program memory. The source is only
+   read once, so a label that is used before it is defined gets a fixup, which
+   resolve_fixups patches at the end
    
   Returns 1 on success, 0 on error
 */
-int parse_line(char *line) {
-	char *space, *cmd, *rest, *args[8], *line_copy;
-	int i, num_args = 0, succ = 1;
+int parse_line(Y86Machine *m, char *line) {
+	int i, succ, len, first_fixup = m->num_fixups;
+	long size;
   
 	assert(line != NULL);
   
 	DBG_PRINT("Line: %s\n", line);
 	
-	line_copy = strdup(line);
+	len = strlen(line);
+	
+	if (len == 0)
+		return 1; /* blank line or line with only a comment, so skip */
 	
-	if (line_copy == NULL)
+	if (!add_source_line(m, line, m->mem_len))
 		return 0;
 	
-	if (!str_ends_with(line, ':')) {
-		// this is not a label line
-		space = strchr(line_copy, ' ');
-		
-		for (i = 0; i < 8; i++)
-			args[i] = NULL;
-		
-		if (space != NULL) {
-			*space = '\0'; // separate instruction from parameters  
-			cmd = line_copy;
-			rest = cmd + strlen(cmd) + 1;
-			
-			num_args = 1;
-			args[0] = strtok(rest, ",");
-			args[1] = strtok(NULL, ",");
-			
-			if (args[1] != NULL)
-				num_args++;
-		} else {
-			cmd = line_copy;
-		}
-
-		DBG_PRINT("Instruction: %s, num_args=%d\n", cmd, num_args);
-		
-		if (strcmp(cmd, "irmovl") == 0) {
-			succ = (num_args != 2) ? 0 : irmovl_codegen(cmd, args);
-		}
+	if (str_ends_with(line, ':')) {
+		// this is a label line
+		line[len-1] = '\0';
+		succ = add_label(m, line, m->mem_len);
+		line[len-1] = ':';
 		
-		// rmmovl %eax, (%ebx) is equiv. to rmmovl %eax, 0(%ebx)
-		else if (strcmp(cmd, "rmmovl") == 0 || strcmp(cmd, "mrmovl") == 0) {
-			succ = (num_args != 2) ? 0 : reg_mem_codegen(cmd, args);
-		}
-		
-		else if (strcmp(cmd, "rdint") == 0 || strcmp(cmd, "rdch") == 0 || strcmp(cmd, "wrch") == 0 || strcmp(cmd, "wrint") == 0 ||
-				 strcmp(cmd, "pushl") == 0 || strcmp(cmd, "popl") == 0) {
-			succ = (num_args != 1) ? 0 : reg_num_codegen(cmd, args);
-		}
-		
-		else if (strcmp(cmd, "addl") == 0 || strcmp(cmd, "subl") == 0 || strcmp(cmd, "xorl") == 0 || strcmp(cmd, "andl") == 0 ||
-				 strcmp(cmd, "multl") == 0 || strcmp(cmd, "divl") == 0 || strcmp(cmd, "modl") == 0 || strcmp(cmd, "rrmovl") == 0) {
-			succ = (num_args != 2) ? 0 : reg_nums_mask_codegen(cmd, args);
-		}
-		
-		else if (strcmp(cmd, "halt") == 0 || strcmp(cmd, "ret") == 0 || strcmp(cmd, "nop") == 0) {
-			succ = (num_args != 0) ? 0 : no_operands_codegen(cmd, args); 
-		}
-		
-		else if (strcmp(cmd, "je") == 0 || strcmp(cmd, "jle") == 0 || strcmp(cmd, "jmp") == 0 || strcmp(cmd, "jg") == 0 ||
-				 strcmp(cmd, "jl") == 0 || strcmp(cmd, "jne") == 0 || strcmp(cmd, "jge") == 0 || strcmp(cmd, "call") == 0) {
-		    succ = (num_args != 1) ? 0 : label_addr_codegen(cmd, args);
-		}
-		
-		else if (strcmp(cmd, ".long") == 0) {
-			succ = (num_args != 1) ? 0 : long_codegen(cmd, args);
-		}
-  
-		else if (strcmp(cmd, ".pos") == 0) {
-			succ = (num_args != 1) ? 0 : pos_codegen(cmd, args);
-		}
-		
-		else if (strcmp(cmd, ".align") == 0) {
-		    succ = (num_args != 1) ? 0 : align_codegen(cmd, args);
-		}
+		DBG_PRINT("Got a label line %s at address %lx\n", line, (long)m->mem_len);
+		return succ;
 	}
 	
-	if (!succ) {
-		write_to_dbg("parser: Error processing %s", line);
-		get_key_and_exit();
+	// make sure the instruction fits before any of it is written
+	size = get_instr_size(line, m->mem_len);
+	
+	if ((long)m->mem_len + size > (long)m->mem_size) {
+		DBG_PRINT("Instruction at %lx exceeds mem_size\n", (long)m->mem_len);
+		sim_error(m, "parser: Program does not fit in memory");
+		return 0;
 	}
 	
-	free(line_copy);
-	return 1;
-}
-
-/*
-  Runs through the y86 file, and assign an address to each label
-  Also stores each source line in source_lines by calling
-    add_source_line (this just happens to be the easiest place to do so)
-*/
-void parse_labels(FILE *str_in) {
-	char line[4096];
-	int len, cur_addr = 0;
-	Label *cur_label = NULL;
+	if (!encode_line(m, line)) {
+		sim_error(m, "parser: Error processing %s", line);
+		return 0;
+	}
 	
-	assert(str_in != NULL);
+	// the fixups the codegen function added report this line if their label never turns up
+	for (i = first_fixup; i < m->num_fixups; i++)
+		if ((m->fixups[i].line = strdup(line)) == NULL)
+			return 0;
 	
-	while (read_y86_line(str_in, line, sizeof(line))) {
-		if (cur_addr > 4096) {
-			DBG_PRINT("cur_addr exceeds 4096\n");
-			exit(0);
-		}
-		
-		len = strlen(line);
-   
-		DBG_PRINT("Read in line: %s\n", line);
-        
-		if (len == 0)
-			continue; /* blank line or line with only a comment, so skip */
-
-		add_source_line(line, cur_addr);    
-    
-		if (str_ends_with(line, ':')) {
-			// this is a label line
-			line[len-1] = '\0';
-			cur_label = malloc(sizeof(Label));
-			strcpy(cur_label->name, line);
-			cur_label->addr = cur_addr;
-
-			DBG_PRINT("Got a label line %s at address %x\n", line, cur_addr);
-
-			labels = realloc(labels, (num_labels + 1) * sizeof(Label));
-			labels[num_labels++] = cur_label;
-		} else {
-			// this is not a label line, but we still need to keep counting the current address so we know where we are
-			DBG_PRINT("cur instr size = %d, cur addr = %x\n", get_instr_size(line, cur_addr), cur_addr);
-			cur_addr += get_instr_size(line, cur_addr); /* line now contains only the instruction */
-		}
-	}
+	return 1;
 }
 
-/* Check if a line is a label, returns 1 if it is, and 0 if not */
-int is_label_line(char *line) {
-	int i;
-	char *p, *colon;
-	char *alphanumeric;
-	
-	assert(line != NULL);
+/* Check if the len characters at line are a label, returns 1 if they are, and 0 if not */
+static int is_label_text(char *line, int len) {
+	char *p, *colon, *end = line + len;
+	char *alphanumeric = NULL;
 	
-	colon = strchr(line, ':');
+	colon = memchr(line, ':', len);
 	
 	/* should have a : marking the end of the label name */
 	if (colon == NULL)
 		return 0;
 	
 	/* only characters that should come after the colon are spaces */
-	for (i = 1; i < strlen(colon); i++)
-		if (!is_whitespace(colon[i]))
+	for (p = colon + 1; p < end; p++)
+		if (!is_whitespace(*p))
 			return 0;
 
 	/* and everything before it should be alphanumeric or a space or underscore */
-	for (p = line; p < colon; p++)
+	for (p = line; p < colon; p++) {
 		if (!is_alphanumeric(*p) && !is_whitespace(*p) && *p != '_')
 			return 0;
+		
+		if (alphanumeric == NULL && is_alphanumeric(*p))
+			alphanumeric = p;
+	}
 
 	/* ...but we cannot have a space in the middle of the label (e.g. "LA BEL:" disallowed)
 	   AND we must have atleast one alphanumeric character for the label name */
-	alphanumeric = get_first_alphanumeric(line);
 	if (alphanumeric == NULL)
 		return 0;
 	
 	/* from the first alphanumeric character to the : */
-	for (p = alphanumeric; p < colon; p++) {
+	for (p = alphanumeric; p < colon; p++)
 		if (!is_alphanumeric(*p) && *p != '_') /* we should only have alphanumeric characters or underscores */
 			return 0;
-		p++;
-	}
 	
 	return 1;
 }
 
-// Read the next raw line of the file
-int read_line(FILE *file, char *buf, int size) {
-	int len;
-	char *ret;
-	
-	if (buf == NULL)
-		return 0;
-	
-	memset(buf, 0, size);
-	ret = fgets(buf, size, file);
-	
-	if (ret == NULL)
-		return 0;
-	
-	len = strlen(buf);
-	buf[len-1] = '\0';
+/* Check if a line is a label, returns 1 if it is, and 0 if not */
+int is_label_line(char *line) {
+	assert(line != NULL);
 	
-	DBG_PRINT("Read: %s\n", buf);
-	return 1;
+	return is_label_text(line, strlen(line));
 }
 
 /*
-  Reads the next raw line from the file, and puts it into a nice format to parse:
+  Puts a raw source line, the len characters at line_in, into a nice format to parse, writing it
+  to buf (size bytes long):
    -> comments are removed from the line
    -> the instruction is converted to <INSTRUCTION NAME> <ARG1>,<ARG2>
         e.g. "  irmovl  $3,   %edx" is convered to "irmovl $3,%edx"
+   A blank line or a line with only a comment gives an empty string. line_in doesn't need to
+   be NUL terminated and isn't modified, so it can point straight into a mapped source file
+   (a \r ending the line is whitespace like any other)
 	
    Returns 0 on error, 1 on success
 */
-int read_y86_line(FILE *file, char *buf, int size) {
-	int i, err, buf_idx = 0;
-	char *line_in = malloc(size);
-	char *orig_line = line_in;
+int format_y86_line(char *line_in, int len, char *buf, int size) {
+	char *end, *comment, *p;
+	int buf_idx = 0, name_len = 0;
+	Mnemonic *mn;
 	
-	if (line_in == NULL) {
-		DBG_PRINT("malloc fail\n");
-		return 0;
-	}
-	
-	memset(buf, 0, size);
-	err = read_line(file, line_in, size);
+	*buf = '\0';
 	
-	DBG_PRINT("Read in: %s\n", line_in);
-	
-	if (err == 0) {
-		free(orig_line);
-		return 0;
-	}
+	/* check if we have a comment in the line, and if so, ignore everything after (and including) the # */
+	comment = memchr(line_in, '#', len);
+	end = (comment != NULL) ? comment : line_in + len;
 	
 	/* skip all spaces */
-	while (is_whitespace(*line_in))
+	while (line_in < end && is_whitespace(*line_in))
 		line_in++;
 	
-	/* check if we have a comment in the line, and if so, remove everything after (and including) the # */
-	char *comment = strchr(line_in, '#');
-	if (comment != NULL)
-		*comment = '\0';
-	
 	/* whole line is a comment */
-	if (*line_in == '\0') {
-		free(orig_line);
+	if (line_in == end)
 		return 1;
-	}
 	
-	/* check if we have an instruction */
-	char *instr_start = NULL, *instr_end = NULL;
+	/* check if we have an instruction or directive */
+	while (line_in + name_len < end && !is_whitespace(line_in[name_len]))
+		name_len++;
 	
-	for (i = 0; i < num_instrs; i++) {
-		int instr_len = strlen(instrs[i].name);
-		if (memcmp(line_in, instrs[i].name, instr_len) == 0) {
-			if (instr_len > size-1) { /* probably shouldn't happen but just to be safe */
-				free(orig_line);
-				return 0;
-			}
-			
-			if (is_whitespace(line_in[instr_len]) || line_in[instr_len] == '\0') {
-				instr_start = line_in;
-				instr_end = instr_start + strlen(instrs[i].name);
-				if (instrs[i].num_args > 0)
-					instr_end += 1; /* add space to end to make room for arguments */
-				break;
-			}
-		}
-	}
+	mn = find_mnemonic(line_in, name_len);
+	
+	if (mn != NULL && name_len > size-2) /* probably shouldn't happen but just to be safe */
+		return 0;
     
 	/* if this line is an instruction */
-	if (instr_start != NULL) {
-		// first copy the actual instruction name
-		char *params = instr_end;
-		strncpy(buf, instr_start, instr_end-instr_start);
-		buf_idx += (instr_end-instr_start);
+	if (mn != NULL && *mn->name != '.') {
+		// first copy the actual instruction name, with a space to make room for arguments
+		memcpy(buf, mn->name, name_len);
+		buf_idx = name_len;
+		
+		if (mn->num_args > 0)
+			buf[buf_idx++] = ' ';
 		
 		/* and then copy all of the non-spaces after it (i.e. arguments) */
-		while (*params != '\0') {
-			if (!is_whitespace(*params))
-				buf[buf_idx++] = *params;
-			params++;
+		for (p = line_in + name_len; p < end; p++) {
+			if (is_whitespace(*p))
+				continue;
+			
+			if (buf_idx >= size-1)
+				return 0;
+			
+			buf[buf_idx++] = *p;
 		}
 		
+		if (buf_idx == name_len + 1) /* the arguments are missing */
+			buf_idx = name_len;
+		
 		buf[buf_idx] = '\0';
-		free(orig_line);
 		return 1;
 	}
 
 	/* otherwise if we have a label */
-	else if (is_label_line(line_in)) {
-		char *alphanumeric, *colon, *p;
+	else if (is_label_text(line_in, end - line_in)) {
+		/* then copy only the "label:" part of the label (w/o any spaces) */
+		for (p = line_in; !is_alphanumeric(*p); p++)
+			;
 		
-		alphanumeric = get_first_alphanumeric(line_in);
-		colon = strchr(line_in, ':');
-		for (p = alphanumeric; p <= colon; p++) /* then copy only the "label:" part of the label (w/o any spaces) */ 
+		for (; *p != ':'; p++) {
+			if (buf_idx >= size-2)
+				return 0;
+			
 			buf[buf_idx++] = *p;
+		}
 		
-		free(orig_line);
+		buf[buf_idx++] = ':';
+		buf[buf_idx] = '\0';
 		return 1;
 	}
 	
-	else if (strncmp(line_in, ".long", 5) == 0 || strncmp(line_in, ".pos", 4) == 0 || strncmp(line_in, ".align", 6) == 0) {
-		if (strncmp(line_in, ".long", 5) == 0)
-			strcpy(buf, ".long ");
-		else if (strncmp(line_in, ".pos", 4) == 0)
-			strcpy(buf, ".pos ");
-		else
-			strcpy(buf, ".align ");
-
-		char *arg_data = &line_in[strlen(buf)];
-
+	else if (mn != NULL) {
+		memcpy(buf, mn->name, name_len);
+		buf_idx = name_len;
+		buf[buf_idx++] = ' ';
+		
 		// skip the spaces in between .<directive> and value
-		while (*arg_data == ' ')
-			arg_data++;
-
-    	buf_idx = strlen(buf);
+		for (p = line_in + name_len; p < end && is_whitespace(*p); p++)
+			;
 		
-		while (*arg_data != ' ' && *arg_data != '\0') {
-			buf[buf_idx++] = *arg_data;
-			arg_data++;
+		while (p < end && !is_whitespace(*p)) {
+			if (buf_idx >= size-1)
+				return 0;
+			
+			buf[buf_idx++] = *p++;
 		}
 		
 		buf[buf_idx] = '\0';
-		free(orig_line);
 		return 1;
 	}
 	
-	DBG_PRINT("No match for %s, returning 0\n", line_in);
-	free(orig_line);
+	DBG_PRINT("No match for %.*s, returning 0\n", (int)(end - line_in), line_in);
 	return 0;
 }
 
 // Checks if the SourceLine is a line with an instruction on it
 static int is_instruction(SourceLine *line) {
-	int i;
-	char *space, *instr_name = NULL;
-	int alloced_name = 0, is_instr = 0;
+	Mnemonic *mn;
 	
 	if (line == NULL)
 		return 0;
-  
-	space = strchr(line->line, ' ');
-  
-	if (space == NULL)
-		instr_name = line->line;
-	else {
-		instr_name = malloc(space - line->line + 1);
-		alloced_name = 1;
-		strncpy(instr_name, line->line, space - line->line);
-		instr_name[space - line->line] = '\0';
-	}
-  
-	DBG_PRINT("name=%s\n", instr_name);
-  
-	for (i = 0; i < num_instrs; i++) {
-		if (strcmp(instrs[i].name, instr_name) == 0) {
-			is_instr = 1;
-			break;
-		}
-	}
-
-	if (alloced_name)
-		free(instr_name);
-  
-	return is_instr;
+	
+	mn = find_mnemonic(line->line, mnemonic_len(line->line));
+	return mn != NULL && *mn->name != '.';
 }
 
 // Return the size of a SourceLine linked list
@@ -390,38 +283,30 @@ int get_source_lines_size(SourceLine *lines) {
 	return size;
 }
 
-// Adds a node to the linked list of source lines
-int add_source_line(char *line, int addr) {
-	SourceLine *new_line = malloc(sizeof(SourceLine));
+// Adds a node, holding a copy of line, to the end of the linked list of source lines
+int add_source_line(Y86Machine *m, char *line, uint32 addr) {
+	SourceLine *new_line = arena_alloc(&m->arena, sizeof(SourceLine));
 
 	if (new_line == NULL)
 		return 0;
   
-	new_line->line = malloc(strlen(line)+1);
+	new_line->line = arena_strdup(&m->arena, line);
 
-	if (new_line->line == NULL) {
-		free(new_line);
+	if (new_line->line == NULL)
 		return 0;
-	}
   
-	strcpy(new_line->line, line);
 	new_line->addr = addr;
 	new_line->next = NULL;
 	new_line->has_breakpoint = 0;
 	new_line->has_cond_breakpoint = 0;
 	new_line->cond_bp_list = NULL;
   
-	if (source_lines == NULL) {
-		source_lines = new_line;
-	} else {
-		SourceLine *last = source_lines;
-
-		while (last->next != NULL)
-			last = last->next;
-
-		last->next = new_line;
-	}
+	if (m->source_lines == NULL)
+		m->source_lines = new_line;
+	else
+		m->last_source_line->next = new_line;
 
+	m->last_source_line = new_line;
 	return 1;
 }
 
@@ -430,8 +315,8 @@ int add_source_line(char *line, int addr) {
   Multiple source lines may have this addr, but only ones with instructions and/or .long declarations
   are returned, not the label name
 */
-SourceLine *find_source_line(uint16 addr) {
-	SourceLine *cur = source_lines;
+SourceLine *find_source_line(Y86Machine *m, uint32 addr) {
+	SourceLine *cur = m->source_lines;
 
 	while (cur != NULL) {
 		if (cur->addr == addr &&
@@ -444,27 +329,157 @@ SourceLine *find_source_line(uint16 addr) {
 	return NULL;
 }
 
+// Hashes a label name (32 bit FNV-1a)
+static uint32 hash_label_name(char *name) {
+	uint32 hash = 2166136261u;
+
+	for (; *name != '\0'; name++)
+		hash = (hash ^ (uint8)*name) * 16777619u;
+
+	return hash;
+}
+
+// Hashes a label address (Fibonacci hashing, the high bits are the best mixed)
+static uint32 hash_label_addr(uint32 addr) {
+	uint32 hash = addr * 2654435761u;
+
+	return hash ^ (hash >> 16);
+}
+
+/*
+  Adds label to the name and address indexes, unless a label with the same name (or at the
+  same address) is already there: lookups find the first label, as a search of labels in
+  order would
+*/
+static void index_label(Y86Machine *m, Label *label) {
+	uint32 mask = m->label_slots - 1, i;
+
+	for (i = hash_label_name(label->name) & mask; m->label_by_name[i] != NULL; i = (i+1) & mask)
+		if (strcmp(m->label_by_name[i]->name, label->name) == 0)
+			break;
+
+	if (m->label_by_name[i] == NULL)
+		m->label_by_name[i] = label;
+
+	for (i = hash_label_addr(label->addr) & mask; m->label_by_addr[i] != NULL; i = (i+1) & mask)
+		if (m->label_by_addr[i]->addr == label->addr)
+			break;
+
+	if (m->label_by_addr[i] == NULL)
+		m->label_by_addr[i] = label;
+}
+
+/*
+  Makes the indexes twice as big (they are kept at most half full, so probing stays short)
+  and adds every label to them again. Returns 1 on success, 0 if there is not enough memory
+*/
+static int grow_label_index(Y86Machine *m) {
+	int i, slots = m->label_slots ? m->label_slots * 2 : LABEL_INDEX_MIN;
+	Label **by_name = calloc(slots, sizeof(Label*));
+	Label **by_addr = calloc(slots, sizeof(Label*));
+
+	if (by_name == NULL || by_addr == NULL) {
+		free(by_name);
+		free(by_addr);
+		return 0;
+	}
+
+	free(m->label_by_name);
+	free(m->label_by_addr);
+	m->label_by_name = by_name;
+	m->label_by_addr = by_addr;
+	m->label_slots = slots;
+
+	for (i = 0; i < m->num_labels; i++)
+		index_label(m, m->labels[i]);
+
+	return 1;
+}
+
+// Adds a label with the given name at addr. Returns 1 on success, 0 if there is not enough memory
+int add_label(Y86Machine *m, char *name, uint32 addr) {
+	Label *label, **labels;
+
+	// labels doubles in size when it fills up
+	if (m->num_labels == m->labels_size) {
+		labels = realloc(m->labels, (m->labels_size ? m->labels_size * 2 : LABEL_INDEX_MIN) * sizeof(Label*));
+
+		if (labels == NULL)
+			return 0;
+
+		m->labels = labels;
+		m->labels_size = m->labels_size ? m->labels_size * 2 : LABEL_INDEX_MIN;
+	}
+
+	if ((m->num_labels + 1) * 2 > m->label_slots && !grow_label_index(m))
+		return 0;
+
+	label = arena_alloc(&m->arena, sizeof(Label));
+
+	if (label == NULL)
+		return 0;
+
+	strncpy(label->name, name, MAX_LABEL_NAME-1);
+	label->name[MAX_LABEL_NAME-1] = '\0';
+	label->addr = addr;
+
+	m->labels[m->num_labels++] = label;
+	index_label(m, label);
+	return 1;
+}
+
 // Find a label by name, and return it, or NULL if it does not exist
-Label *find_label(char *name) {
-	int i;
-  
-	for (i = 0; i < num_labels; i++)
-		if (strcmp(labels[i]->name, name) == 0)
-			return labels[i];
-  
+Label *find_label(Y86Machine *m, char *name) {
+	uint32 mask = m->label_slots - 1, i;
+
+	if (m->label_slots == 0)
+		return NULL;
+
+	for (i = hash_label_name(name) & mask; m->label_by_name[i] != NULL; i = (i+1) & mask)
+		if (strcmp(m->label_by_name[i]->name, name) == 0)
+			return m->label_by_name[i];
+
 	return NULL;
 }
 
 /*
-  Search the array of labels for the label at the specified address
-  Returns the label if it is present in the array, and NULL if not
+  Finds the label at the specified address (the first one, if there are several)
+  Returns the label if there is one, and NULL if not
 */
-Label *find_label_by_addr(uint16 addr) {
-	int i;
-  
-	for (i = 0; i < num_labels; i++)
-		if (labels[i]->addr == addr)
-			return labels[i];
-  
+Label *find_label_by_addr(Y86Machine *m, uint32 addr) {
+	uint32 mask = m->label_slots - 1, i;
+
+	if (m->label_slots == 0)
+		return NULL;
+
+	for (i = hash_label_addr(addr) & mask; m->label_by_addr[i] != NULL; i = (i+1) & mask)
+		if (m->label_by_addr[i]->addr == addr)
+			return m->label_by_addr[i];
+
 	return NULL;
 }
+
+// Frees the label indexes, forgetting every label (the labels themselves are in the arena)
+static void free_labels(Y86Machine *m) {
+	free(m->labels);
+	free(m->label_by_name);
+	free(m->label_by_addr);
+	m->labels = NULL;
+	m->label_by_name = NULL;
+	m->label_by_addr = NULL;
+	m->num_labels = 0;
+	m->labels_size = 0;
+	m->label_slots = 0;
+}
+
+/*
+  Forgets the program: its labels, its source lines with their conditional breakpoints, and
+  the watch conditions, freeing the arena they are all in at once
+*/
+void free_program(Y86Machine *m) {
+	free_labels(m);
+	m->source_lines = NULL;
+	m->last_source_line = NULL;
+	m->watch_conditions = NULL;
+	arena_free(&m->arena);
+}
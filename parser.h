@@ -1,36 +1,49 @@
 #ifndef PARSER_H
 #define PARSER_H
 #include "common.h"
+#include "condition.h"
+#include "arena.h"
 #define MAX_LABEL_NAME 32
+#define LABEL_INDEX_MIN 64 // starting size of labels and the label indexes
+#define MAX_LINE_LEN 4096 // longest source line the assembler takes, once formatted
 
 typedef struct label {
 	char name[MAX_LABEL_NAME];
-	uint16 addr;
+	uint32 addr;
 } Label;
 
-extern Label **labels;
-extern int num_labels;
+/*
+  A use of a label that the assembler reached before the label's definition, so the
+  address is written as a placeholder and patched by resolve_fixups at the end
+*/
+typedef struct _Fixup {
+	uint32 addr; // where the 4 byte address goes
+	char *name; // the label
+	char *line; // the source line it is used on, for reporting a label that is never defined
+	uint8 weak; // an irmovl operand that is a number too, which only a label of that name overrides
+	uint8 rewritten; // bit i is set when a later line (after a .pos moved back) wrote over byte i, which keeps that line's value
+} Fixup;
 
 typedef struct _SourceLine {
 	char *line;
-	uint16 addr;
+	uint32 addr;
 	uint8 has_breakpoint;
 	uint8 has_cond_breakpoint;
 	ConditionList *cond_bp_list;
 	struct _SourceLine *next;
 } SourceLine;
 
-extern SourceLine *source_lines;
-
-int parse_line(char *line);
-void parse_labels(FILE *str_in);
+int encode_line(Y86Machine *m, char *line);
+int parse_line(Y86Machine *m, char *line);
 int get_source_lines_size(SourceLine *lines);
-SourceLine *find_source_line(uint16 addr);
-Label *find_label(char*);
-Label *find_label_by_addr(uint16);
+SourceLine *find_source_line(Y86Machine *m, uint32 addr);
+Label *find_label(Y86Machine *m, char*);
+Label *find_label_by_addr(Y86Machine *m, uint32);
 int reg_name_to_num(char *reg);
 int is_label_line(char *line);
-int read_y86_line(FILE *file, char *buf, int size);
-int add_source_line(char *line, int addr);
+int format_y86_line(char *line_in, int len, char *buf, int size);
+int add_source_line(Y86Machine *m, char *line, uint32 addr);
+int add_label(Y86Machine *m, char *name, uint32 addr);
+void free_program(Y86Machine *m);
 
 #endif
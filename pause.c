@@ -7,6 +7,7 @@
 #include "assembler.h"
 #include "console.h"
 #include "debugger.h"
+#include "memory.h"
 
 /*
   Writes a string to the file first by writing the size of the string
@@ -23,15 +24,15 @@ static void write_string(FILE *out, char *str) {
 	fwrite(str, 1, size, out);
 }
 
-// Reads a string written to the file by write_string
-static char *read_string(FILE *in) {
+// Reads a string written to the file by write_string, into arena
+static char *read_string(Arena *arena, FILE *in) {
 	uint16 size;
 	char *str;
 
 	assert(in != NULL);
   
 	fread(&size, 1, sizeof(size), in);
-	str = malloc(size);
+	str = arena_alloc(arena, size);
 
 	if (str != NULL)
 		fread(str, 1, size, in);
@@ -51,17 +52,17 @@ void write_condition(FILE *out, Condition *con) {
 	fwrite(&con->op, 1, sizeof(con->op), out);
 }
 
-// Reads a condition written to the file by write_condition
-Condition *read_condition(FILE *in) {
-	Condition *con = malloc(sizeof(Condition));
+// Reads a condition written to the file by write_condition, into arena
+Condition *read_condition(Arena *arena, FILE *in) {
+	Condition *con = arena_alloc(arena, sizeof(Condition));
 
 	assert(in != NULL);
   
 	if (con == NULL)
 		return NULL;
   
-	con->x = read_string(in);
-	con->y = read_string(in);
+	con->x = read_string(arena, in);
+	con->y = read_string(arena, in);
 	fread(&con->op, 1, sizeof(con->op), in);
 
 	return con;
@@ -93,19 +94,17 @@ void write_condition_list(FILE *out, ConditionList *list) {
   written to the file by write_condition
   Returns the new ConditionList node or NULL if an error occured
 */
-ConditionList *read_condition_list_node(FILE *in) {
-	ConditionList *new_node = malloc(sizeof(ConditionList));
+ConditionList *read_condition_list_node(Arena *arena, FILE *in) {
+	ConditionList *new_node = arena_alloc(arena, sizeof(ConditionList));
 
 	if (new_node == NULL)
 		return NULL;
 
 	new_node->next = NULL;
-	new_node->con = read_condition(in);
+	new_node->con = read_condition(arena, in);
 
-	if (new_node->con == NULL) {
-		free(new_node);
+	if (new_node->con == NULL)
 		return NULL;
-	}
   
 	return new_node;
 }
@@ -114,7 +113,7 @@ ConditionList *read_condition_list_node(FILE *in) {
   Reads an entire condition linked list written to the file by write_condition_list
   Builds the linked list and returns it, returns NULL when the list size was 0
 */
-ConditionList *read_condition_list(FILE *in) {
+ConditionList *read_condition_list(Arena *arena, FILE *in) {
 	int i;
 	uint16 size;
 	ConditionList *new_list = NULL, *cur = NULL, *prev = NULL;
@@ -124,7 +123,7 @@ ConditionList *read_condition_list(FILE *in) {
 	fread(&size, 1, sizeof(size), in);
  
 	for (i = 0; i < size; i++) {
-		cur = read_condition_list_node(in);
+		cur = read_condition_list_node(arena, in);
     
 		if (prev == NULL)
 			new_list = cur;
@@ -148,21 +147,21 @@ void write_source_line_node(FILE *out, SourceLine *line) {
 	write_condition_list(out, line->cond_bp_list);
 }
 
-// Reads a SourceLine node written to the file by write_source_line_node
-SourceLine *read_source_line_node(FILE *in) {
-	SourceLine *new_node = malloc(sizeof(SourceLine));
+// Reads a SourceLine node written to the file by write_source_line_node, into arena
+SourceLine *read_source_line_node(Arena *arena, FILE *in) {
+	SourceLine *new_node = arena_alloc(arena, sizeof(SourceLine));
   
 	if (new_node == NULL)
 		return NULL;
 
 	new_node->next = NULL;
-	new_node->line = read_string(in);
+	new_node->line = read_string(arena, in);
   
 	fread(&new_node->addr, 1, sizeof(new_node->addr), in);
 	fread(&new_node->has_breakpoint, 1, sizeof(new_node->has_breakpoint), in);
 	fread(&new_node->has_cond_breakpoint, 1, sizeof(new_node->has_cond_breakpoint), in);
 
-	new_node->cond_bp_list = read_condition_list(in);
+	new_node->cond_bp_list = read_condition_list(arena, in);
   
 	return new_node;
 }
@@ -186,8 +185,8 @@ void write_source_lines(FILE *out, SourceLine *list) {
 	write_source_lines_rec(out, list);
 }
 
-// Reads an entire SourceLine linked list written to the file by write_source_lines 
-SourceLine *read_source_lines(FILE *in) {
+// Reads an entire SourceLine linked list written to the file by write_source_lines, into arena
+SourceLine *read_source_lines(Arena *arena, FILE *in) {
 	int i;
 	uint16 size;
 	SourceLine *new_list = NULL, *cur = NULL, *prev = NULL;
@@ -197,7 +196,7 @@ SourceLine *read_source_lines(FILE *in) {
 	fread(&size, 1, sizeof(size), in);
 
 	for (i = 0; i < size; i++) {
-		cur = read_source_line_node(in);
+		cur = read_source_line_node(arena, in);
 
 		if (prev == NULL)
 			new_list = cur;
@@ -210,14 +209,55 @@ SourceLine *read_source_lines(FILE *in) {
 	return new_list;
 }
 
+/*
+  Writes memory to the file: the size of the address space, then the number and contents
+  of every allocated page, ending with NO_PAGE
+*/
+static void write_memory(FILE *out, Y86Machine *m) {
+	uint64 page_num = 0;
+	uint32 num;
+	uint8 *data;
+
+	fwrite(&m->mem_size, 1, sizeof(m->mem_size), out);
+
+	while ((data = mem_next_page(m, &page_num)) != NULL) {
+		num = page_num;
+		fwrite(&num, 1, sizeof(num), out);
+		fwrite(data, 1, PAGE_SIZE, out);
+		page_num++;
+	}
+
+	num = NO_PAGE;
+	fwrite(&num, 1, sizeof(num), out);
+}
+
+// Reads memory written to the file by write_memory, returns 1 on success and 0 on failure
+static int read_memory(FILE *in, Y86Machine *m) {
+	uint64 size;
+	uint32 num;
+	uint8 *data;
+
+	if (fread(&size, 1, sizeof(size), in) != sizeof(size) || !mem_set_size(m, size))
+		return 0;
+
+	while (fread(&num, 1, sizeof(num), in) == sizeof(num) && num != NO_PAGE) {
+		if (((uint64)num << PAGE_BITS) >= size || (data = mem_page_data(m, num, 1)) == NULL)
+			return 0;
+
+		fread(data, 1, PAGE_SIZE, in);
+	}
+
+	return 1;
+}
+
 /*
   Saves the state of the simulator, debugger, and console to a file.
   For more information about the format of the file read the simulator overview.
 */
-int gen_pause_file(char *filename) {
+int gen_pause_file(Y86Machine *m, char *filename) {
 	int i;
 	FILE *f_out;
-	uint16 cur_PC = sim_get_pc();
+	uint32 cur_PC = sim_get_pc(m);
 
 	assert(filename != NULL);
 
@@ -226,12 +266,12 @@ int gen_pause_file(char *filename) {
 	if (f_out == NULL)
 		return 0;
   
-	fwrite(registers, 1, sizeof(registers), f_out);
+	fwrite(m->registers, 1, sizeof(m->registers), f_out);
 	fwrite(&cur_PC, 1, sizeof(cur_PC), f_out);
-	fwrite(&flgs, 1, sizeof(Flags), f_out);
-	fwrite(memory, 1, sizeof(memory), f_out);
-	write_condition_list(f_out, watch_conditions);
-	write_source_lines(f_out, source_lines);
+	fwrite(sim_get_flags(m), 1, sizeof(Flags), f_out);
+	write_memory(f_out, m);
+	write_condition_list(f_out, m->watch_conditions);
+	write_source_lines(f_out, m->source_lines);
 
 	fwrite(&dbg_win_frac, 1, sizeof(dbg_win_frac), f_out);
 	fwrite(&num_lines, 1, sizeof(num_lines), f_out);
@@ -256,10 +296,11 @@ int gen_pause_file(char *filename) {
 }
 
 // Restores the state of the simulator saved to the pause file by gen_pause_file
-int restore_simulator_state(char *pause_file) {
+int restore_simulator_state(Y86Machine *m, char *pause_file) {
 	int i, x, y;
 	FILE *f_in;
-	uint16 new_PC;
+	uint32 new_PC;
+	Flags new_flags;
 
 	assert(pause_file != NULL);
 
@@ -270,21 +311,24 @@ int restore_simulator_state(char *pause_file) {
 		return 0;
 	}
   
-	fread(registers, 1, sizeof(registers), f_in);
-	fread(&new_PC, 1, sizeof(uint16), f_in);
-	sim_set_pc(new_PC);
-  
-	fread(&flgs, 1, sizeof(Flags), f_in);
-	fread(memory, 1, sizeof(memory), f_in);
+	fread(m->registers, 1, sizeof(m->registers), f_in);
+	fread(&new_PC, 1, sizeof(new_PC), f_in);
+	sim_set_pc(m, new_PC);
   
-	// TODO: free source_lines if read_source_lines fails (store ret. value in a variable)
+	fread(&new_flags, 1, sizeof(Flags), f_in);
+	sim_set_flags(m, &new_flags);
 
-	free_condition_list(watch_conditions);
+	if (!read_memory(f_in, m)) {
+		write_to_dbg("Error reading memory from the pause file");
+		fclose(f_in);
+		return 0;
+	}
   
-	watch_conditions = read_condition_list(f_in);
+	// what is read goes in the program's arena, the lines and conditions it replaces stay there until the program is freed
+	m->watch_conditions = read_condition_list(&m->arena, f_in);
 
-	SourceLine *new_source_lines = read_source_lines(f_in);
-	SourceLine *cur_line_old = source_lines;
+	SourceLine *new_source_lines = read_source_lines(&m->arena, f_in);
+	SourceLine *cur_line_old = m->source_lines;
 	SourceLine *cur_line_new = new_source_lines;
 	int same_source_lines = 1;
   
@@ -311,7 +355,12 @@ int restore_simulator_state(char *pause_file) {
 		return 0;
 	}
   
-	source_lines = new_source_lines;
+	m->source_lines = new_source_lines;
+	
+	m->last_source_line = new_source_lines;
+	
+	while (m->last_source_line != NULL && m->last_source_line->next != NULL)
+		m->last_source_line = m->last_source_line->next;
 
 	free_dbg_and_sim_lines();
 	
@@ -360,7 +409,7 @@ int restore_simulator_state(char *pause_file) {
 
 	redraw_window(sim);
 	redraw_window(dbg);  
-	sim_exec_bytecode();
+	dbg_run_program(m);
   
 	fclose(f_in);
 	return 1;
@@ -1,12 +1,12 @@
 #ifndef PAUSE_H
 #define PAUSE_H
 
-#include "debugger.h"
+#include "simulator.h"
 
 void write_condition_list(FILE *out, ConditionList *list);
-ConditionList *read_condition_list(FILE *in);
-SourceLine *read_source_lines(FILE *in);
-int gen_pause_file(char *filename);
-int restore_simulator_state(char *pause_file);
+ConditionList *read_condition_list(Arena *arena, FILE *in);
+SourceLine *read_source_lines(Arena *arena, FILE *in);
+int gen_pause_file(Y86Machine *m, char *filename);
+int restore_simulator_state(Y86Machine *m, char *pause_file);
 
 #endif
@@ -3,13 +3,13 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <stdarg.h>
 #include <math.h>
 #include <assert.h>
 #include "simulator.h"
 #include "assembler.h"
-#include "console.h"
-#include "debugger.h"
-#include "pause.h"
+#include "jit.h"
+#include "memory.h"
 
 Instruction instrs[] = {
 	/* name, op code, size of instruction, number of operands, callback function */
@@ -45,36 +45,419 @@ Instruction instrs[] = {
 
 int num_instrs = sizeof(instrs) / sizeof(Instruction);
 
-uint8 memory[4096];
-int mem_len = 0;
-uint32 registers[8];
-Flags flgs;
-StackFrame *stack_frames = NULL;
-static uint16 PC = 0; // the program counter (instruction pointer)
+/*
+  Maps every possible opcode byte directly to its entry in instrs[], so the
+  simulator loop does one indexed lookup per instruction instead of searching instrs[].
+  Opcodes that don't belong to any instruction map to invalid_instr.
+  Built by sim_init_dispatch_table
+*/
+static Instruction invalid_instr = {"invalid", 0xff, 1, 0, invalid_opcode_callback};
+static Instruction *dispatch_table[256];
+
+#ifdef THREADED_ENGINE
+// the threaded engine's handler label for each opcode, given to every decoded instruction whichever engine decodes it
+static void *threaded_labels[256];
+#endif
+
+// rrmovl and arithmetic handlers specialized for each register pair, generated by handlergen.c
+#include "handlers.h"
+
+// Default I/O hooks (see Y86IO), a new machine reads from stdin and writes to stdout
+static void stdio_read_int(void *ctx, uint32 *reg) {
+	int val;
+
+	if (scanf("%d", &val) == 1)
+		*reg = val;
+}
+
+// only the low byte of the register is replaced, like reading "%c" into it
+static void stdio_read_char(void *ctx, uint32 *reg) {
+	int c = getchar();
+
+	if (c != EOF)
+		*reg = (*reg & ~0xFF) | (uint8)c;
+}
+
+static void stdio_write_int(void *ctx, uint32 val) {
+	printf("%d", (int)val);
+}
+
+static void stdio_write_char(void *ctx, uint32 val) {
+	putchar((char)val);
+}
+
+static void stdio_error(void *ctx, const char *msg) {
+	fprintf(stderr, "%s\n", msg);
+}
+
+/*
+  Sets up a machine with nothing loaded: a 4 KiB address space of zeroed memory, zeroed
+  registers and flags, empty caches, no debugger state, the block engine and the stdio hooks.
+  sim_init_dispatch_table must have been called first
+  Returns 1 on success, 0 if memory couldn't be set up (see mem_init)
+*/
+int sim_init_machine(Y86Machine *m) {
+	memset(m, 0, sizeof(Y86Machine));
+	m->lazy_flags.op = FLAGS_VALID;
+	m->mem_size = DEFAULT_MEM_SIZE;
+	m->code_page_num = NO_PAGE;
+#ifdef JIT_ENGINE
+	m->jit_page_num = NO_PAGE;
+#endif
+	m->engine = ENGINE_BLOCK;
+	m->io.read_int = stdio_read_int;
+	m->io.read_char = stdio_read_char;
+	m->io.write_int = stdio_write_int;
+	m->io.write_char = stdio_write_char;
+	m->io.error = stdio_error;
+	return mem_init(m);
+}
+
+// Frees everything the machine allocated (but not the machine itself)
+void sim_free_machine(Y86Machine *m) {
+	sim_free_stack_frames(m);
+	mem_free(m);
+	free_program(m);
+
+#ifdef JIT_ENGINE
+	jit_free(m);
+#endif
+}
+
+// Reports an error through the machine's error hook, formatted like printf
+void sim_error(Y86Machine *m, char *fmt, ...) {
+	char msg[512];
+	va_list args;
+
+	va_start(args, fmt);
+	vsnprintf(msg, sizeof(msg), fmt, args);
+	va_end(args);
+
+	m->io.error(m->io.ctx, msg);
+}
 
 // Initializes registers to 0
-void sim_init_registers() {
+void sim_init_registers(Y86Machine *m) {
 	int i;
   
 	for (i = 0; i <= 7; i++)
-		registers[i] = 0;
+		m->registers[i] = 0;
 }
 
 // Initializes flags (condition codes) to 0
-void sim_init_flags() {
-	flgs.OF = 0;
-	flgs.SF = 0;
-	flgs.ZF = 0;
+void sim_init_flags(Y86Machine *m) {
+	m->flgs.OF = 0;
+	m->flgs.SF = 0;
+	m->flgs.ZF = 0;
+	m->lazy_flags.op = FLAGS_VALID;
+}
+
+/*
+  Brings flgs up to date with the last arithmetic operation recorded in lazy_flags.
+  OF is set the same way as it always has been, from
+  http://www.c-jump.com/CIS77/ASM/Flags/F77_0110_overflow_flag.htm adapted for 32 bit
+  registers, which is not quite the x86 definition
+*/
+static inline void update_flags(Y86Machine *m) {
+	uint32 src = m->lazy_flags.src, orig_dest = m->lazy_flags.orig_dest, result = m->lazy_flags.result;
+
+	if (m->lazy_flags.op == FLAGS_VALID)
+		return;
+
+	switch (m->lazy_flags.op) {
+	case ARITH_ADD:
+	case ARITH_MULT:
+	case ARITH_DIV:
+		m->flgs.OF = (signed)orig_dest > 0 && (signed)src > 0 && result > 0x7FFFFFFF;
+		break;
+	case ARITH_SUB:
+		m->flgs.OF = (signed)orig_dest < 0 && (signed)src < 0 && (signed)result < 0x7FFFFFFF;
+		break;
+	default: // xorl, andl, modl
+		m->flgs.OF = 0;
+		break;
+	}
+
+	m->flgs.SF = (signed)result < 0;
+	m->flgs.ZF = result == 0;
+	m->lazy_flags.op = FLAGS_VALID;
+
+	DBG_PRINT("OF=%d, SF=%d, ZF=%d\n", m->flgs.OF, m->flgs.SF, m->flgs.ZF);
+}
+
+// Returns the flags (condition codes), evaluating them first if needed
+Flags *sim_get_flags(Y86Machine *m) {
+	update_flags(m);
+	return &m->flgs;
+}
+
+// Sets the flags (condition codes)
+void sim_set_flags(Y86Machine *m, Flags *new_flags) {
+	m->flgs = *new_flags;
+	m->lazy_flags.op = FLAGS_VALID;
+}
+
+#ifdef THREADED_ENGINE
+static int exec_threaded(Y86Machine *m, uint64 budget);
+#endif
+
+/*
+  Builds the opcode dispatch table from instrs[] (and the threaded engine's table of
+  handler labels). Only needs to be called once, before any machine runs
+*/
+void sim_init_dispatch_table() {
+	int i;
+
+	for (i = 0; i < 256; i++)
+		dispatch_table[i] = &invalid_instr;
+
+	for (i = 0; i < num_instrs; i++)
+		dispatch_table[instrs[i].opcode] = &instrs[i];
+
+#ifdef THREADED_ENGINE
+	exec_threaded(NULL, 0);
+#endif
+}
+
+/*
+  Decodes the instruction at addr from bytes, which holds its first 6 bytes
+  (the longest instruction), with anything past the end of memory as 0
+*/
+static void decode_bytes(uint8 *bytes, uint32 addr, DecodedInstr *di) {
+	Instruction *instr = dispatch_table[bytes[0]];
+	int imm_start;
+
+	di->instr = instr;
+	di->exec = instr->cmd_callback;
+	di->len = instr->size;
+	di->next_pc = addr + instr->size;
+	di->rA = 0;
+	di->rB = 0;
+	di->imm = 0;
+#ifdef THREADED_ENGINE
+	di->label = threaded_labels[bytes[0]];
+#else
+	di->label = NULL;
+#endif
+
+	if (instr->size == 2 || instr->size == 6) {
+		int (*handler)(Y86Machine *, DecodedInstr *);
+		
+		di->rA = bytes[1] >> 4;
+		di->rB = bytes[1] & 0x0F;
+
+		if ((handler = specialized_handler(instr->opcode, di->rA, di->rB)) != NULL)
+			di->exec = handler;
+	}
+
+	if (instr->size >= 5) {
+		imm_start = instr->size - 4;
+		di->imm = bytes[imm_start] | (bytes[imm_start+1] << 8) |
+			(bytes[imm_start+2] << 16) | ((uint32)bytes[imm_start+3] << 24);
+	}
+
+	di->valid = 1;
+}
+
+/*
+  Decodes the instruction starting at addr into di: looks up the instruction
+  in the dispatch table, splits the register byte into rA (4 high bits) and rB
+  (4 low bits), and reads the 32 bit immediate/offset/address operand
+*/
+void sim_decode(Y86Machine *m, uint32 addr, DecodedInstr *di) {
+	uint8 bytes[6];
+	int i;
+
+	for (i = 0; i < 6; i++)
+		bytes[i] = (uint64)addr + i < m->mem_size ? mem_read8(m, addr+i) : 0;
+
+	decode_bytes(bytes, addr, di);
+}
+
+// Same as sim_decode, but reads the instruction from a flat memory image of mem_size bytes other than a machine's
+void sim_decode_mem(uint8 *memory, uint32 mem_size, uint32 addr, DecodedInstr *di) {
+	uint8 bytes[6];
+	int i;
+
+	for (i = 0; i < 6; i++)
+		bytes[i] = (uint64)addr + i < mem_size ? memory[addr+i] : 0;
+
+	decode_bytes(bytes, addr, di);
+}
+
+// Returns the code page of page page_num, or NULL if no code on that page has run
+CodePage *sim_find_code_page(Y86Machine *m, uint32 page_num) {
+	CodePageTable *table;
+
+	if (page_num == m->code_page_num)
+		return m->code_page;
+
+	table = m->code_dir[page_num >> PAGE_TABLE_BITS];
+	return table != NULL ? table->pages[page_num & (PAGE_TABLE_SIZE-1)] : NULL;
+}
+
+/*
+  Returns the code page for the page holding addr, allocating it the first time,
+  or NULL if there is not enough memory
+*/
+static CodePage *get_code_page(Y86Machine *m, uint32 addr) {
+	uint32 page_num = addr >> PAGE_BITS;
+	CodePageTable **table;
+	CodePage **code;
+
+	if (page_num == m->code_page_num)
+		return m->code_page;
+
+	table = &m->code_dir[page_num >> PAGE_TABLE_BITS];
+
+	if (*table == NULL && (*table = calloc(1, sizeof(CodePageTable))) == NULL) {
+		DBG_PRINT("Out of memory allocating code page table for page 0x%x\n", page_num);
+		return NULL;
+	}
+
+	code = &(*table)->pages[page_num & (PAGE_TABLE_SIZE-1)];
+
+	if (*code == NULL) {
+		*code = calloc(1, sizeof(CodePage));
+
+		if (*code == NULL) {
+			DBG_PRINT("Out of memory allocating code page 0x%x\n", page_num);
+			return NULL;
+		}
+
+		(*code)->page_num = page_num;
+		(*code)->next = m->code_pages;
+		m->code_pages = *code;
+	}
+
+	m->code_page_num = page_num;
+	m->code_page = *code;
+	return *code;
+}
+
+/*
+  Returns the decoded record for the instruction at addr, which still has to be filled
+  in by sim_decode if it isn't valid. When there isn't enough memory for the code page,
+  no_code is returned, marked invalid so the instruction gets decoded every time
+*/
+static DecodedInstr *lookup_decoded(Y86Machine *m, uint32 addr) {
+	CodePage *code;
+
+	if ((addr >> PAGE_BITS) == m->code_page_num)
+		return &m->code_page->decoded[addr & PAGE_MASK];
+
+	if ((code = get_code_page(m, addr)) == NULL) {
+		m->no_code.valid = 0;
+		return &m->no_code;
+	}
+
+	return &code->decoded[addr & PAGE_MASK];
+}
+
+/*
+  Invalidates the predecoded instructions that overlap the len bytes of memory at addr
+  Must be called whenever program memory is modified while the program runs
+*/
+void sim_invalidate_decoded(Y86Machine *m, uint32 addr, int len) {
+	uint64 a, page_end, end = (uint64)addr + len;
+	CodePage *code;
+
+	// the longest instruction is 6 bytes, and only pages that have run code have anything to invalidate
+	for (a = addr >= 5 ? addr - 5 : 0; a < end; a = page_end) {
+		page_end = ((a >> PAGE_BITS) + 1) << PAGE_BITS;
+		code = sim_find_code_page(m, a >> PAGE_BITS);
+
+		if (code == NULL)
+			continue;
+
+		for (; a < end && a < page_end; a++) {
+			code->decoded[a & PAGE_MASK].valid = 0;
+
+			if (a >= addr && code->block_code[a & PAGE_MASK])
+				m->blocks_dirty = 1;
+		}
+	}
+}
+
+// Frees every translated block
+static void free_blocks(Y86Machine *m) {
+	CodePage *code;
+	int i;
+
+	for (code = m->code_pages; code != NULL; code = code->next) {
+		for (i = 0; i < PAGE_SIZE; i++) {
+			if (code->blocks[i] != NULL) {
+				free(code->blocks[i]);
+				code->blocks[i] = NULL;
+			}
+		}
+
+		// anything decoded before now may lie outside the (now empty) block_code map
+		memset(code->decoded, 0, sizeof(code->decoded));
+		memset(code->block_code, 0, sizeof(code->block_code));
+	}
+
+	m->blocks_dirty = 0;
+
+#ifdef JIT_ENGINE
+	jit_reset(m);
+#endif
+}
+
+/*
+  Throws away every translated block (the next time the block engine looks for a block).
+  Called by the debugger whenever breakpoints change, since translated blocks
+  remember whether they contain a breakpoint
+*/
+void sim_flush_blocks(Y86Machine *m) {
+	m->blocks_dirty = 1;
+}
+
+// Frees every code page along with its blocks, called by mem_clear when memory is cleared
+void sim_free_code_pages(Y86Machine *m) {
+	CodePage *code, *next;
+	int i;
+
+	free_blocks(m);
+
+	for (code = m->code_pages; code != NULL; code = next) {
+		next = code->next;
+		free(code);
+	}
+
+	for (i = 0; i < PAGE_TABLE_SIZE; i++) {
+		free(m->code_dir[i]);
+		m->code_dir[i] = NULL;
+	}
+
+	m->code_pages = NULL;
+	m->code_page_num = NO_PAGE;
+	m->code_page = NULL;
 }
 
 // Returns the program counter (instruction pointer)
-uint16 sim_get_pc() {
-	return PC;
+uint32 sim_get_pc(Y86Machine *m) {
+	return m->PC;
 }
 
 // Sets the program counter
-void sim_set_pc(uint16 new_PC) {
-	PC = new_PC;
+void sim_set_pc(Y86Machine *m, uint32 new_PC) {
+	m->PC = new_PC;
+}
+
+// Returns the number of instructions retired since the program was loaded
+uint64 sim_get_instr_count(Y86Machine *m) {
+	return m->instr_count;
+}
+
+// Returns the name of the instruction sim_run last stopped on with STAT_ADR or STAT_INS
+const char *sim_get_fault_instr(Y86Machine *m) {
+	return m->fault_instr != NULL ? m->fault_instr->name : NULL;
+}
+
+// Returns 1 if sim_run last stopped on an opcode that doesn't belong to any instruction
+int sim_fault_is_invalid_opcode(Y86Machine *m) {
+	return m->fault_instr == &invalid_instr;
 }
 
 // Return 1 if reg_num is a valid register number and 0 if not
@@ -82,11 +465,27 @@ static int valid_reg_num(int reg_num) {
 	return reg_num >= 0 && reg_num <= 7;
 }
 
+/*
+  Stores val at addr for rmmovl, pushl and call, throwing away any decoded instructions
+  it overwrote. Returns 1 on success, 0 (with fault_status set) if the page of memory
+  it goes to couldn't be allocated
+*/
+static int store32(Y86Machine *m, uint32 addr, uint32 val) {
+	if (!mem_write32(m, addr, val)) {
+		sim_error(m, "Not enough memory for the page at 0x%x", addr & ~PAGE_MASK);
+		m->fault_status = STAT_ADR;
+		return 0;
+	}
+
+	sim_invalidate_decoded(m, addr, 4);
+	return 1;
+}
+
 /*
   Pushes a new stack frame onto the stack of active function calls
   Called in call_callback for use by the backtrace command
 */
-static void push_new_stack_frame(char *func_name, uint16 addr, uint32 esp) {
+static void push_new_stack_frame(Y86Machine *m, char *func_name, uint32 addr, uint32 esp) {
 	StackFrame *frame;
   
 	assert(func_name != NULL);
@@ -99,8 +498,8 @@ static void push_new_stack_frame(char *func_name, uint16 addr, uint32 esp) {
 		frame->esp = esp;
 
 		// insert into the the head of linked list
-		frame->next = stack_frames;
-		stack_frames = frame;
+		frame->next = m->stack_frames;
+		m->stack_frames = frame;
 	}
 }
 
@@ -108,29 +507,35 @@ static void push_new_stack_frame(char *func_name, uint16 addr, uint32 esp) {
   Pops the most recent stack frame from the stack of active function calls
   Called in ret_callback for use by the backtrace command
 */
-static void pop_stack_frame() {
-	StackFrame *old = stack_frames;
+static void pop_stack_frame(Y86Machine *m) {
+	StackFrame *old = m->stack_frames;
   
-	if (stack_frames != NULL) {
-		stack_frames = stack_frames->next;
+	if (m->stack_frames != NULL) {
+		m->stack_frames = m->stack_frames->next;
 		free(old);
 	}
 }
 
+// Frees the whole stack of active function calls
+void sim_free_stack_frames(Y86Machine *m) {
+	while (m->stack_frames != NULL)
+		pop_stack_frame(m);
+}
+
 /* BYTE: 0x30 (opcode)
    BYTE: 4 high bits 8
    4 lower bits reg num
    UINT32: New value */
-int irmovl_callback() {
+int irmovl_callback(Y86Machine *m, DecodedInstr *di) {
 	uint8 reg_num;
     
-	reg_num = memory[PC+1] & 0x0F; // clear the 8 stored in 4 high bits
+	reg_num = di->rB; // clear the 8 stored in 4 high bits
 	if (!valid_reg_num(reg_num))
 		return 0;
   
-	registers[reg_num] = *((uint32*)&memory[PC+2]);
-	DBG_PRINT("regnum = %d, new value: %08x\n", reg_num, registers[reg_num]); 
-	PC += 6;
+	m->registers[reg_num] = di->imm;
+	DBG_PRINT("regnum = %d, new value: %08x\n", reg_num, m->registers[reg_num]); 
+	m->PC = di->next_pc;
 	return 1;
 }
 
@@ -138,13 +543,13 @@ int irmovl_callback() {
    BYTE: 4 higher bits source register number
    4 lower bits dest register number
    UINT32: Offset */
-int rmmovl_callback() {
+int rmmovl_callback(Y86Machine *m, DecodedInstr *di) {
 	uint32 offset;
 	uint8 src_reg_num, dest_reg_num;
  
-	src_reg_num = memory[PC+1] >> 4; // source
-	dest_reg_num = memory[PC+1] & 0x0F; // destination
-	offset = *((uint32*)&memory[PC+2]);
+	src_reg_num = di->rA; // source
+	dest_reg_num = di->rB; // destination
+	offset = di->imm;
 
 	DBG_PRINT("src_reg_num=%d, dest_reg_num=%d, offset=%x\n", src_reg_num, dest_reg_num, offset);
   
@@ -156,26 +561,32 @@ int rmmovl_callback() {
 		   (it was supplied as a label in the source), the actual address is stored in offset
 		   so we want to move contents of src_num into the address stored in offset */
     
-		if (offset > 4096-4) {
-			write_to_dbg("rmmovl offset out of bounds");
+		if (mem_out_of_bounds32(m, offset)) {
+			sim_error(m, "rmmovl offset out of bounds");
+			m->fault_status = STAT_ADR;
 			return 0;
 		}
     
-		*((uint32*)&memory[offset]) = registers[src_reg_num];
-		DBG_PRINT("Wrote %x to address %x\n", registers[src_reg_num], offset);
+		if (!store32(m, offset, m->registers[src_reg_num]))
+			return 0;
+
+		DBG_PRINT("Wrote %x to address %x\n", m->registers[src_reg_num], offset);
 	} else {
-		uint32 addr = registers[dest_reg_num] + (int)offset;
+		uint32 addr = m->registers[dest_reg_num] + (int)offset;
     
-		if (addr > 4096-4) {
-			write_to_dbg("rmmovl offset out of bounds");
+		if (mem_out_of_bounds32(m, addr)) {
+			sim_error(m, "rmmovl offset out of bounds");
+			m->fault_status = STAT_ADR;
 			return 0;
 		}
     
-		*((uint32*)&memory[addr]) = registers[src_reg_num];
-		DBG_PRINT("Wrote %x to address %x\n", registers[src_reg_num], addr);
+		if (!store32(m, addr, m->registers[src_reg_num]))
+			return 0;
+
+		DBG_PRINT("Wrote %x to address %x\n", m->registers[src_reg_num], addr);
 	}
   
-	PC += 6;
+	m->PC = di->next_pc;
 	return 1;
 }
 
@@ -183,13 +594,13 @@ int rmmovl_callback() {
    BYTE: 4 higher bits dest register number
    4 lower bits source register number
    UINT32: Offset */
-int mrmovl_callback() {
+int mrmovl_callback(Y86Machine *m, DecodedInstr *di) {
 	uint32 offset;
 	uint8 src_reg_num, dest_reg_num;
     
-	dest_reg_num = memory[PC+1] >> 4; // destination
-	src_reg_num = memory[PC+1] & 0x0F; // source
-	offset = *((uint32*)&memory[PC+2]);
+	dest_reg_num = di->rA; // destination
+	src_reg_num = di->rB; // source
+	offset = di->imm;
 
 	DBG_PRINT("dest_reg_num=%d, src_reg_num=%d, offset=%x\n", dest_reg_num, src_reg_num, offset);
   
@@ -197,126 +608,131 @@ int mrmovl_callback() {
 		return 0;
   
 	if (src_reg_num == 8) {
-		if (offset > 4096-4) {
-			write_to_dbg("mrmovl offset out of bounds");
+		if (mem_out_of_bounds32(m, offset)) {
+			sim_error(m, "mrmovl offset out of bounds");
+			m->fault_status = STAT_ADR;
 			return 0;
 		}
     
-		registers[dest_reg_num] = *((uint32*)&memory[offset]);
-		DBG_PRINT("Read %x from address %x\n", registers[dest_reg_num], offset);
+		m->registers[dest_reg_num] = mem_read32(m, offset);
+		DBG_PRINT("Read %x from address %x\n", m->registers[dest_reg_num], offset);
 	} else {
-		uint32 addr = registers[src_reg_num] + (int)offset;
+		uint32 addr = m->registers[src_reg_num] + (int)offset;
 
-		if (addr > 4096-4) {
-			write_to_dbg("mrmovl offset out of bounds");
+		if (mem_out_of_bounds32(m, addr)) {
+			sim_error(m, "mrmovl offset out of bounds");
+			m->fault_status = STAT_ADR;
 			return 0;
 		}
     
-		registers[dest_reg_num] =  *((uint32*)&memory[addr]);
-		DBG_PRINT("Read %x from address %x\n", registers[dest_reg_num], addr);
+		m->registers[dest_reg_num] = mem_read32(m, addr);
+		DBG_PRINT("Read %x from address %x\n", m->registers[dest_reg_num], addr);
 	}
   
-	PC += 6;
+	m->PC = di->next_pc;
 	return 1;
 }
 
 /* BYTE: 0x20 (opcode)
    BYTE: 4 higher bits source register number
    4 lower bits dest register number */
-int rrmovl_callback() {
-	uint32 src = memory[PC+1] >> 4;
-	uint32 dest = memory[PC+1] & 0x0F;
+int rrmovl_callback(Y86Machine *m, DecodedInstr *di) {
+	uint32 src = di->rA;
+	uint32 dest = di->rB;
     
 	DBG_PRINT("src: %d, dest: %d\n", src, dest);
   
 	if (!valid_reg_num(src) || !valid_reg_num(dest))
 		return 0;
   
-	registers[dest] = registers[src];
-	PC += 2;
+	m->registers[dest] = m->registers[src];
+	m->PC = di->next_pc;
 	return 1;
 }
 
 /* BYTE: 0xF2 (opcode)
    BYTE: 4 higher bits register number to read into
    4 lower bits 8 */
-int rdint_callback() {
-	uint8 reg_num = memory[PC+1] >> 4;
+int rdint_callback(Y86Machine *m, DecodedInstr *di) {
+	uint8 reg_num = di->rA;
   
 	if (!valid_reg_num(reg_num))
 		return 0;
   
-	set_window_title(sim, "(STATUS: Waiting for integer input - rdint)");
-	read_from_win(sim, NULL, "%d", &registers[reg_num]);
-	set_window_title(sim, NULL);
+	m->io.read_int(m->io.ctx, &m->registers[reg_num]);
 
-	DBG_PRINT("Read %d into reg num %d\n", registers[reg_num], reg_num);
+	DBG_PRINT("Read %d into reg num %d\n", m->registers[reg_num], reg_num);
   
-	PC += 2;
+	m->PC = di->next_pc;
 	return 1;
 }
 
 /* BYTE: 0xF0 (opcode)
    BYTE: 4 higher bits register number to read into
    4 lower bits 8 */
-int rdch_callback() {
-	uint8 reg_num = memory[PC+1] >> 4;
+int rdch_callback(Y86Machine *m, DecodedInstr *di) {
+	uint8 reg_num = di->rA;
  
 	if (!valid_reg_num(reg_num))
 		return 0;
   
-	set_window_title(sim, "(STATUS: Waiting for character input - rdch)");
-	read_from_win(sim, NULL, "%c", &registers[reg_num]);
-	set_window_title(sim, NULL); 
+	m->io.read_char(m->io.ctx, &m->registers[reg_num]);
 
-	DBG_PRINT("Read %c into reg num %d\n", registers[reg_num], reg_num);
+	DBG_PRINT("Read %c into reg num %d\n", m->registers[reg_num], reg_num);
   
-	PC += 2;
+	m->PC = di->next_pc;
 	return 1;
 }
 
 /* BYTE: 0xF3 (opcode)
    BYTE: 4 higher bits register number to read into
    4 lower bits 8 */
-int wrint_callback() {
-	uint8 reg_num = memory[PC+1] >> 4;
+int wrint_callback(Y86Machine *m, DecodedInstr *di) {
+	uint8 reg_num = di->rA;
   
 	if (!valid_reg_num(reg_num))
 		return 0;
   
-	write_to_sim("%d", registers[reg_num]);
-	DBG_PRINT("Wrote %d to reg num %d\n", registers[reg_num], reg_num);
+	m->io.write_int(m->io.ctx, m->registers[reg_num]);
+	DBG_PRINT("Wrote %d to reg num %d\n", m->registers[reg_num], reg_num);
   
-	PC += 2;
+	m->PC = di->next_pc;
 	return 1;
 }
 
 /* BYTE: 0xF1 (opcode)
    BYTE: 4 higher bits register number to read into
    4 lower bits 8 */
-int wrch_callback() {
-	uint8 reg_num = memory[PC+1] >> 4;
+int wrch_callback(Y86Machine *m, DecodedInstr *di) {
+	uint8 reg_num = di->rA;
   
 	if (!valid_reg_num(reg_num))
 		return 0;
 
-	write_to_sim("%c", registers[reg_num]);
-	DBG_PRINT("Wrote %c to reg num %d\n", registers[reg_num], reg_num);
+	m->io.write_char(m->io.ctx, m->registers[reg_num]);
+	DBG_PRINT("Wrote %c to reg num %d\n", m->registers[reg_num], reg_num);
   
-	PC += 2;
+	m->PC = di->next_pc;
 	return 1;
 }
 
 // BYTE: 0 (opcode)
-int nop_callback() {
-	PC++;
+int nop_callback(Y86Machine *m, DecodedInstr *di) {
+	m->PC = di->next_pc;
 	return 1;
 }
 
 // BYTE: 0x10 (opcode)
-int halt_callback() {
+int halt_callback(Y86Machine *m, DecodedInstr *di) {
 	DBG_PRINT("halt_callback()\n");
-	get_key_and_exit();
+	m->fault_status = STAT_HLT;
+	return 0;
+}
+
+// Called for any opcode that doesn't match an instruction in instrs[]
+int invalid_opcode_callback(Y86Machine *m, DecodedInstr *di) {
+	sim_error(m, "Could not find callback for opcode %x at PC=0x%x", mem_read8(m, m->PC), m->PC);
+	m->fault_status = STAT_INS;
 	return 0;
 }
 
@@ -326,10 +742,10 @@ int halt_callback() {
   Returns the result of the operation (i.e. new value of destination register)
   err will be set to 1 if an error occured and 0 if not, provided that err is not NULL
 */
-uint32 do_arithmetic(uint32 src, uint32 dest, int op, int *err) {
+uint32 do_arithmetic(Y86Machine *m, uint32 src, uint32 dest, int op, int *err) {
 	uint32 orig_dest;
   
-	DBG_PRINT("src=%08x, dest=%08x\n", registers[src], registers[dest]);
+	DBG_PRINT("src=%08x, dest=%08x\n", m->registers[src], m->registers[dest]);
   
 	if (!valid_reg_num(src) || !valid_reg_num(dest)) {
 		if (err != NULL)
@@ -337,46 +753,38 @@ uint32 do_arithmetic(uint32 src, uint32 dest, int op, int *err) {
 		return 0;
 	}
 
-	orig_dest = registers[dest];
+	if ((op == ARITH_DIV || op == ARITH_MOD) && m->registers[src] == 0) {
+		// stops the program with STAT_INS instead of taking down the host with SIGFPE
+		sim_error(m, "%s by zero", op == ARITH_DIV ? "divl" : "modl");
+		m->fault_status = STAT_INS;
 
-	/*
-	  this method for setting the OF flag is from http://www.c-jump.com/CIS77/ASM/Flags/F77_0110_overflow_flag.htm
-	  it is adapted for 32 bit registers and seems to work fine
-	*/
-	if (op == ARITH_ADD) {
-		registers[dest] += registers[src];
-		flgs.OF = (signed)orig_dest > 0 && (signed)registers[src] > 0 && registers[dest] > 0x7FFFFFFF;
+		if (err != NULL)
+			*err = 1;
+		return 0;
 	}
 
-	else if (op == ARITH_SUB) {
-		registers[dest] -= registers[src];
-		flgs.OF = (signed)orig_dest < 0 && (signed)registers[src] < 0 && (signed)registers[dest] < 0x7FFFFFFF; 
-	}
+	orig_dest = m->registers[dest];
 
-	else if (op == ARITH_MULT) {
-		registers[dest] *= registers[src];
-		flgs.OF = (signed)orig_dest > 0 && (signed)registers[src] > 0 && registers[dest] > 0x7FFFFFFF;
-	}
+	if (op == ARITH_ADD)
+		m->registers[dest] += m->registers[src];
 
-	else if (op == ARITH_DIV) {
-		registers[dest] /= registers[src];
-		flgs.OF = (signed)orig_dest > 0 && (signed)registers[src] > 0 && registers[dest] > 0x7FFFFFFF;
-	}
+	else if (op == ARITH_SUB)
+		m->registers[dest] -= m->registers[src];
 
-	else if (op == ARITH_XOR) {
-		registers[dest] ^= registers[src];
-		flgs.OF = 0;
-	}
+	else if (op == ARITH_MULT)
+		m->registers[dest] *= m->registers[src];
 
-	else if (op == ARITH_AND) {
-		registers[dest] &= registers[src];
-		flgs.OF = 0;
-	}
+	else if (op == ARITH_DIV)
+		m->registers[dest] /= m->registers[src];
 
-	else if (op == ARITH_MOD) {
-		registers[dest] %= registers[src];
-		flgs.OF = 0;
-	}
+	else if (op == ARITH_XOR)
+		m->registers[dest] ^= m->registers[src];
+
+	else if (op == ARITH_AND)
+		m->registers[dest] &= m->registers[src];
+
+	else if (op == ARITH_MOD)
+		m->registers[dest] %= m->registers[src];
 
 	else {
 		if (err != NULL)
@@ -385,32 +793,26 @@ uint32 do_arithmetic(uint32 src, uint32 dest, int op, int *err) {
 		return 0;
 	}
 
-	DBG_PRINT("Result: %08x\n", registers[dest]);
-
-	flgs.SF = (signed)registers[dest] < 0;
-	flgs.ZF = registers[dest] == 0;
+	DBG_PRINT("Result: %08x\n", m->registers[dest]);
 
-	if (flgs.OF)
-		DBG_PRINT("Set OF flag\n");
-
-	if (flgs.SF)
-		DBG_PRINT("Set SF flag\n");
-
-	if (flgs.ZF)
-		DBG_PRINT("Set ZF flag\n");
+	// the flags are only worked out when something reads them (see update_flags)
+	m->lazy_flags.op = op;
+	m->lazy_flags.src = m->registers[src];
+	m->lazy_flags.orig_dest = orig_dest;
+	m->lazy_flags.result = m->registers[dest];
    
 	if (err != NULL)
 		*err = 0;
   
-	return registers[dest];
+	return m->registers[dest];
 }
 
 /* BYTE: 0x60 (opcode)
    BYTE: 4 higher bits source register number
    4 lower bits dest register number */
-int addl_callback() {
-	uint32 src = memory[PC+1] >> 4;
-	uint32 dest = memory[PC+1] & 0x0F;
+int addl_callback(Y86Machine *m, DecodedInstr *di) {
+	uint32 src = di->rA;
+	uint32 dest = di->rB;
 	int err;
   
 	DBG_PRINT("src: %d, dest: %d\n", src, dest);
@@ -418,21 +820,21 @@ int addl_callback() {
 	if (!valid_reg_num(src) || !valid_reg_num(dest))
 		return 0;
   
-	do_arithmetic(src, dest, ARITH_ADD, &err);
+	do_arithmetic(m, src, dest, ARITH_ADD, &err);
   
 	if (err)
 		return 0;
   
-	PC += 2;
+	m->PC = di->next_pc;
 	return 1;
 }
 
 /* BYTE: 0x61 (opcode)
    BYTE: 4 higher bits source register number
    4 lower bits dest register number */
-int subl_callback() {
-	uint32 src = memory[PC+1] >> 4;
-	uint32 dest = memory[PC+1] & 0x0F;
+int subl_callback(Y86Machine *m, DecodedInstr *di) {
+	uint32 src = di->rA;
+	uint32 dest = di->rB;
 	int err;
   
 	DBG_PRINT("src: %d, dest: %d\n", src, dest);
@@ -440,21 +842,21 @@ int subl_callback() {
 	if (!valid_reg_num(src) || !valid_reg_num(dest))
 		return 0;
 
-	do_arithmetic(src, dest, ARITH_SUB, &err);
+	do_arithmetic(m, src, dest, ARITH_SUB, &err);
 
 	if (err)
 		return 0;
   
-	PC += 2;
+	m->PC = di->next_pc;
 	return 1;
 }
 
 /* BYTE: 0x64 (opcode)
    BYTE: 4 higher bits source register number
    4 lower bits dest register number */
-int multl_callback() {
-	uint32 src = memory[PC+1] >> 4;
-	uint32 dest = memory[PC+1] & 0x0F;
+int multl_callback(Y86Machine *m, DecodedInstr *di) {
+	uint32 src = di->rA;
+	uint32 dest = di->rB;
 	int err;
   
 	DBG_PRINT("src: %d, dest: %d\n", src, dest);
@@ -462,21 +864,21 @@ int multl_callback() {
 	if (!valid_reg_num(src) || !valid_reg_num(dest))
 		return 0;
 
-	do_arithmetic(src, dest, ARITH_MULT, &err);
+	do_arithmetic(m, src, dest, ARITH_MULT, &err);
 
 	if (err)
 		return 0;
   
-	PC += 2;
+	m->PC = di->next_pc;
 	return 1;
 }
 
 /* BYTE: 0x65 (opcode)
    BYTE: 4 higher bits source register number
    4 lower bits dest register number */
-int divl_callback() {
-	uint32 src = memory[PC+1] >> 4;
-	uint32 dest = memory[PC+1] & 0x0F;
+int divl_callback(Y86Machine *m, DecodedInstr *di) {
+	uint32 src = di->rA;
+	uint32 dest = di->rB;
 	int err;
   
 	DBG_PRINT("src: %d, dest: %d\n", src, dest);
@@ -484,21 +886,21 @@ int divl_callback() {
 	if (!valid_reg_num(src) || !valid_reg_num(dest))
 		return 0;
 
-	do_arithmetic(src, dest, ARITH_DIV, &err);
+	do_arithmetic(m, src, dest, ARITH_DIV, &err);
 
 	if (err)
 		return 0;
   
-	PC += 2;
+	m->PC = di->next_pc;
 	return 1;
 }
 
 /* BYTE: 0x63 (opcode)
    BYTE: 4 higher bits source register number
    4 lower bits dest register number */
-int xorl_callback() {
-	uint32 src = memory[PC+1] >> 4;
-	uint32 dest = memory[PC+1] & 0x0F;
+int xorl_callback(Y86Machine *m, DecodedInstr *di) {
+	uint32 src = di->rA;
+	uint32 dest = di->rB;
 	int err;
   
 	DBG_PRINT("src: %d, dest: %d\n", src, dest);
@@ -506,21 +908,21 @@ int xorl_callback() {
 	if (!valid_reg_num(src) || !valid_reg_num(dest))
 		return 0;
 
-	do_arithmetic(src, dest, ARITH_XOR, &err);
+	do_arithmetic(m, src, dest, ARITH_XOR, &err);
 
 	if (err)
 		return 0;
   
-	PC += 2;
+	m->PC = di->next_pc;
 	return 1;
 }
 
 /* BYTE: 0x62 (opcode)
    BYTE: 4 higher bits source register number
    4 lower bits dest register number */
-int andl_callback() {
-	uint32 src = memory[PC+1] >> 4;
-	uint32 dest = memory[PC+1] & 0x0F;
+int andl_callback(Y86Machine *m, DecodedInstr *di) {
+	uint32 src = di->rA;
+	uint32 dest = di->rB;
 	int err;
   
 	DBG_PRINT("src: %d, dest: %d\n", src, dest);
@@ -528,21 +930,21 @@ int andl_callback() {
 	if (!valid_reg_num(src) || !valid_reg_num(dest))
 		return 0;
 
-	do_arithmetic(src, dest, ARITH_AND, &err);
+	do_arithmetic(m, src, dest, ARITH_AND, &err);
 
 	if (err)
 		return 0;
   
-	PC += 2;
+	m->PC = di->next_pc;
 	return 1;
 }
 
 /* BYTE: 0x66 (opcode)
    BYTE: 4 higher bits source register number
    4 lower bits dest register number */
-int modl_callback() {
-	uint32 src = memory[PC+1] >> 4;
-	uint32 dest = memory[PC+1] & 0x0F;
+int modl_callback(Y86Machine *m, DecodedInstr *di) {
+	uint32 src = di->rA;
+	uint32 dest = di->rB;
 	int err;
   
 	DBG_PRINT("src: %d, dest: %d\n", src, dest);
@@ -550,32 +952,34 @@ int modl_callback() {
 	if (!valid_reg_num(src) || !valid_reg_num(dest))
 		return 0;
 
-	do_arithmetic(src, dest, ARITH_MOD, &err);
+	do_arithmetic(m, src, dest, ARITH_MOD, &err);
 
 	if (err)
 		return 0;
   
-	PC += 2;
+	m->PC = di->next_pc;
 	return 1;
 }
 
 /* BYTE: 0x70 (opcode)
    UINT32: jump address */
-int jmp_callback() {
-	PC = (int)*((uint32*)&memory[PC+1]);
-	DBG_PRINT("To: %d\n", PC);
+int jmp_callback(Y86Machine *m, DecodedInstr *di) {
+	m->PC = di->imm;
+	DBG_PRINT("To: %d\n", m->PC);
 	return 1;
 }
 
 /* BYTE: 0x73 (opcode)
    UINT32: jump address */
-int je_callback() {
-	if (flgs.ZF) {
-		PC = (int)*((uint32*)&memory[PC+1]);
-		DBG_PRINT("Taking jump to %d\n", PC);
+int je_callback(Y86Machine *m, DecodedInstr *di) {
+	update_flags(m);
+
+	if (m->flgs.ZF) {
+		m->PC = di->imm;
+		DBG_PRINT("Taking jump to %d\n", m->PC);
 	} else {
-		DBG_PRINT("Not taking jump to %d\n", (int)*((uint32*)&memory[PC+1]));
-		PC += 5;
+		DBG_PRINT("Not taking jump to %d\n", di->imm);
+		m->PC = di->next_pc;
 	}
   
 	return 1;
@@ -583,13 +987,15 @@ int je_callback() {
 
 /* BYTE: 0x71 (opcode)
    UINT32: jump address */
-int jle_callback() {
-	if ((flgs.SF ^ flgs.OF) | flgs.ZF) {
-		PC = (int)*((uint32*)&memory[PC+1]);
-		DBG_PRINT("Taking jump to %d\n", PC);
+int jle_callback(Y86Machine *m, DecodedInstr *di) {
+	update_flags(m);
+
+	if ((m->flgs.SF ^ m->flgs.OF) | m->flgs.ZF) {
+		m->PC = di->imm;
+		DBG_PRINT("Taking jump to %d\n", m->PC);
 	} else {
-		DBG_PRINT("Not taking jump to %d\n", (int)*((uint32*)&memory[PC+1]));
-		PC += 5;
+		DBG_PRINT("Not taking jump to %d\n", di->imm);
+		m->PC = di->next_pc;
 	}
   
 	return 1;
@@ -597,15 +1003,16 @@ int jle_callback() {
 
 /* BYTE: 0x76 (opcode)
    UINT32: jump address */
-int jg_callback() {
-	DBG_PRINT("SF=%d, OF=%d, ZF=%d\n", flgs.SF, flgs.OF, flgs.ZF);
+int jg_callback(Y86Machine *m, DecodedInstr *di) {
+	update_flags(m);
+	DBG_PRINT("SF=%d, OF=%d, ZF=%d\n", m->flgs.SF, m->flgs.OF, m->flgs.ZF);
   
-	if (!(flgs.SF ^ flgs.OF) & !flgs.ZF) {
-		PC = (int)*((uint32*)&memory[PC+1]);
-		DBG_PRINT("Taking jump to %d\n", PC);
+	if (!(m->flgs.SF ^ m->flgs.OF) & !m->flgs.ZF) {
+		m->PC = di->imm;
+		DBG_PRINT("Taking jump to %d\n", m->PC);
 	} else {
-		DBG_PRINT("Not taking jump to %d\n", (int)*((uint32*)&memory[PC+1]));
-		PC += 5;
+		DBG_PRINT("Not taking jump to %d\n", di->imm);
+		m->PC = di->next_pc;
 	}
   
 	return 1;
@@ -613,15 +1020,16 @@ int jg_callback() {
 
 /* BYTE: 0x72 (opcode)
    UINT32: jump address */
-int jl_callback() {
-	DBG_PRINT("SF=%d, OF=%d, ZF=%d\n", flgs.SF, flgs.OF, flgs.ZF);
+int jl_callback(Y86Machine *m, DecodedInstr *di) {
+	update_flags(m);
+	DBG_PRINT("SF=%d, OF=%d, ZF=%d\n", m->flgs.SF, m->flgs.OF, m->flgs.ZF);
   
-	if (flgs.SF ^ flgs.OF) {
-		PC = (int)*((uint32*)&memory[PC+1]);
-		DBG_PRINT("Taking jump to %d\n", PC);
+	if (m->flgs.SF ^ m->flgs.OF) {
+		m->PC = di->imm;
+		DBG_PRINT("Taking jump to %d\n", m->PC);
 	} else {
-		DBG_PRINT("Not taking jump to %d\n", (int)*((uint32*)&memory[PC+1]));
-		PC += 5;
+		DBG_PRINT("Not taking jump to %d\n", di->imm);
+		m->PC = di->next_pc;
 	}
   
 	return 1;
@@ -629,15 +1037,16 @@ int jl_callback() {
 
 /* BYTE: 0x74 (opcode)
    UINT32: jump address */
-int jne_callback() {
-	DBG_PRINT("SF=%d, OF=%d, ZF=%d\n", flgs.SF, flgs.OF, flgs.ZF);
+int jne_callback(Y86Machine *m, DecodedInstr *di) {
+	update_flags(m);
+	DBG_PRINT("SF=%d, OF=%d, ZF=%d\n", m->flgs.SF, m->flgs.OF, m->flgs.ZF);
   
-	if (!flgs.ZF) {
-		PC = (int)*((uint32*)&memory[PC+1]);
-		DBG_PRINT("Taking jump to %d\n", PC);
+	if (!m->flgs.ZF) {
+		m->PC = di->imm;
+		DBG_PRINT("Taking jump to %d\n", m->PC);
 	} else {
-		DBG_PRINT("Not taking jump to %d\n", (int)*((uint32*)&memory[PC+1]));
-		PC += 5;
+		DBG_PRINT("Not taking jump to %d\n", di->imm);
+		m->PC = di->next_pc;
 	}
   
 	return 1;
@@ -645,15 +1054,16 @@ int jne_callback() {
 
 /* BYTE: 0x75 (opcode)
    UINT32: jump address */
-int jge_callback() {
-	DBG_PRINT("SF=%d, OF=%d, ZF=%d\n", flgs.SF, flgs.OF, flgs.ZF);
+int jge_callback(Y86Machine *m, DecodedInstr *di) {
+	update_flags(m);
+	DBG_PRINT("SF=%d, OF=%d, ZF=%d\n", m->flgs.SF, m->flgs.OF, m->flgs.ZF);
   
-	if (!(flgs.SF ^ flgs.OF)) {
-		PC = (int)*((uint32*)&memory[PC+1]);
-		DBG_PRINT("Taking jump to %d\n", PC);
+	if (!(m->flgs.SF ^ m->flgs.OF)) {
+		m->PC = di->imm;
+		DBG_PRINT("Taking jump to %d\n", m->PC);
 	} else {
-		DBG_PRINT("Not taking jump to %d\n", (int)*((uint32*)&memory[PC+1]));
-		PC += 5;
+		DBG_PRINT("Not taking jump to %d\n", di->imm);
+		m->PC = di->next_pc;
 	}
   
 	return 1;
@@ -663,7 +1073,7 @@ int jge_callback() {
    of the register to push onto the stack. If op is STACK_RAW_VAL then val is the raw value
    to push onto the stack. If err is not NULL then the flag will be set to 1 if an error
    occured set to 0 if not. Returns the value pushed onto the stack */
-uint32 pushl(uint8 src_reg, uint32 val, int op, int *err) {
+uint32 pushl(Y86Machine *m, uint8 src_reg, uint32 val, int op, int *err) {
 	uint32 esp_val, push_val;
   
 	if (op == STACK_REG_VAL) {
@@ -673,21 +1083,31 @@ uint32 pushl(uint8 src_reg, uint32 val, int op, int *err) {
 			return 0;
 		}
 
-		push_val = registers[src_reg];
+		push_val = m->registers[src_reg];
 	} else {
 		push_val = val;
 	}
 
 	DBG_PRINT("Attempting to set push %d on stack\n", push_val);
 
-	if (registers[ESP] > 4096) {
-		write_to_dbg("Stack overflow");
+	// %esp below 4 would wrap around to the top of the address space
+	if (m->registers[ESP] < 4 || mem_out_of_bounds32(m, m->registers[ESP] - 4)) {
+		sim_error(m, "Stack overflow");
+		m->fault_status = STAT_ADR;
+		if (err != NULL)
+			*err = 1;
 		return 0;
 	}
   
-	registers[ESP] -= 4;
-	esp_val = registers[ESP];
-	*((uint32*)&memory[esp_val]) = push_val;
+	esp_val = m->registers[ESP] - 4;
+
+	if (!store32(m, esp_val, push_val)) {
+		if (err != NULL)
+			*err = 1;
+		return 0;
+	}
+
+	m->registers[ESP] = esp_val;
   
 	if (err != NULL)
 		*err = 0;
@@ -699,16 +1119,19 @@ uint32 pushl(uint8 src_reg, uint32 val, int op, int *err) {
    of the register to save the in. If op is STACK_RAW_VAL then the value will not be
    saved in a register. If err is not NULL then the flag will be set appropriately. Returns
    the value popped from the stack. */
-uint32 popl(uint32 dest_reg, int op, int *err) {
+uint32 popl(Y86Machine *m, uint32 dest_reg, int op, int *err) {
 	uint32 esp_val, deref_esp;
 
-	if (registers[ESP] > 4096) {
-		write_to_dbg("Stack overflow");
+	if (mem_out_of_bounds32(m, m->registers[ESP])) {
+		sim_error(m, "Stack overflow");
+		m->fault_status = STAT_ADR;
+		if (err != NULL)
+			*err = 1;
 		return 0;
 	}
   
-	esp_val = registers[ESP];
-	deref_esp = *((uint32*)&memory[esp_val]);
+	esp_val = m->registers[ESP];
+	deref_esp = mem_read32(m, esp_val);
   
 	if (op == STACK_REG_VAL) {
 		if (!valid_reg_num(dest_reg)) {
@@ -718,10 +1141,10 @@ uint32 popl(uint32 dest_reg, int op, int *err) {
 			return 0;
 		}
   
-		registers[dest_reg] = deref_esp;
+		m->registers[dest_reg] = deref_esp;
 	}
 
-	registers[ESP] += 4;
+	m->registers[ESP] += 4;
 
 	if (err != NULL)
 		*err = 0;
@@ -733,109 +1156,638 @@ uint32 popl(uint32 dest_reg, int op, int *err) {
 /* BYTE: 0xA0 (opcode)
    BYTE: 4 higher bits register number to read into
    4 lower bits 8 */
-int pushl_callback() {
-	uint8 src_reg = memory[PC+1] >> 4;
+int pushl_callback(Y86Machine *m, DecodedInstr *di) {
+	uint8 src_reg = di->rA;
 	int err;
   
 	if (!valid_reg_num(src_reg))
 		return 0;
 
-	pushl(src_reg, 0, STACK_REG_VAL, &err);
+	pushl(m, src_reg, 0, STACK_REG_VAL, &err);
 
 	if (err)
 		return 0;
   
-	PC += 2;
+	m->PC = di->next_pc;
 	return 1;
 }
 
 /* BYTE: 0xB0 (opcode)
    BYTE: 4 higher bits register number to read into
    4 lower bits 8 */
-int popl_callback() {
+int popl_callback(Y86Machine *m, DecodedInstr *di) {
 	uint8 dest_reg;
 	int err;
   
-	dest_reg = memory[PC+1] >> 4;
+	dest_reg = di->rA;
   
 	if (!valid_reg_num(dest_reg))
 		return 0;
   
-	popl(dest_reg, STACK_REG_VAL, &err);
+	popl(m, dest_reg, STACK_REG_VAL, &err);
 
 	if (err)
 		return 0;
   
-	PC += 2;
+	m->PC = di->next_pc;
 	return 1;
 }
 
 /* BYTE: 0x80 (opcode)
    UINT32: function address */
-int call_callback() {
+int call_callback(Y86Machine *m, DecodedInstr *di) {
 	int err;
 	uint32 call_addr;
 	Label *func;
 
-	pushl(0, PC+5, STACK_RAW_VAL, &err);
+	pushl(m, 0, di->next_pc, STACK_RAW_VAL, &err);
 
 	if (err)
 		return 0;
 
-	call_addr = *((uint32*)&memory[PC+1]);
-	func = find_label_by_addr(call_addr);
+	call_addr = di->imm;
+	func = find_label_by_addr(m, call_addr);
 
 	if (func != NULL)
-		push_new_stack_frame(func->name, func->addr, registers[ESP]);
+		push_new_stack_frame(m, func->name, func->addr, m->registers[ESP]);
 
-	PC = call_addr;
+	m->PC = call_addr;
 	return 1;
 }
 
 // BYTE: 0x90 (opcode)
-int ret_callback() {
+int ret_callback(Y86Machine *m, DecodedInstr *di) {
 	int err;
-	PC = popl(0, STACK_RAW_VAL, &err);
-	pop_stack_frame();
-	return err == 0;
+	uint32 ret_addr = popl(m, 0, STACK_RAW_VAL, &err);
+
+	if (err)
+		return 0;
+
+	m->PC = ret_addr;
+	pop_stack_frame(m);
+	return 1;
 }
 
-// Executes the byte code
-void sim_exec_bytecode() {
-	uint8 opcode;
-	int i, found_callback;
+// Whether break_check has to be called before the next instruction
+#define NEEDS_BREAK_CHECK (m->dbg_armed || m->interrupted || m->skip_break_check)
 
-	dbg_step = 1; // start off suspended, waiting for debugger input
+/*
+  Returns 1 if we should suspend execution before the instruction at PC to transfer
+  control to the debugger, and 0 if not. We transfer control to the debugger
+  when any of the following conditions hold:
+     1) The next instruction to execute has a (unconditional) breakpoint
+     2) The next instruction to execute has a conditional breakpoint,
+           and that condition is met
+     3) Any of the watch conditions are met
+     4) The user has requested suspension due to a step command in the debugger
+*/
+static int suspend_check(Y86Machine *m) {
+	SourceLine *line = find_source_line(m, m->PC);
+	
+	if (line == NULL)
+		return 0;
+	
+	return m->dbg_step == 1 ||
+		line->has_breakpoint ||
+		find_true_condition_in_list(m, line->cond_bp_list) != NULL ||
+		find_true_condition_in_list(m, m->watch_conditions) != NULL;
+}
 
-	while (PC < 4096) {
-		opcode = memory[PC];
-		found_callback = 0;
+/*
+  Asks the debugger whether to stop before the instruction at PC. Every engine calls
+  this before each instruction while NEEDS_BREAK_CHECK holds (the block engine only
+  at the start of a block when it can). Returns STAT_BREAK, or STAT_AOK after a Ctrl-C,
+  if sim_run should stop, and 0 if the instruction should run
+*/
+static int break_check(Y86Machine *m) {
+	if (m->skip_break_check) {
+		m->skip_break_check = 0;
+		return 0;
+	}
 
-		if (dbg_step >= 2)
-			dbg_step--;
-    
-		if (dbg_suspend_check()) {
-			dbg_step = 0;
-			dbg_suspend_program();
+	if (m->dbg_step >= 2)
+		m->dbg_step--;
+
+	if (m->interrupted) {
+		m->interrupted = 0;
+		m->dbg_step = 0;
+		m->skip_break_check = 1;
+		return STAT_AOK;
+	}
+
+	if (suspend_check(m)) {
+		m->dbg_step = 0;
+		m->skip_break_check = 1;
+		return STAT_BREAK;
+	}
+
+	return 0;
+}
+
+// Returns the status sim_run stops with after di's callback failed
+static int instr_failed(Y86Machine *m, DecodedInstr *di) {
+	int status = m->fault_status != 0 ? m->fault_status : STAT_INS;
+
+	m->fault_status = 0;
+	m->fault_instr = di->instr;
+
+	if (status == STAT_HLT)
+		m->instr_count++; // halt itself retires
+
+	return status;
+}
+
+#ifdef THREADED_ENGINE
+/*
+  Direct threaded version of the loop in exec_callbacks, built on the GCC
+  labels as values extension. Every opcode has a label (threaded_labels, which
+  decode_bytes stores in every decoded instruction as label, whichever engine decoded
+  it) and every handler finishes with its own copy of the dispatch
+  code (DISPATCH), ending in a jump straight to the label of the next instruction.
+  Compared to calling instrs[].cmd_callback through a pointer from a single loop, this
+  gives the host's branch predictor one indirect jump per handler to learn from.
+  Handlers for the simple instructions are inlined here, the rest call their
+  callback directly so both engines share the same semantics.
+  Runs at most budget instructions, returns the STAT_* code for sim_run.
+  Called once with m NULL by sim_init_dispatch_table, which only builds the label table
+  (so machines running on several threads never write to it)
+*/
+static int exec_threaded(Y86Machine *m, uint64 budget) {
+	DecodedInstr *di = NULL;
+	uint64 counted = budget; // budget when instr_count was last brought up to date
+	int i, status;
+
+	if (m == NULL) {
+		for (i = 0; i < 256; i++)
+			threaded_labels[i] = &&op_invalid;
+
+		threaded_labels[0x30] = &&op_irmovl;
+		threaded_labels[0x40] = &&op_rmmovl;
+		threaded_labels[0x50] = &&op_mrmovl;
+		threaded_labels[0x20] = &&op_rrmovl;
+		threaded_labels[0xf2] = &&op_rdint;
+		threaded_labels[0xf0] = &&op_rdch;
+		threaded_labels[0xf3] = &&op_wrint;
+		threaded_labels[0xf1] = &&op_wrch;
+		threaded_labels[0x00] = &&op_nop;
+		threaded_labels[0x10] = &&op_halt;
+		threaded_labels[0x70] = &&op_jmp;
+		threaded_labels[0x60] = &&op_addl;
+		threaded_labels[0x61] = &&op_subl;
+		threaded_labels[0x63] = &&op_xorl;
+		threaded_labels[0x62] = &&op_andl;
+		threaded_labels[0x64] = &&op_multl;
+		threaded_labels[0x65] = &&op_divl;
+		threaded_labels[0x66] = &&op_modl;
+		threaded_labels[0x73] = &&op_je;
+		threaded_labels[0x71] = &&op_jle;
+		threaded_labels[0x76] = &&op_jg;
+		threaded_labels[0x72] = &&op_jl;
+		threaded_labels[0x74] = &&op_jne;
+		threaded_labels[0x75] = &&op_jge;
+		threaded_labels[0xa0] = &&op_pushl;
+		threaded_labels[0xb0] = &&op_popl;
+		threaded_labels[0x80] = &&op_call;
+		threaded_labels[0x90] = &&op_ret;
+		return 0;
+	}
+
+#define DISPATCH() do {								\
+		if (m->PC >= m->mem_size) {					\
+			status = STAT_HLT;						\
+			goto done;								\
+		}											\
+		if (budget == 0) {							\
+			status = STAT_BUDGET;					\
+			goto done;								\
+		}											\
+		if (NEEDS_BREAK_CHECK && (status = break_check(m)) != 0) \
+			goto done;								\
+		budget--;									\
+		di = lookup_decoded(m, m->PC);				\
+		if (!di->valid)								\
+			sim_decode(m, m->PC, di);					\
+		goto *di->label;							\
+	} while (0)
+
+#define CALLBACK(callback) do {						\
+		if (!callback(m, di))							\
+			goto fail;								\
+		DISPATCH();									\
+	} while (0)
+
+// loads and stores may fault straight back to sim_run (see GUARD_MEMORY), so instr_count is brought up to date first
+#define MEM_CALLBACK(callback) do {					\
+		m->instr_count += counted - budget - 1;		\
+		counted = budget + 1;							\
+		CALLBACK(callback);							\
+	} while (0)
+
+#define JUMP_IF(cond) do {							\
+		update_flags(m);								\
+		m->PC = (cond) ? di->imm : di->next_pc;		\
+		DISPATCH();									\
+	} while (0)
+
+	DISPATCH();
+
+ op_irmovl:
+	if (!valid_reg_num(di->rB))
+		goto fail;
+	m->registers[di->rB] = di->imm;
+	m->PC = di->next_pc;
+	DISPATCH();
+
+ op_rrmovl:
+	if (!valid_reg_num(di->rA) || !valid_reg_num(di->rB))
+		goto fail;
+	m->registers[di->rB] = m->registers[di->rA];
+	m->PC = di->next_pc;
+	DISPATCH();
+
+ op_nop:
+	m->PC = di->next_pc;
+	DISPATCH();
+
+ op_jmp: JUMP_IF(1);
+ op_je: JUMP_IF(m->flgs.ZF);
+ op_jle: JUMP_IF((m->flgs.SF ^ m->flgs.OF) | m->flgs.ZF);
+ op_jg: JUMP_IF(!(m->flgs.SF ^ m->flgs.OF) & !m->flgs.ZF);
+ op_jl: JUMP_IF(m->flgs.SF ^ m->flgs.OF);
+ op_jne: JUMP_IF(!m->flgs.ZF);
+ op_jge: JUMP_IF(!(m->flgs.SF ^ m->flgs.OF));
+
+ op_rmmovl: MEM_CALLBACK(rmmovl_callback);
+ op_mrmovl: MEM_CALLBACK(mrmovl_callback);
+ op_rdint: CALLBACK(rdint_callback);
+ op_rdch: CALLBACK(rdch_callback);
+ op_wrint: CALLBACK(wrint_callback);
+ op_wrch: CALLBACK(wrch_callback);
+ op_addl: CALLBACK(di->exec);
+ op_subl: CALLBACK(di->exec);
+ op_xorl: CALLBACK(di->exec);
+ op_andl: CALLBACK(di->exec);
+ op_multl: CALLBACK(di->exec);
+ op_divl: CALLBACK(di->exec);
+ op_modl: CALLBACK(di->exec);
+ op_pushl: MEM_CALLBACK(pushl_callback);
+ op_popl: MEM_CALLBACK(popl_callback);
+ op_call: MEM_CALLBACK(call_callback);
+ op_ret: MEM_CALLBACK(ret_callback);
+ op_halt: CALLBACK(halt_callback);
+ op_invalid: CALLBACK(invalid_opcode_callback);
+
+ fail:
+	budget++; // the failed instruction didn't retire
+	m->instr_count += counted - budget;
+	return instr_failed(m, di);
+
+ done:
+	m->instr_count += counted - budget;
+	return status;
+
+#undef DISPATCH
+#undef CALLBACK
+#undef MEM_CALLBACK
+#undef JUMP_IF
+}
+#endif
+
+// Returns 1 if the instruction ends a basic block (i.e. it can change the flow of control)
+static int ends_block(Instruction *instr) {
+	switch (instr->opcode) {
+	case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75: case 0x76: // jmp, jXX
+	case 0x80: // call
+	case 0x90: // ret
+	case 0x10: // halt
+		return 1;
+	}
+
+	return instr == &invalid_instr;
+}
+
+/*
+  Translates the basic block starting at addr: a straight line run of instructions
+  ending with a jump, call, ret or halt (or after MAX_BLOCK_INSTRS instructions,
+  or at the end of memory), which goes in code's blocks. Returns NULL if there is not enough memory.
+*/
+static Block *translate_block(Y86Machine *m, CodePage *code, uint32 addr) {
+	Block *block;
+	DecodedInstr di;
+	SourceLine *line;
+	CodePage *end_code;
+	uint64 pc = addr, i;
+
+	block = malloc(sizeof(Block));
+
+	if (block == NULL)
+		return NULL;
+
+	block->start = addr;
+	block->num_instrs = 0;
+	block->has_breakpoint = 0;
+	block->exec_count = 0;
+	block->jit_code = NULL;
+	block->succ[0] = block->succ[1] = NULL;
+	block->succ_pc[0] = block->succ_pc[1] = 0;
+
+	do {
+		sim_decode(m, pc, &di);
+		block->instrs[block->num_instrs++] = di;
+		
+		// the first instruction is covered by the check at the start of the block, and the
+		// source lines only matter while something is armed (setting a breakpoint flushes the blocks)
+		if (pc != addr && m->dbg_armed) {
+			line = find_source_line(m, pc);
+			
+			if (line != NULL && (line->has_breakpoint || line->cond_bp_list != NULL))
+				block->has_breakpoint = 1;
 		}
-   
-		// search for the correct command to process
-		for (i = 0; i < num_instrs; i++) {      
-			if (opcode == instrs[i].opcode) {
-				found_callback = 1;
-	
-				if (!instrs[i].cmd_callback()) {
-					write_to_dbg("%s callback failed, exiting...", instrs[i].name);
-					get_key_and_exit();
+		
+		pc += di.len;
+	} while (!ends_block(di.instr) && block->num_instrs < MAX_BLOCK_INSTRS && pc < m->mem_size);
+
+	block->end = pc;
+
+	// the block may run on into the next page, which needs a code page of its own
+	for (i = addr; i < pc && i < m->mem_size; i++) {
+		if ((end_code = get_code_page(m, i)) == NULL) {
+			free(block);
+			return NULL;
+		}
+
+		end_code->block_code[i & PAGE_MASK] = 1;
+	}
+
+	code->blocks[addr & PAGE_MASK] = block;
+	return block;
+}
+
+// Returns the translated block starting at addr, translating it if needed
+static Block *lookup_block(Y86Machine *m, uint32 addr) {
+	CodePage *code = get_code_page(m, addr);
+
+	if (code == NULL)
+		return NULL;
+
+	if (code->blocks[addr & PAGE_MASK] != NULL)
+		return code->blocks[addr & PAGE_MASK];
+
+	return translate_block(m, code, addr);
+}
+
+// Runs the instruction at PC through its callback. Returns 0, or the STAT_* code if it fails
+static int exec_instr(Y86Machine *m) {
+	DecodedInstr *di = lookup_decoded(m, m->PC);
+
+	if (!di->valid)
+		sim_decode(m, m->PC, di);
+
+	if (!di->exec(m, di))
+		return instr_failed(m, di);
+
+	m->instr_count++;
+	return 0;
+}
+
+/*
+  Block engine: runs whole translated basic blocks at a time. The debugger only needs
+  to be asked whether to suspend once at the start of each block, unless something
+  requires checking before every instruction (a step count, a watch condition, or a
+  breakpoint inside the block), in which case we fall back to a single instruction.
+  The same goes for the last few instructions of the budget, when the whole block
+  doesn't fit in it. After a block runs, its successor is normally found through the
+  block's succ links instead of the code pages' blocks tables. With the jit engine, blocks that
+  have run JIT_THRESHOLD times are compiled to native code (see jit.c) and run from then on.
+  Runs at most budget instructions, returns the STAT_* code for sim_run
+*/
+static int exec_blocks(Y86Machine *m, uint64 budget) {
+	Block *block = NULL, *prev = NULL;
+	DecodedInstr *di;
+	int i, slot, status;
+
+	while (m->PC < m->mem_size) {
+		if (budget == 0)
+			return STAT_BUDGET;
+
+		if (m->blocks_dirty) {
+			free_blocks(m);
+			prev = NULL;
+		}
+
+		// find the block at PC, following the chain from the previous block when we can
+		block = NULL;
+		
+		if (prev != NULL) {
+			for (slot = 0; slot < 2; slot++)
+				if (prev->succ[slot] != NULL && prev->succ_pc[slot] == m->PC)
+					block = prev->succ[slot];
+		}
+		
+		if (block == NULL) {
+			block = lookup_block(m, m->PC);
+
+			// out of memory, run the instruction without a block
+			if (block == NULL) {
+				DBG_PRINT("Out of memory translating block at PC=0x%x\n", m->PC);
+
+				if (NEEDS_BREAK_CHECK && (status = break_check(m)) != 0)
+					return status;
+
+				if ((status = exec_instr(m)) != 0)
+					return status;
+
+				budget--;
+				continue;
+			}
+
+			// link it to the previous block, in the first free slot
+			if (prev != NULL) {
+				slot = (prev->succ[0] == NULL) ? 0 : 1;
+				prev->succ[slot] = block;
+				prev->succ_pc[slot] = m->PC;
+			}
+		}
+		
+		prev = NULL;
+
+		if (m->skip_break_check || m->dbg_step != 0 || m->watch_conditions != NULL || block->has_breakpoint ||
+			budget < block->num_instrs) {
+			if (NEEDS_BREAK_CHECK && (status = break_check(m)) != 0)
+				return status;
+			
+			if ((status = exec_instr(m)) != 0)
+				return status;
+
+			budget--;
+			continue;
+		}
+		
+		if ((m->dbg_armed || m->interrupted) && (status = break_check(m)) != 0)
+			return status;
+
+#ifdef JIT_ENGINE
+		if (m->engine == ENGINE_JIT) {
+			if (block->jit_code == NULL && ++block->exec_count == JIT_THRESHOLD)
+				block->jit_code = jit_compile(m, block);
+			
+			if (block->jit_code != NULL) {
+				m->PC = jit_exec(m, block->jit_code, &i);
+				m->instr_count += i;
+				budget -= i;
+
+				// nothing ran when the first instruction has to be left to the interpreter (it faults, or straddles two pages)
+				if (i != 0) {
+					if (!m->blocks_dirty)
+						prev = block;
+					continue;
 				}
 			}
 		}
+#endif
+
+		// instr_count is kept up to date as we go, since a load or store may fault straight back to sim_run (see GUARD_MEMORY)
+		for (i = 0; i < block->num_instrs; ) {
+			di = &block->instrs[i];
 
-		if (!found_callback) {
-			write_to_dbg("Could not find callback for opcode %x at PC=0x%x", opcode, PC);
-			get_key_and_exit();
+			if (!di->exec(m, di))
+				return instr_failed(m, di);
+
+			m->instr_count++;
+			i++;
+
+			// this block (or another one) was just overwritten, or the user pressed Ctrl-C
+			if (m->blocks_dirty || m->interrupted)
+				break;
 		}
+
+		budget -= i;
+
+		if (i == block->num_instrs && !m->blocks_dirty)
+			prev = block;
+	}
+
+	return STAT_HLT;
+}
+
+/*
+  Runs instructions without consulting the debugger, for when it has nothing armed
+  (see dbg_armed), until the program ends, the budget runs out or the user presses Ctrl-C.
+  Returns the STAT_* code if an instruction failed, 0 otherwise
+*/
+static int exec_unchecked(Y86Machine *m, uint64 *budget) {
+	DecodedInstr *di;
+	uint64 left = *budget;
+
+	while (m->PC < m->mem_size && left != 0 && !m->interrupted) {
+		di = lookup_decoded(m, m->PC);
+
+		if (!di->valid)
+			sim_decode(m, m->PC, di);
+
+		if (!di->exec(m, di))
+			return instr_failed(m, di);
+
+		m->instr_count++; // kept up to date as we go, like exec_blocks does
+		left--;
+	}
+
+	*budget = left;
+	return 0;
+}
+
+/*
+  Callback engine: calls the callback of one instruction at a time. While the
+  debugger has nothing armed the work is handed to exec_unchecked.
+  Runs at most budget instructions, returns the STAT_* code for sim_run
+*/
+static int exec_callbacks(Y86Machine *m, uint64 budget) {
+	DecodedInstr *di;
+	int status;
+
+	while (m->PC < m->mem_size) {
+		if (budget == 0)
+			return STAT_BUDGET;
+
+		if (!NEEDS_BREAK_CHECK) {
+			if ((status = exec_unchecked(m, &budget)) != 0)
+				return status;
+			continue;
+		}
+
+		if ((status = break_check(m)) != 0)
+			return status;
+
+		di = lookup_decoded(m, m->PC);
+
+		if (!di->valid)
+			sim_decode(m, m->PC, di);
+
+		if (!di->exec(m, di))
+			return instr_failed(m, di);
+
+		m->instr_count++;
+		budget--;
+	}
+
+	return STAT_HLT;
+}
+
+#ifdef GUARD_MEMORY
+/*
+  Called by sim_run when the instruction at PC faulted on a load or store outside memory.
+  The callbacks only change the machine after their loads and stores, and the engines
+  keep instr_count up to date before them, so this only has to report the error the
+  same way the callbacks' bounds checks do without GUARD_MEMORY
+*/
+static int guest_fault(Y86Machine *m) {
+	DecodedInstr di;
+
+	sim_decode(m, m->PC, &di);
+
+	if (di.instr->opcode == 0x40 || di.instr->opcode == 0x50)
+		sim_error(m, "%s offset out of bounds", di.instr->name);
+	else
+		sim_error(m, "Stack overflow"); // pushl, popl, call or ret
+
+	m->fault_status = STAT_ADR;
+	return instr_failed(m, &di);
+}
+#endif
+
+/*
+  Runs the program from PC until it halts, an instruction fails, the debugger needs
+  to take over (a breakpoint, watch condition, finished step or Ctrl-C), or max_instrs
+  instructions have run (0 means no limit), using the engine selected by m->engine.
+  Returns one of the STAT_* codes. After STAT_AOK, STAT_BUDGET or STAT_BREAK the program
+  carries on from where it stopped with another call.
+*/
+int sim_run(Y86Machine *m, uint64 max_instrs) {
+	uint64 budget = max_instrs != 0 ? max_instrs : UINT64_MAX;
+	int status;
+
+#ifdef GUARD_MEMORY
+	// a load or store outside memory faults in the host, and memory.c's SIGSEGV handler comes back here
+	if (sigsetjmp(m->fault_jmp, 0) != 0) {
+		mem_guard(NULL);
+		return guest_fault(m);
 	}
 
-	get_key_and_exit();
+	mem_guard(m);
+#endif
+
+#ifdef THREADED_ENGINE
+	if (m->engine == ENGINE_THREADED)
+		status = exec_threaded(m, budget);
+	else
+#endif
+	if (m->engine == ENGINE_BLOCK || m->engine == ENGINE_JIT)
+		status = exec_blocks(m, budget);
+	else
+		status = exec_callbacks(m, budget);
+
+#ifdef GUARD_MEMORY
+	mem_guard(NULL);
+#endif
+	return status;
 }
@@ -1,8 +1,10 @@
 #ifndef SIMULATOR_H
 #define SIMULATOR_H
 
+#include <signal.h>
+#include <setjmp.h>
 #include "common.h"
-#include "debugger.h"
+#include "condition.h"
 #include "parser.h"
 
 #define EAX 0
@@ -22,6 +24,23 @@
 #define ARITH_MULT 4
 #define ARITH_DIV 5
 #define ARITH_MOD 6
+#define FLAGS_VALID -1 // lazily evaluated flags are up to date (see update_flags)
+
+#ifdef __GNUC__
+#define THREADED_ENGINE
+#define LANE_ENGINE // y86_run_lanes, built on GCC's vector extensions
+#endif
+
+#if defined(__GNUC__) && defined(__x86_64__) && defined(__unix__)
+#define JIT_ENGINE
+#endif
+
+// GUARD_MEMORY (make GUARD_MEMORY=1) catches out of bounds loads and stores with the host's MMU instead of checking for them, see memory.c
+#if defined(GUARD_MEMORY) && !(defined(__unix__) && defined(__LP64__))
+#error "GUARD_MEMORY needs a 64 bit unix host"
+#endif
+
+#define JIT_THRESHOLD 16 // number of times a block runs before the jit engine compiles it
 
 // USED BY PUSH AND POP //
 #define STACK_RAW_VAL 0
@@ -31,69 +50,241 @@ typedef struct flags {
 	uint32 OF, SF, ZF;
 } Flags;
 
+/*
+  Condition codes are evaluated lazily. Most arithmetic results are overwritten
+  before any jXX looks at the flags, so do_arithmetic only records the operation and
+  the values the flags depend on, and update_flags works out the flags from them the
+  next time they are needed (by a jXX, sim_get_flags or the jit).
+*/
+typedef struct _LazyFlags {
+	int op; // ARITH_* of the last arithmetic instruction, or FLAGS_VALID if the flags are up to date
+	uint32 src; // source register value, read after the destination was written (see do_arithmetic)
+	uint32 orig_dest;
+	uint32 result;
+} LazyFlags;
+
+struct _DecodedInstr;
+
 typedef struct instruction {
 	char name[16]; // name of the instruction
 	uint8 opcode;
 	int size;
 	int num_args; /* number of arguments the command takes */
-	int (*cmd_callback)(); /* returns 1 if the callback succeeds
-							  and 0 if it does not */
+	int (*cmd_callback)(Y86Machine *, struct _DecodedInstr *); /* returns 1 if the callback succeeds
+																  and 0 if it does not */
 } Instruction;
 
+// An instruction with its operands already pulled out of memory (built by sim_decode)
+typedef struct _DecodedInstr {
+	Instruction *instr; // entry in instrs[] whose callback executes this instruction
+	int (*exec)(Y86Machine *, struct _DecodedInstr *); // instr's callback, or a variant specialized for rA and rB
+	uint8 rA, rB; // 4 high bits and 4 low bits of the register byte
+	uint32 imm; // immediate value, offset or address operand
+	uint8 len; // size of the instruction in bytes
+	uint32 next_pc; // address of the instruction that follows
+	uint8 valid; // cleared when the bytes of the instruction are overwritten
+	void *label; // handler label, only used by the threaded engine
+} DecodedInstr;
+
+#define MAX_BLOCK_INSTRS 64
+
+/*
+  A translated basic block: the decoded instructions from start up to and including
+  the next jump, call, ret or halt. succ holds up to two chained successor blocks
+  (the jump target and the fall through), with succ_pc the address each one starts at
+*/
+typedef struct _Block {
+	uint32 start, end; // addresses [start, end) covered by the block
+	int num_instrs;
+	uint8 has_breakpoint; // set if an instruction after the first has a breakpoint
+	int exec_count; // number of times the block has run, used by the jit engine
+	void *jit_code; // native code compiled by the jit engine, or NULL
+	struct _Block *succ[2];
+	uint32 succ_pc[2];
+	DecodedInstr instrs[MAX_BLOCK_INSTRS];
+} Block;
+
+// GUEST MEMORY (see memory.h) //
+#define PAGE_BITS 12
+#define PAGE_SIZE (1 << PAGE_BITS)
+#define PAGE_MASK (PAGE_SIZE - 1)
+#define PAGE_TABLE_BITS 10 // a page number is split into a page directory index and a page table index
+#define PAGE_TABLE_SIZE (1 << PAGE_TABLE_BITS)
+#define NO_PAGE 0xFFFFFFFF // page number that no page has, for the empty last page caches
+#define DEFAULT_MEM_SIZE 4096
+#define MAX_MEM_SIZE ((uint64)1 << 32)
+
+/*
+  The decode and block caches for the instructions on one page of memory, allocated the
+  first time code on the page runs and found through the machine's code_dir. decoded[off]
+  is the predecoded form of the instruction starting at offset off (filled in by sim_decode,
+  so the operands don't need to be pulled out of memory on every execution), blocks[off]
+  is the translated block starting there
+  (or NULL), and block_code[off] is set for every byte that belongs to some translated block.
+  Stores into memory invalidate any decoded records overlapping the written bytes, which
+  keeps self modifying programs working, and a store into block_code'd bytes sets
+  blocks_dirty, which makes the block engine stop and flush every block before running
+  anything else.
+*/
+typedef struct _CodePage {
+	DecodedInstr decoded[PAGE_SIZE];
+	Block *blocks[PAGE_SIZE];
+	uint8 block_code[PAGE_SIZE];
+	uint32 page_num;
+	struct _CodePage *next; // the machine's list of code pages
+} CodePage;
+
+typedef struct _CodePageTable {
+	CodePage *pages[PAGE_TABLE_SIZE];
+} CodePageTable;
+
+#ifndef GUARD_MEMORY
+// A 4 KiB page of guest memory, allocated the first time something is stored into it
+typedef struct _Page {
+	uint8 data[PAGE_SIZE];
+} Page;
+
+typedef struct _PageTable {
+	Page *pages[PAGE_TABLE_SIZE];
+} PageTable;
+#endif
+
 typedef struct _StackFrame {
 	char func_name[MAX_LABEL_NAME];
-	uint16 addr;
+	uint32 addr;
 	uint32 esp;
 	struct _StackFrame *next;
 } StackFrame;
 
-extern StackFrame *stack_frames;
-  
-extern uint8 memory[4096];
-extern int mem_len; // used by assembler
-extern uint32 registers[8];
-extern Flags flgs;
+struct _Y86Machine {
+	/*
+	  Guest memory is mem_size bytes (up to 4 GiB) of 4 KiB pages, found through a two
+	  level page table: page_dir[page_num >> PAGE_TABLE_BITS]->pages[page_num & (PAGE_TABLE_SIZE-1)].
+	  Pages are only allocated when something is stored into them, anything else reads as 0.
+	  last_page is the page last found by a load or store (page number last_page_num),
+	  which saves walking the page table when accesses stay on one page (see mem_page).
+	  With GUARD_MEMORY, memory is instead the first mem_size bytes of a MEM_RESERVE byte
+	  mapping at mem_base, the rest of which faults on any access (see memory.c)
+	*/
+	uint64 mem_size;
+#ifdef GUARD_MEMORY
+	uint8 *mem_base;
+	uint8 *page_used; // nonzero for every page something was stored into, indexed by page number
+	sigjmp_buf fault_jmp; // where sim_run carries on after a load or store outside memory
+#else
+	PageTable *page_dir[PAGE_TABLE_SIZE];
+	uint32 last_page_num;
+	Page *last_page;
+#endif
+	uint64 mem_len; // used by assembler
+	uint32 registers[8];
+	Flags flgs; // only up to date when lazy_flags.op is FLAGS_VALID, read through sim_get_flags
+	LazyFlags lazy_flags;
+	uint32 PC; // the program counter (instruction pointer)
+	StackFrame *stack_frames;
+	int engine; // which execution core sim_run uses
+	Y86IO io;
+
+	uint64 instr_count; // number of instructions retired since the program was loaded
+	int fault_status; // set by a failing callback to the STAT_* code for its failure (0 means STAT_INS)
+	Instruction *fault_instr; // the instruction sim_run last stopped on because it failed
+	int skip_break_check; // set when sim_run stops for the debugger, lets the instruction it stopped at run on resuming
+
+	// built by the assembler (see parser.c)
+	Label **labels; // in the order they appear in the source
+	int num_labels;
+	int labels_size; // number of labels there is room for
+	Label **label_by_name; // hash indexes of labels by name and by address (see find_label), label_slots long
+	Label **label_by_addr;
+	int label_slots;
+	SourceLine *source_lines;
+	SourceLine *last_source_line; // where add_source_line adds the next line
+	Arena arena; // holds the labels, source lines and conditions of the program (see free_program)
+	Fixup *fixups; // only while assembling (see add_fixup)
+	int num_fixups;
+	uint64 asm_end; // the highest address written while assembling, anything written below it may land on a fixup
+
+	// debugger state (see debugger.c)
+	int dbg_step;
+	ConditionList *watch_conditions;
+	int dbg_armed;
+	volatile sig_atomic_t interrupted;
+
+	/*
+	  Decode and block caches (see CodePage), found through code_dir the same way as pages
+	  of memory. code_page is the code page of the page the PC was last on (page number
+	  code_page_num), so running code doesn't need to walk code_dir. no_code is used in
+	  place of a code page that can't be allocated
+	*/
+	CodePageTable *code_dir[PAGE_TABLE_SIZE];
+	CodePage *code_pages;
+	uint32 code_page_num;
+	CodePage *code_page;
+	DecodedInstr no_code;
+	int blocks_dirty;
+
+#ifdef JIT_ENGINE
+	uint8 *jit_buf; // executable buffer holding every block compiled by the jit (see jit.c)
+	int jit_used; // number of bytes of jit_buf in use
+	uint32 jit_page_num; // page compiled code last loaded from or stored to, which the next block starts on
+#endif
+};
+
 extern Instruction instrs[];
 extern int num_instrs;
 
-void sim_init_registers();
-void sim_init_flags();
-uint16 sim_get_pc();
-void sim_set_pc(uint16 new_PC);
-int irmovl_callback();
-int rmmovl_callback();
-int mrmovl_callback();
-int rrmovl_callback();
-int rdint_callback();
-int rdch_callback();
-int wrint_callback();
-int wrch_callback();
-int nop_callback();
-int halt_callback();
-uint32 do_arithmetic(uint32 src, uint32 dest, int op, int *err);
-int addl_callback();
-int subl_callback();
-int multl_callback();
-int divl_callback();
-int xorl_callback();
-int andl_callback();
-int modl_callback();
-int jmp_callback();
-int je_callback();
-int jle_callback();
-int jg_callback();
-int jl_callback();
-int jne_callback();
-int jge_callback();
-uint32 pushl(uint8 src_reg, uint32 val, int op, int *err);
-uint32 popl(uint32 dest_reg, int op, int *err);
-int pushl_callback();
-int popl_callback();
-int call_callback();
-int ret_callback();
-void write_condition_list(FILE *out, ConditionList *list);
-ConditionList *read_condition_list(FILE *in);
-void sim_exec_bytecode();
-SourceLine *read_source_lines(FILE *in);
+int sim_init_machine(Y86Machine *m);
+void sim_free_machine(Y86Machine *m);
+void sim_error(Y86Machine *m, char *fmt, ...);
+void sim_free_stack_frames(Y86Machine *m);
+void sim_init_registers(Y86Machine *m);
+void sim_init_flags(Y86Machine *m);
+Flags *sim_get_flags(Y86Machine *m);
+void sim_set_flags(Y86Machine *m, Flags *new_flags);
+void sim_init_dispatch_table();
+void sim_decode(Y86Machine *m, uint32 addr, DecodedInstr *di);
+void sim_decode_mem(uint8 *memory, uint32 mem_size, uint32 addr, DecodedInstr *di);
+void sim_invalidate_decoded(Y86Machine *m, uint32 addr, int len);
+void sim_flush_blocks(Y86Machine *m);
+CodePage *sim_find_code_page(Y86Machine *m, uint32 page_num);
+void sim_free_code_pages(Y86Machine *m);
+uint32 sim_get_pc(Y86Machine *m);
+void sim_set_pc(Y86Machine *m, uint32 new_PC);
+uint64 sim_get_instr_count(Y86Machine *m);
+const char *sim_get_fault_instr(Y86Machine *m);
+int sim_fault_is_invalid_opcode(Y86Machine *m);
+int sim_run(Y86Machine *m, uint64 max_instrs);
+int irmovl_callback(Y86Machine *m, DecodedInstr *di);
+int rmmovl_callback(Y86Machine *m, DecodedInstr *di);
+int mrmovl_callback(Y86Machine *m, DecodedInstr *di);
+int rrmovl_callback(Y86Machine *m, DecodedInstr *di);
+int rdint_callback(Y86Machine *m, DecodedInstr *di);
+int rdch_callback(Y86Machine *m, DecodedInstr *di);
+int wrint_callback(Y86Machine *m, DecodedInstr *di);
+int wrch_callback(Y86Machine *m, DecodedInstr *di);
+int nop_callback(Y86Machine *m, DecodedInstr *di);
+int halt_callback(Y86Machine *m, DecodedInstr *di);
+int invalid_opcode_callback(Y86Machine *m, DecodedInstr *di);
+uint32 do_arithmetic(Y86Machine *m, uint32 src, uint32 dest, int op, int *err);
+int addl_callback(Y86Machine *m, DecodedInstr *di);
+int subl_callback(Y86Machine *m, DecodedInstr *di);
+int multl_callback(Y86Machine *m, DecodedInstr *di);
+int divl_callback(Y86Machine *m, DecodedInstr *di);
+int xorl_callback(Y86Machine *m, DecodedInstr *di);
+int andl_callback(Y86Machine *m, DecodedInstr *di);
+int modl_callback(Y86Machine *m, DecodedInstr *di);
+int jmp_callback(Y86Machine *m, DecodedInstr *di);
+int je_callback(Y86Machine *m, DecodedInstr *di);
+int jle_callback(Y86Machine *m, DecodedInstr *di);
+int jg_callback(Y86Machine *m, DecodedInstr *di);
+int jl_callback(Y86Machine *m, DecodedInstr *di);
+int jne_callback(Y86Machine *m, DecodedInstr *di);
+int jge_callback(Y86Machine *m, DecodedInstr *di);
+uint32 pushl(Y86Machine *m, uint8 src_reg, uint32 val, int op, int *err);
+uint32 popl(Y86Machine *m, uint32 dest_reg, int op, int *err);
+int pushl_callback(Y86Machine *m, DecodedInstr *di);
+int popl_callback(Y86Machine *m, DecodedInstr *di);
+int call_callback(Y86Machine *m, DecodedInstr *di);
+int ret_callback(Y86Machine *m, DecodedInstr *di);
 
 #endif
@@ -0,0 +1,76 @@
+// engines.c - Runs each program given for a few instructions on one engine and the rest on another, for
+// every pair of engines, and checks that it ends the same way as on the callback engine alone. Run by run.sh
+#include <stdio.h>
+#include <string.h>
+#include "../y86sim.h"
+
+#define NUM_ENGINES 4
+#define FIRST_INSTRS 50 // instructions run before switching
+
+static void zero_read(void *ctx, uint32_t *reg) {
+	*reg = 0;
+}
+
+static void quiet_write(void *ctx, uint32_t val) {
+}
+
+static void quiet_error(void *ctx, const char *msg) {
+}
+
+// Runs program switching from engine from to engine to, and writes how it ended into status, instrs and regs. Returns 1 on success, 0 if it couldn't be loaded
+static int run_switched(char *program, int from, int to, int *status, uint64_t *instrs, uint32_t *regs) {
+	Y86IO io = {zero_read, zero_read, quiet_write, quiet_write, quiet_error, NULL};
+	Y86Machine *m = y86_new_machine();
+	int i;
+
+	if (m == NULL)
+		return 0;
+
+	y86_set_io(m, &io);
+
+	if (!y86_set_engine(m, from) || !y86_load_file(m, program)) {
+		y86_free_machine(m);
+		return 0;
+	}
+
+	*status = y86_run(m, FIRST_INSTRS);
+
+	if (*status == STAT_BUDGET) {
+		y86_set_engine(m, to);
+		*status = y86_run(m, 0);
+	}
+
+	*instrs = y86_get_instr_count(m);
+
+	for (i = 0; i < 8; i++)
+		regs[i] = y86_get_reg(m, i);
+
+	y86_free_machine(m);
+	return 1;
+}
+
+int main(int argc, char *argv[]) {
+	int i, from, to, status, want_status, failed = 0;
+	uint64_t instrs, want_instrs;
+	uint32_t regs[8], want_regs[8];
+
+	for (i = 1; i < argc; i++) {
+		if (!run_switched(argv[i], ENGINE_CALLBACK, ENGINE_CALLBACK, &want_status, &want_instrs, want_regs)) {
+			printf("%s: could not be loaded\n", argv[i]);
+			failed = 1;
+			continue;
+		}
+
+		for (from = 0; from < NUM_ENGINES; from++) {
+			for (to = 0; to < NUM_ENGINES; to++) {
+				if (!run_switched(argv[i], from, to, &status, &instrs, regs) || status != want_status ||
+					instrs != want_instrs || memcmp(regs, want_regs, sizeof(regs)) != 0) {
+					printf("%s: engine %d then %d ends differently\n", argv[i], from, to);
+					failed = 1;
+				}
+			}
+		}
+	}
+
+	return failed;
+}
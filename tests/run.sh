@@ -0,0 +1,181 @@
+#!/bin/sh
+# run.sh - Runs the test programs through y86sim-batch with every engine, with --lockstep, from
+# .yo listings, object files and the assembly cache, switching engines part way through
+# (engines.c) and a couple through --emit-c, and checks that assembling on several threads
+# gives the same image as assembling on one. Run by make check, from the top directory
+#
+# programs/  foo.ys with its input (foo.in) and expected output (foo.out), which must pass
+# errors/    programs which must stop with the status and message in expected.csv
+# lanes/     one program over many inputs (a manifest), for --lockstep
+# loaders/   .yo listings of some of the programs (a manifest)
+# engines.c  runs programs on liby86sim.a, switching from each engine to each other one
+# expected.csv  program,result,status,instructions,message of everything above but loaders/
+#               (sh tests/run.sh update writes it from the callback engine)
+
+cd "$(dirname "$0")/.." || exit 1
+
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+export Y86SIM_NO_CACHE=1
+failed=0
+
+# The results of a run without the timings, in a stable order
+report() {
+	./y86sim-batch -j 4 --format csv "$@" | tail -n +2 | cut -d, -f1-4,7- | sort
+}
+
+# Compares the file of results with tests/expected.csv
+check() {
+	if cmp -s tests/expected.csv "$2"; then
+		echo "ok      $1"
+	else
+		echo "FAILED  $1"
+		diff tests/expected.csv "$2" | head -20
+		failed=1
+	fi
+}
+
+# Checks that every job in the file of results passed
+check_pass() {
+	if [ -s "$2" ] && ! grep -v ',pass,hlt,' "$2" >/dev/null; then
+		echo "ok      $1"
+	else
+		echo "FAILED  $1"
+		grep -v ',pass,hlt,' "$2" | head -20
+		failed=1
+	fi
+}
+
+corpus="tests/programs tests/errors tests/lanes/manifest"
+
+if [ "$1" = "update" ]; then
+	report --engine callback $corpus > tests/expected.csv
+	echo "wrote tests/expected.csv"
+	exit 0
+fi
+
+for engine in callback threaded block jit; do
+	report --engine $engine $corpus > "$tmp/$engine.csv"
+	check "engine $engine" "$tmp/$engine.csv"
+done
+
+report --lockstep $corpus > "$tmp/lockstep.csv"
+check "lockstep" "$tmp/lockstep.csv"
+
+# a machine switched to another engine with y86_set_engine part way through a run ends the same way
+if cc -o "$tmp/engines" tests/engines.c liby86sim.a -lm -pthread && "$tmp/engines" tests/programs/*.ys; then
+	echo "ok      switching engines"
+else
+	echo "FAILED  switching engines"
+	failed=1
+fi
+
+report tests/loaders/manifest > "$tmp/yo.csv"
+check_pass ".yo listings" "$tmp/yo.csv"
+
+# every program saved as an object file and run from that
+mkdir "$tmp/obj"
+: > "$tmp/obj/manifest"
+
+for src in tests/programs/*.ys; do
+	name=$(basename "$src" .ys)
+	input=-
+
+	if [ -e "tests/programs/$name.in" ]; then
+		cp "tests/programs/$name.in" "$tmp/obj/"
+		input=$name.in
+	fi
+
+	cp "tests/programs/$name.out" "$tmp/obj/"
+	./y86sim --emit-obj "$tmp/obj/$name.obj" "$src" >/dev/null 2>&1
+	echo "$name.obj $input $name.out" >> "$tmp/obj/manifest"
+done
+
+report "$tmp/obj/manifest" > "$tmp/obj.csv"
+check_pass "object files" "$tmp/obj.csv"
+
+# a failed --emit-obj or --emit-c exits with 1: a missing source, one that doesn't assemble, an unwritable output
+if ./y86sim --emit-obj "$tmp/x.obj" tests/missing.ys 2>/dev/null ||
+	./y86sim --emit-obj "$tmp/x.obj" tests/errors/asm_undef.ys 2>/dev/null ||
+	./y86sim --emit-obj "$tmp/missing/x.obj" tests/programs/arith.ys 2>/dev/null ||
+	./y86sim --emit-c "$tmp/missing/x.c" tests/programs/arith.ys 2>/dev/null; then
+	echo "FAILED  failed emits exit with 0"
+	failed=1
+else
+	echo "ok      failed emits"
+fi
+
+if ./y86sim --batch --engine bogus tests/programs/arith.ys >/dev/null 2>&1; then
+	echo "FAILED  an unknown engine exits with 0"
+	failed=1
+else
+	echo "ok      unknown engine"
+fi
+
+# a program translated with --emit-c gives the same output, and ones that store into their own code (an
+# instruction, or .long data they jump to) stop with 1
+if command -v cc >/dev/null; then
+	./y86sim --emit-c "$tmp/rec.c" tests/programs/rec.ys >/dev/null 2>&1
+	./y86sim --emit-c "$tmp/smc.c" tests/programs/smc.ys >/dev/null 2>&1
+	./y86sim --emit-c "$tmp/smc_long.c" tests/programs/smc_long.ys >/dev/null 2>&1
+
+	if cc -o "$tmp/rec" "$tmp/rec.c" && cc -o "$tmp/smc" "$tmp/smc.c" && cc -o "$tmp/smc_long" "$tmp/smc_long.c" &&
+		"$tmp/rec" < tests/programs/rec.in | cmp -s - tests/programs/rec.out &&
+		! "$tmp/smc" >/dev/null 2>"$tmp/smc.err" && grep -q "Store into translated code" "$tmp/smc.err" &&
+		! "$tmp/smc_long" >/dev/null 2>"$tmp/smc.err" && grep -q "Store into translated code" "$tmp/smc.err"; then
+		echo "ok      --emit-c"
+	else
+		echo "FAILED  --emit-c"
+		failed=1
+	fi
+fi
+
+# the first run fills the cache (only used while Y86SIM_NO_CACHE is unset), the second loads everything from it
+mkdir "$tmp/cache"
+(unset Y86SIM_NO_CACHE; XDG_CACHE_HOME="$tmp/cache" report $corpus) > "$tmp/cache1.csv"
+check "cache (stored)" "$tmp/cache1.csv"
+
+if [ -z "$(ls "$tmp/cache/y86sim" 2>/dev/null)" ]; then
+	echo "FAILED  cache (nothing was stored)"
+	failed=1
+fi
+
+(unset Y86SIM_NO_CACHE; XDG_CACHE_HOME="$tmp/cache" report $corpus) > "$tmp/cache2.csv"
+check "cache (loaded)" "$tmp/cache2.csv"
+
+# a source big enough to be assembled on several threads, with forward and backward
+# labels, data between the code, .align and a .pos part way through
+awk 'BEGIN {
+	n = 24000
+	print "main:"
+	for (i = 1; i <= n; i++) {
+		if (i == n / 2)
+			print ".pos 0x100000"
+		if (i % 1000 == 0)
+			print ".align 16"
+		printf "L%d:\n  irmovl L%d, %%eax\n  addl %%eax, %%ebx\n  jmp L%d\n  .long L%d\n", i, (i * 7) % n + 1, i + 1, (i * 13) % n + 1
+	}
+	printf "L%d:\n  wrint %%ebx\n  halt\n", n + 1
+}' > "$tmp/big.ys"
+
+for threads in 1 2 3 4 8; do
+	Y86SIM_ASM_THREADS=$threads ./y86sim --mem-size 0x200000 --emit-obj "$tmp/big$threads.obj" "$tmp/big.ys" >/dev/null 2>&1
+done
+
+if [ -s "$tmp/big1.obj" ] && ./y86sim --batch --engine callback --mem-size 0x200000 "$tmp/big1.obj" >/dev/null; then
+	echo "ok      big source assembled on one thread"
+else
+	echo "FAILED  big source assembled on one thread"
+	failed=1
+fi
+
+for threads in 2 3 4 8; do
+	if cmp -s "$tmp/big1.obj" "$tmp/big$threads.obj"; then
+		echo "ok      big source assembled on $threads threads"
+	else
+		echo "FAILED  big source assembled on $threads threads differs from one thread"
+		failed=1
+	fi
+done
+
+exit $failed
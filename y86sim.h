@@ -0,0 +1,74 @@
+// y86sim.h - Public interface of liby86sim, for running y86 programs from other programs
+#ifndef Y86SIM_H
+#define Y86SIM_H
+
+#include <stdint.h>
+
+/*
+  All of the state of one simulated machine (memory, registers, flags, PC, labels,
+  source lines, debugger settings and caches) lives in a Y86Machine, so any number
+  of them can be used at once, including from different threads as long as each
+  machine is only used by one thread at a time.
+*/
+typedef struct _Y86Machine Y86Machine;
+
+/*
+  Many copies (lanes) of one program run side by side, each with its own memory,
+  registers and I/O, for running a program over lots of different inputs. The lanes
+  execute in lockstep for as long as they are at the same instruction, using vector
+  instructions for the arithmetic, and split up and join again at conditional jumps.
+  See y86_new_lanes and y86_run_lanes.
+*/
+typedef struct _Y86Lanes Y86Lanes;
+
+/*
+  How a machine talks to the outside world. rdint/rdch call read_int/read_char with a
+  pointer to the register being read into, wrint/wrch call write_int/write_char, and
+  error is given a message whenever the assembler or an instruction reports an error.
+  ctx is passed to every hook. A new machine uses stdin, stdout and stderr.
+*/
+typedef struct _Y86IO {
+	void (*read_int)(void *ctx, uint32_t *reg);
+	void (*read_char)(void *ctx, uint32_t *reg);
+	void (*write_int)(void *ctx, uint32_t val);
+	void (*write_char)(void *ctx, uint32_t val);
+	void (*error)(void *ctx, const char *msg);
+	void *ctx;
+} Y86IO;
+
+// STATUS CODES RETURNED BY Y86_RUN (AND SIM_RUN) //
+#define STAT_AOK 1 // interrupted by Ctrl-C (see y86_interrupt), the program can carry on
+#define STAT_HLT 2 // executed halt, or ran off the end of memory
+#define STAT_ADR 3 // invalid memory access (out of bounds mrmovl/rmmovl, stack overflow)
+#define STAT_INS 4 // invalid instruction (unknown opcode or register number)
+#define STAT_BUDGET 5 // executed the maximum number of instructions it was given
+#define STAT_BREAK 6 // reached a breakpoint, watch condition or the end of a step
+
+// EXECUTION ENGINES (see y86_set_engine) //
+#define ENGINE_CALLBACK 0 // calls instrs[].cmd_callback for each instruction
+#define ENGINE_THREADED 1 // direct threaded interpreter (needs GCC labels as values)
+#define ENGINE_BLOCK 2 // runs cached basic blocks (the default)
+#define ENGINE_JIT 3 // block engine that compiles hot blocks to x86-64 code
+
+Y86Machine *y86_new_machine();
+void y86_free_machine(Y86Machine *m);
+void y86_set_io(Y86Machine *m, Y86IO *io);
+int y86_set_engine(Y86Machine *m, int engine);
+int y86_set_mem_size(Y86Machine *m, uint64_t size);
+int y86_load_file(Y86Machine *m, char *filename);
+int y86_run(Y86Machine *m, uint64_t max_instrs);
+void y86_interrupt(Y86Machine *m);
+uint32_t y86_get_reg(Y86Machine *m, int reg_num);
+uint32_t y86_get_pc(Y86Machine *m);
+uint64_t y86_get_instr_count(Y86Machine *m);
+const char *y86_get_fault_instr(Y86Machine *m);
+
+Y86Lanes *y86_new_lanes(Y86Machine *m, int num_lanes, Y86IO *io);
+void y86_free_lanes(Y86Lanes *l);
+int y86_run_lanes(Y86Lanes *l, uint64_t max_instrs);
+int y86_get_lane_status(Y86Lanes *l, int lane);
+uint64_t y86_get_lane_instr_count(Y86Lanes *l, int lane);
+uint32_t y86_get_lane_pc(Y86Lanes *l, int lane);
+uint32_t y86_get_lane_reg(Y86Lanes *l, int lane, int reg_num);
+
+#endif